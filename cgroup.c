@@ -0,0 +1,654 @@
+/*
+ * memtoy:  cgroup.c - cgroup v2 sandboxes
+ *
+ * create cgroups with memory and cpuset limits, move memtoy or its
+ * children into them, and watch one -- stats.c reports its memory
+ * statistics deltas around each command.  Cgroup names are paths
+ * relative to the cgroup2 mount.  Cgroups that memtoy creates are
+ * removed when it exits.
+ *
+ * All of this state belongs to the main thread:  command threads can't
+ * run 'cgroup', and stats.c skips cgroup statistics for them.  So
+ * there's no locking.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memtoy.h"
+
+#define CGROUP_VALSZ 256
+
+struct cgroup_dir {
+	struct cgroup_dir *cg_next;
+	char              *cg_name;
+	char              *cg_path;
+};
+
+static struct cgroup_dir *cgroups;	/* created by us, newest first */
+static struct cgroup_dir *cgroup_watch_dir;
+static struct cgroup_dir  cgroup_other;	/* watched, not ours */
+
+static char cgroup_root[PATH_MAX];	/* cgroup2 mount */
+static char cgroup_home[PATH_MAX];	/* where memtoy started */
+static char cgroup_self[PATH_MAX];	/* where memtoy moved, if not home */
+static char *cgroup_self_name;
+
+/*
+ * cgroup_setup() - find the cgroup2 mount and memtoy's own cgroup,
+ * once.  Returns 0 on success, -1 if there's no cgroup v2.
+ */
+static int
+cgroup_setup(void)
+{
+	glctx_t *gcp = &glctx;
+	FILE    *fp;
+	char     line[PATH_MAX + 64], mnt[PATH_MAX], type[32];
+
+	if (*cgroup_root)
+		return 0;
+
+	fp = fopen("/proc/self/mounts", "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp))
+			if (sscanf(line, "%*s %4095s %31s", mnt, type) == 2 &&
+			    !strcmp(type, "cgroup2")) {
+				strcpy(cgroup_root, mnt);
+				break;
+			}
+		fclose(fp);
+	}
+	if (!*cgroup_root) {
+		fprintf(stderr, "%s:  no cgroup2 file system mounted\n",
+			gcp->program_name);
+		return -1;
+	}
+
+	fp = fopen("/proc/self/cgroup", "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp))
+			if (!strncmp(line, "0::", 3)) {
+				line[strcspn(line, "\n")] = '\0';
+				snprintf(cgroup_home, sizeof(cgroup_home),
+					"%s%s", cgroup_root, line + 3);
+				break;
+			}
+		fclose(fp);
+	}
+	if (!*cgroup_home)
+		strcpy(cgroup_home, cgroup_root);
+
+	return 0;
+}
+
+/*
+ * cgroup_path() - path of cgroup 'name'; "-" is memtoy's own
+ */
+static int
+cgroup_path(char *name, char *path, size_t size)
+{
+	glctx_t *gcp = &glctx;
+
+	if (cgroup_setup() < 0)
+		return -1;
+
+	if (!strcmp(name, "-")) {
+		snprintf(path, size, "%s", cgroup_home);
+		return 0;
+	}
+
+	name += strspn(name, "/");
+	if (!*name || strstr(name, "..")) {
+		fprintf(stderr, "%s:  bad cgroup name:  %s\n",
+			gcp->program_name, name);
+		return -1;
+	}
+	if (snprintf(path, size, "%s/%s", cgroup_root, name) >= size) {
+		fprintf(stderr, "%s:  cgroup name too long\n",
+			gcp->program_name);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * cg_read() - read cgroup file 'file' of 'dir' into 'buf', with lines
+ * joined by "; ".  Returns -1, quietly, if the file can't be read.
+ */
+static int
+cg_read(char *dir, char *file, char *buf, size_t size)
+{
+	char    path[PATH_MAX];
+	ssize_t len;
+	char   *cp;
+	int     fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	while (len > 0 && buf[len - 1] == '\n')
+		--len;
+	buf[len] = '\0';
+	for (cp = buf; (cp = strchr(cp, '\n')); ) {
+		if (cp + 2 >= buf + size - 1)
+			*cp = '\0';
+		else {
+			memmove(cp + 2, cp + 1, strlen(cp + 1) + 1);
+			memcpy(cp, "; ", 2);
+		}
+	}
+	return 0;
+}
+
+/*
+ * cg_write() - write 'value' to cgroup file 'file' of 'dir'
+ */
+static int
+cg_write(char *dir, char *file, char *value)
+{
+	glctx_t *gcp = &glctx;
+	char     path[PATH_MAX];
+	int      fd, err;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		goto fail;
+	if (write(fd, value, strlen(value)) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		goto fail;
+	}
+	if (close(fd) == 0)
+		return 0;
+
+fail:
+	err = errno;
+	fprintf(stderr, "%s:  can't write '%s' to %s - %s\n",
+		gcp->program_name, value, path, strerror(err));
+	if (err == EBUSY && !strcmp(file, "cgroup.subtree_control"))
+		fprintf(stderr, "\tNote:  a cgroup with processes can't "
+			"enable controllers for its children\n");
+	errno = err;
+	return -1;
+}
+
+/*
+ * has_word() - does space separated list 'list' contain 'word'?
+ */
+static bool
+has_word(char *list, char *word)
+{
+	size_t len = strlen(word);
+	char  *cp;
+
+	for (cp = list; (cp = strstr(cp, word)); cp += len)
+		if ((cp == list || cp[-1] == ' ') &&
+		    (cp[len] == ' ' || cp[len] == '\0'))
+			return true;
+	return false;
+}
+
+/*
+ * enable_in() - enable 'controller' for the children of cgroup 'dir'
+ */
+static int
+enable_in(char *dir, char *controller)
+{
+	glctx_t *gcp = &glctx;
+	char     buf[CGROUP_VALSZ], enable[64];
+
+	if (cg_read(dir, "cgroup.subtree_control", buf, sizeof(buf)) == 0 &&
+	    has_word(buf, controller))
+		return 0;
+
+	if (cg_read(dir, "cgroup.controllers", buf, sizeof(buf)) < 0 ||
+	    !has_word(buf, controller)) {
+		fprintf(stderr, "%s:  cgroup controller %s not available "
+			"in %s\n", gcp->program_name, controller, dir);
+		return -1;
+	}
+
+	snprintf(enable, sizeof(enable), "+%s", controller);
+	return cg_write(dir, "cgroup.subtree_control", enable);
+}
+
+/*
+ * cgroup_enable() - enable 'controller' for cgroup 'path':  in the
+ * cgroup.subtree_control of each of its ancestors, from the root down.
+ */
+static int
+cgroup_enable(char *path, char *controller)
+{
+	char  dir[PATH_MAX];
+	char *slash = path + strlen(cgroup_root);
+
+	strcpy(dir, cgroup_root);
+	for (;;) {
+		if (enable_in(dir, controller) < 0)
+			return -1;
+		slash = strchr(slash + 1, '/');
+		if (!slash)
+			return 0;
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	}
+}
+
+static struct cgroup_dir *
+cgroup_find(char *path)
+{
+	struct cgroup_dir *cgp;
+
+	for (cgp = cgroups; cgp; cgp = cgp->cg_next)
+		if (!strcmp(cgp->cg_path, path))
+			return cgp;
+	return NULL;
+}
+
+/*
+ * cgroup_create() - create cgroup 'name' -- whose parent must exist --
+ * with the memory controller enabled.  Returns 0 on success, else -1.
+ */
+int
+cgroup_create(char *name)
+{
+	glctx_t *gcp = &glctx;
+	struct cgroup_dir *cgp;
+	char     path[PATH_MAX];
+	int      err;
+
+	if (cgroup_path(name, path, sizeof(path)) < 0)
+		return -1;
+	if (!strcmp(name, "-")) {
+		fprintf(stderr, "%s:  can't create memtoy's own cgroup\n",
+			gcp->program_name);
+		return -1;
+	}
+
+	if (access(path, F_OK) == 0) {
+		fprintf(stderr, "%s:  cgroup %s already exists\n",
+			gcp->program_name, name);
+		return -1;
+	}
+
+	cgp = calloc(1, sizeof(*cgp));
+	if (!cgp || !(cgp->cg_name = strdup(name)) ||
+	    !(cgp->cg_path = strdup(path))) {
+		fprintf(stderr, "%s:  can't allocate cgroup %s\n",
+			gcp->program_name, name);
+		goto fail;
+	}
+
+	if (mkdir(path, 0755) < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  can't create cgroup %s - %s\n",
+			gcp->program_name, path, strerror(err));
+		goto fail;
+	}
+
+	if (cgroup_enable(path, "memory") < 0) {
+		rmdir(path);
+		goto fail;
+	}
+
+	cgp->cg_next = cgroups;
+	cgroups = cgp;
+
+	vprint("%s:  created cgroup %s\n", gcp->program_name, path);
+	return 0;
+
+fail:
+	if (cgp) {
+		free(cgp->cg_name);
+		free(cgp->cg_path);
+		free(cgp);
+	}
+	return -1;
+}
+
+/*
+ * cgroup_set() - write 'value' to cgroup interface file 'file' -- e.g.,
+ * memory.high -- enabling the file's controller if need be.
+ */
+int
+cgroup_set(char *name, char *file, char *value)
+{
+	glctx_t *gcp = &glctx;
+	char     path[PATH_MAX], controller[64];
+	size_t   len;
+
+	if (cgroup_path(name, path, sizeof(path)) < 0)
+		return -1;
+
+	len = strcspn(file, ".");
+	if (!file[len] || strchr(file, '/') || len >= sizeof(controller)) {
+		fprintf(stderr, "%s:  bad cgroup file:  %s\n",
+			gcp->program_name, file);
+		return -1;
+	}
+	snprintf(controller, sizeof(controller), "%.*s", (int)len, file);
+
+	if (strcmp(controller, "cgroup") && access(path, F_OK) == 0) {
+		char buf[PATH_MAX];
+
+		snprintf(buf, sizeof(buf), "%s/%s", path, file);
+		if (access(buf, F_OK) < 0 &&
+		    cgroup_enable(path, controller) < 0)
+			return -1;
+	}
+
+	if (cg_write(path, file, value) < 0)
+		return -1;
+
+	vprint("%s:  cgroup %s %s = %s\n", gcp->program_name, name, file,
+		value);
+	return 0;
+}
+
+/*
+ * cgroup_move() - move process 'pid' into cgroup 'name'
+ */
+int
+cgroup_move(char *name, pid_t pid)
+{
+	glctx_t *gcp = &glctx;
+	char     path[PATH_MAX], value[32];
+
+	if (cgroup_path(name, path, sizeof(path)) < 0)
+		return -1;
+
+	snprintf(value, sizeof(value), "%d", pid);
+	if (cg_write(path, "cgroup.procs", value) < 0)
+		return -1;
+
+	if (pid == getpid()) {
+		free(cgroup_self_name);
+		cgroup_self_name = NULL;
+		*cgroup_self = '\0';
+		if (strcmp(path, cgroup_home) &&
+		    (cgroup_self_name = strdup(name)))
+			strcpy(cgroup_self, path);
+	}
+
+	vprint("%s:  moved pid %d to cgroup %s\n", gcp->program_name, pid,
+		path);
+	return 0;
+}
+
+/*
+ * cgroup_remove() - remove cgroup 'name', which must have no processes
+ */
+int
+cgroup_remove(char *name)
+{
+	glctx_t *gcp = &glctx;
+	struct cgroup_dir *cgp, **cgpp;
+	char     path[PATH_MAX];
+
+	if (cgroup_path(name, path, sizeof(path)) < 0)
+		return -1;
+
+	if (rmdir(path) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't remove cgroup %s - %s\n",
+			gcp->program_name, name, strerror(err));
+		return -1;
+	}
+
+	for (cgpp = &cgroups; (cgp = *cgpp); cgpp = &cgp->cg_next)
+		if (!strcmp(cgp->cg_path, path)) {
+			*cgpp = cgp->cg_next;
+			if (cgroup_watch_dir == cgp)
+				(void)cgroup_watch(NULL);
+			free(cgp->cg_name);
+			free(cgp->cg_path);
+			free(cgp);
+			break;
+		}
+	return 0;
+}
+
+/*
+ * cgroup_watch() - report deltas of cgroup 'name's memory statistics
+ * around each command; NULL => stop.
+ */
+int
+cgroup_watch(char *name)
+{
+	glctx_t *gcp = &glctx;
+	struct cgroup_dir *cgp;
+	char     path[PATH_MAX];
+
+	cgroup_watch_dir = NULL;
+	free(cgroup_other.cg_name);
+	free(cgroup_other.cg_path);
+	cgroup_other.cg_name = cgroup_other.cg_path = NULL;
+	if (!name)
+		return 0;
+
+	if (cgroup_path(name, path, sizeof(path)) < 0)
+		return -1;
+	if (access(path, F_OK) < 0) {
+		fprintf(stderr, "%s:  no such cgroup:  %s\n",
+			gcp->program_name, name);
+		return -1;
+	}
+
+	cgp = cgroup_find(path);
+	if (!cgp) {
+		cgp = &cgroup_other;
+		cgp->cg_name = strdup(name);
+		cgp->cg_path = strdup(path);
+		if (!cgp->cg_name || !cgp->cg_path) {
+			fprintf(stderr, "%s:  can't allocate cgroup %s\n",
+				gcp->program_name, name);
+			return cgroup_watch(NULL) - 1;
+		}
+	}
+	cgroup_watch_dir = cgp;
+	return 0;
+}
+
+/*
+ * cgroup_watched() - path of the watched cgroup, if any, and its name
+ */
+char *
+cgroup_watched(char **namep)
+{
+	struct cgroup_dir *cgp = cgroup_watch_dir;
+
+	if (!cgp)
+		return NULL;
+	if (namep)
+		*namep = cgp->cg_name;
+	return cgp->cg_path;
+}
+
+/*
+ * cgroup_current() - path of the cgroup memtoy moved itself to, if any,
+ * and its name
+ */
+char *
+cgroup_current(char **namep)
+{
+	if (!*cgroup_self)
+		return NULL;
+	if (namep)
+		*namep = cgroup_self_name;
+	return cgroup_self;
+}
+
+/*
+ * cgroup_file() - path of interface file 'file' of cgroup 'name'
+ */
+int
+cgroup_file(char *name, char *file, char *path, size_t size)
+{
+	char dir[PATH_MAX];
+
+	if (cgroup_path(name, dir, sizeof(dir)) < 0)
+		return -1;
+	snprintf(path, size, "%s/%s", dir, file);
+	return 0;
+}
+
+static int
+cgroup_nr_procs(char *dir)
+{
+	char  path[PATH_MAX], line[32];
+	FILE *fp;
+	int   nr_procs = 0;
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		++nr_procs;
+	fclose(fp);
+	return nr_procs;
+}
+
+/*
+ * cgroup_show() - show cgroup 'name' in detail or, if NULL, list the
+ * cgroups we created
+ */
+int
+cgroup_show(char *name)
+{
+	glctx_t *gcp = &glctx;
+	static char *files[] = {
+		"memory.current", "memory.min", "memory.low", "memory.high",
+		"memory.max", "memory.swap.max", "memory.peak",
+		"cpuset.mems", "cpuset.mems.effective", "memory.events",
+		"memory.pressure", NULL
+	};
+	struct cgroup_dir *cgp;
+	char     path[PATH_MAX], buf[CGROUP_VALSZ * 2];
+	char     current[CGROUP_VALSZ], high[CGROUP_VALSZ], max[CGROUP_VALSZ];
+	char   **filep;
+
+	if (name) {
+		if (cgroup_path(name, path, sizeof(path)) < 0)
+			return -1;
+		if (access(path, F_OK) < 0) {
+			fprintf(stderr, "%s:  no such cgroup:  %s\n",
+				gcp->program_name, name);
+			return -1;
+		}
+		printf("%s:  cgroup %s [%s], %d procs\n", gcp->program_name,
+			name, path, cgroup_nr_procs(path));
+		for (filep = files; *filep; ++filep)
+			if (cg_read(path, *filep, buf, sizeof(buf)) == 0)
+				printf("    %-22s %s\n", *filep, buf);
+		return 0;
+	}
+
+	if (!cgroups) {
+		printf("%s:  no cgroups\n", gcp->program_name);
+		return 0;
+	}
+
+	printf("  _procs_ ___current___ _____high____ _____max_____ name\n");
+	for (cgp = cgroups; cgp; cgp = cgp->cg_next) {
+		if (cg_read(cgp->cg_path, "memory.current", current,
+				sizeof(current)) < 0)
+			strcpy(current, "-");
+		if (cg_read(cgp->cg_path, "memory.high", high,
+				sizeof(high)) < 0)
+			strcpy(high, "-");
+		if (cg_read(cgp->cg_path, "memory.max", max, sizeof(max)) < 0)
+			strcpy(max, "-");
+		printf("  %7d %13s %13s %13s %s%s\n",
+			cgroup_nr_procs(cgp->cg_path), current, high, max,
+			cgp->cg_name, cgp == cgroup_watch_dir ? " [watched]" : "");
+	}
+	return 0;
+}
+
+/*
+ * cgroup_fini() - forget the parent's cgroups in a fork()ed child:
+ * they're the parent's to remove.
+ */
+void
+cgroup_fini(void)
+{
+	cgroups = NULL;
+	(void)cgroup_watch(NULL);
+	free(cgroup_self_name);
+	cgroup_self_name = NULL;
+	*cgroup_self = '\0';
+}
+
+/*
+ * cgroup_cleanup() - at exit:  move memtoy home and remove the cgroups
+ * it created.  Those still holding processes are left behind.
+ */
+void
+cgroup_cleanup(void)
+{
+	glctx_t *gcp = &glctx;
+	struct cgroup_dir *cgp;
+	char     value[32];
+
+	if (*cgroup_self) {
+		snprintf(value, sizeof(value), "%d", getpid());
+		(void)cg_write(cgroup_home, "cgroup.procs", value);
+		*cgroup_self = '\0';
+	}
+
+	(void)cgroup_watch(NULL);
+	while ((cgp = cgroups)) {
+		int tries;
+
+		/*
+		 * children that cleanup just killed may take a moment
+		 * to leave
+		 */
+		cgroups = cgp->cg_next;
+		for (tries = 0; rmdir(cgp->cg_path) < 0; ++tries) {
+			int err = errno;
+
+			if (err == EBUSY && tries < 100) {
+				usleep(10000);
+				continue;
+			}
+			fprintf(stderr, "%s:  left cgroup %s - %s\n",
+				gcp->program_name, cgp->cg_path,
+				strerror(err));
+			break;
+		}
+		free(cgp->cg_name);
+		free(cgp->cg_path);
+		free(cgp);
+	}
+}
@@ -25,21 +25,32 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
  */
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <math.h>
 #define migratepages migrate_pages	/* fix RHEL5 header snafu */
 #include <numaif.h>
 #include <numa.h>
 #include <sched.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <readline/readline.h>
@@ -48,17 +59,21 @@
 #include "memtoy.h"
 #include "migrate_pages.h"
 
-#define CMD_SUCCESS 0
-#define CMD_ERROR   1
-
-char *whitespace = " \t";
+#define CMDBUFSZ 256
 
 /*
  * =========================================================================
  */
-static int help_me(char *);	/* forward reference */
-
-static char program_name[128];	/* enough? */
+static int help_me(char *);	/* forward references */
+static int parse_command(char *);
+static int parse_command_result(char *, child_result_t *);
+static char *read_command_line(char *);
+static char *cmd_trim(char *);
+static void cmd_free(char *);
+static int run_command_line(char *);
+
+static __thread char program_name[128];	/* enough? */
+static __thread char *last_cmd_name;	/* for command results */
 static void
 set_program_name()
 {
@@ -67,8 +82,14 @@ set_program_name()
 	if (!gcp->child_name)
 		return;		/* parent */
 
-	snprintf(program_name, 128UL, "%s(%s)", gcp->program_name,
+	char name[128];
+
+	/*
+	 * a grandchild's gcp->program_name is its parent's program_name[]
+	 */
+	snprintf(name, sizeof(name), "%s(%s)", gcp->program_name,
 			gcp->child_name);
+	strcpy(program_name, name);
 	gcp->program_name = program_name;
 }
 
@@ -199,6 +220,104 @@ get_range(char *args, range_t *range, char **nextarg)
 	return CMD_SUCCESS;
 }
 
+/*
+ * get_doubling_range() - parse a '<key>=[<min>..]<max>' arg, whose
+ * '<key>=' is 'keylen' chars, for a sweep that doubles from <min> [1] to
+ * <max>.  See doubling_next().
+ */
+static int
+get_doubling_range(char *arg, size_t keylen, int *minp, int *maxp)
+{
+	glctx_t *gcp = &glctx;
+	char    *end;
+	long     min = 1, max;
+
+	max = strtol(arg + keylen, &end, 0);
+	if (end[0] == '.' && end[1] == '.') {
+		min = max;
+		max = strtol(end + 2, &end, 0);
+	}
+	if (*end != '\0' || min < 1 || max < min || max > INT_MAX) {
+		fprintf(stderr, "%s:  expected %.*s[<min>..]<max>, not %s\n",
+			gcp->program_name, (int)keylen, arg, arg);
+		return CMD_ERROR;
+	}
+
+	*minp = min;
+	*maxp = max;
+	return CMD_SUCCESS;
+}
+
+/*
+ * doubling_next() - the step after 'n' in a sweep that doubles up to, and
+ * ends exactly at, 'max'.  A sweep from 0 steps to 1.
+ */
+static int
+doubling_next(int n, int max)
+{
+	if (!n)
+		return 1;
+	return n * 2 < max ? n * 2 : max;
+}
+
+/*
+ * leading_numeric_args() - count whitespace separated args, starting at
+ * 'args', that start with a digit.  For commands where an optional range
+ * precedes another numeric argument.
+ */
+static int
+leading_numeric_args(char *args)
+{
+	int count = 0;
+
+	args += strspn(args, whitespace);
+	while (isdigit(*args)) {
+		++count;
+		args += strcspn(args, whitespace);
+		args += strspn(args, whitespace);
+	}
+	return count;
+}
+
+/*
+ * get_threads_arg() - look for trailing 'threads=<n>' argument.
+ * remove it from 'args' so that preceding args parse as usual.
+ *
+ * returns # threads [default 1], or -1 on error
+ */
+static int
+get_threads_arg(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *arg, *next;
+	long     nr_threads;
+
+	for (arg = strstr(args, "threads="); arg != NULL;
+	     arg = strstr(arg + 1, "threads=")) {
+		if (arg == args || strchr(whitespace, *(arg - 1)))
+			break;		/* at start of an argument */
+	}
+	if (arg == NULL)
+		return 1;
+
+	nr_threads = strtol(arg + strlen("threads="), &next, 0);
+	if (nr_threads < 1 || nr_threads > CPU_SETSIZE ||
+	    *(next + strspn(next, whitespace)) != '\0') {
+		fprintf(stderr, "%s:  'threads=<n>' must be last argument and"
+			" 1 <= <n> <= %d\n", gcp->program_name, CPU_SETSIZE);
+		return -1;
+	}
+
+	/*
+	 * truncate args before 'threads=' and trailing whitespace
+	 */
+	while (arg > args && strchr(whitespace, *(arg - 1)))
+		--arg;
+	*arg = '\0';
+
+	return nr_threads;
+}
+
 /*
  * get_shared() - check for "shared"|"private"
  * return corresponding MAP_ flag or zero [no arg]
@@ -306,6 +425,20 @@ refresh_cpus_allowed(glctx_t *gcp)
 		gcp->cpus_allowed);
 }
 
+/*
+ * nr_cpus_allowed() - how many cpus we may run on; at least 1
+ */
+static int
+nr_cpus_allowed(void)
+{
+	cpu_set_t allowed;
+
+	if (!sched_getaffinity(0, sizeof(allowed), &allowed) &&
+	    CPU_COUNT(&allowed))
+		return CPU_COUNT(&allowed);
+	return 1;
+}
+
 /*
  * get_cpuset_from_mask() - get cpuset from a comma-separated
  * list of hex masks, up to 32-bits per "chunk"
@@ -478,7 +611,7 @@ get_mbind_policy(char *args, char **nextarg)
 
 	fprintf(stderr, "%s:  unrecognized policy %s\n",
 		gcp->program_name, pol);
-	return CMD_ERROR;
+	return -1;	/* CMD_ERROR == MPOL_PREFERRED */
 }
 
 /*
@@ -774,13 +907,18 @@ not_implemented()
 /*
  * command:  quit
  */
-static void child_respond(void);
+static void thread_exit(int);	/* forward reference */
 static int
 quit(char *args)
 {
 	glctx_t *gcp = &glctx;
 
-	child_respond();
+	/*
+	 * children don't respond:  parent sees EOF and reaps us
+	 */
+	if (gcp->cmd_thread)
+		thread_exit(0);
+
 	exit(0);	/* let cleanup() do its thing */
 }
 
@@ -792,7 +930,11 @@ show_pid(char *args)
 {
 	glctx_t *gcp = &glctx;
 	
-	printf("%s:  pid = %d\n", gcp->program_name, getpid());
+	if (gcp->cmd_thread)
+		printf("%s:  pid = %d, tid = %ld\n", gcp->program_name,
+			getpid(), (long)syscall(SYS_gettid));
+	else
+		printf("%s:  pid = %d\n", gcp->program_name, getpid());
 
 	return CMD_SUCCESS;
 }
@@ -811,6 +953,167 @@ pause_me(char *args)
 	return CMD_SUCCESS;
 }
 
+/*
+ * numa_matrix() - 'numa matrix [<size>]':  measure pointer chase latency
+ * and sequential read bandwidth from each node with cpus to each memory
+ * node, and show them beside the kernel's [SLIT] numa_distance().
+ */
+#define MATRIX_SEGNAME "_matrix"
+#define MATRIX_SIZE (64UL << 20)	/* well beyond LLC, we hope */
+static int
+numa_matrix(char *args)
+{
+	glctx_t       *gcp = &glctx;
+	unsigned int  *memids, *cpuids;
+	cpu_set_t     *node_cpus, saved_cpus;
+	double        *latency = NULL, *bandwidth = NULL;
+	size_t         size = MATRIX_SIZE;
+	unsigned long  saved_options = gcp->options;
+	int            nr_mems, nr_cpus = 0, node, c, m;
+	int            ret = CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if (*args != '\0') {
+		char *nextarg;
+
+		args = strtok_r(args, whitespace, &nextarg);
+		size = get_scaled_value(args, "size");
+		if (size == BOGUS_SIZE)
+			return CMD_ERROR;
+	}
+
+	memids    = calloc(gcp->numa_max_node + 1, sizeof(*memids));
+	cpuids    = calloc(gcp->numa_max_node + 1, sizeof(*cpuids));
+	node_cpus = calloc(gcp->numa_max_node + 1, sizeof(*node_cpus));
+	if (!memids || !cpuids || !node_cpus)
+		goto out_free;
+
+	nr_mems = get_current_nodeid_list(memids);
+	if (nr_mems <= 0)
+		goto out_free;
+
+	/*
+	 * cpu nodes:  nodes with cpus that we're allowed to run on
+	 */
+	refresh_cpus_allowed(gcp);
+	for (node = 0; node <= gcp->numa_max_node; ++node) {
+		cpu_set_t *csp = &node_cpus[nr_cpus];
+
+		CPU_ZERO(csp);
+		if (numa_node_to_cpus(node, (unsigned long *)csp,
+					sizeof(*csp)))
+			continue;
+		CPU_AND(csp, csp, gcp->cpus_allowed);
+		if (CPU_COUNT(csp))
+			cpuids[nr_cpus++] = node;
+	}
+	if (!nr_cpus) {
+		fprintf(stderr, "%s:  no allowed cpus on any node?\n",
+			gcp->program_name);
+		goto out_free;
+	}
+
+	latency   = calloc(nr_cpus * nr_mems, sizeof(*latency));
+	bandwidth = calloc(nr_cpus * nr_mems, sizeof(*bandwidth));
+	if (!latency || !bandwidth)
+		goto out_free_results;
+
+	saved_cpus = *gcp->cpus_allowed;
+	set_option(QUIET);
+
+	/*
+	 * populate a scratch segment bound to each memory node once,
+	 * then visit it from each cpu node.
+	 */
+	for (m = 0; m < nr_mems; ++m) {
+		range_t       range = { 0L, 0L };
+		nodemask_t    nodemask;
+		seg_extent_t  extent;
+
+		range.length = size;
+		nodemask_zero(&nodemask);
+		nodemask_set(&nodemask, memids[m]);
+		if (!segment_register(SEGT_ANON, MATRIX_SEGNAME, &range,
+					MAP_PRIVATE))
+			goto out_restore;
+		range.length = 0L;
+		if (!segment_map(MATRIX_SEGNAME, &range, 0) ||
+		    !segment_mbind(MATRIX_SEGNAME, &range, MPOL_BIND,
+				   &nodemask, 0, 1) ||
+		    !segment_touch(MATRIX_SEGNAME, &range, 1, 0) ||
+		    !segment_extent(MATRIX_SEGNAME, &extent)) {
+			segment_remove(MATRIX_SEGNAME);
+			goto out_restore;
+		}
+
+		for (c = 0; c < nr_cpus; ++c) {
+			double *latp = &latency[c * nr_mems + m];
+			double *bwp  = &bandwidth[c * nr_mems + m];
+
+			(void)sched_setaffinity(0, sizeof(node_cpus[c]),
+						&node_cpus[c]);
+			*latp = chase_latency((char *)extent.se_start,
+						extent.se_length);
+			*bwp  = stream_bandwidth(
+					(unsigned long *)extent.se_start,
+					extent.se_length);
+			if (signalled(gcp))
+				break;
+		}
+		segment_remove(MATRIX_SEGNAME);
+
+		if (signalled(gcp)) {
+			reset_signal();
+			goto out_restore;
+		}
+	}
+
+	printf("%s:  numa matrix - %ldk per memory node\n",
+		gcp->program_name, size / 1024);
+	printf("  cpu  mem  latency[ns]  bandwidth[GB/s]  distance  "
+		"measured\n");
+	for (c = 0; c < nr_cpus; ++c) {
+		double local = 0.0;
+
+		/*
+		 * "measured" distance:  latency relative to the cpu node's
+		 * own memory, or its nearest, scaled to SLIT's local = 10.
+		 */
+		for (m = 0; m < nr_mems; ++m) {
+			double lat = latency[c * nr_mems + m];
+
+			if (memids[m] == cpuids[c]) {
+				local = lat;
+				break;
+			}
+			if (local == 0.0 || lat < local)
+				local = lat;
+		}
+
+		for (m = 0; m < nr_mems; ++m)
+			printf("  %3d  %3d  %11.1f  %15.3f  %8d  %8.1f\n",
+				cpuids[c], memids[m],
+				latency[c * nr_mems + m],
+				bandwidth[c * nr_mems + m],
+				numa_distance(cpuids[c], memids[m]),
+				local > 0.0 ?
+				  10.0 * latency[c * nr_mems + m] / local : 0.0);
+	}
+	ret = CMD_SUCCESS;
+
+out_restore:
+	gcp->options = saved_options;
+	(void)sched_setaffinity(0, sizeof(saved_cpus), &saved_cpus);
+out_free_results:
+	free(bandwidth);
+	free(latency);
+out_free:
+	free(node_cpus);
+	free(cpuids);
+	free(memids);
+	return ret;
+}
+
 /*
  * command:  numa
  */
@@ -827,6 +1130,18 @@ numa_info(char *args)
 	if (!numa_supported(gcp))
 		return CMD_ERROR;
 
+	args += strspn(args, whitespace);
+	if (*args != '\0') {
+		char *nextarg, *what = strtok_r(args, whitespace, &nextarg);
+
+		if (strncasecmp(what, "matrix", strlen(what))) {
+			fprintf(stderr, "%s:  unrecognized numa argument: %s\n",
+				gcp->program_name, what);
+			return CMD_ERROR;
+		}
+		return numa_matrix(nextarg);
+	}
+
 	nodeids   = calloc(gcp->numa_max_node, sizeof(*nodeids));
 	nr_nodes  = get_current_nodeid_list(nodeids);
 	if(nr_nodes < 0)
@@ -855,13 +1170,15 @@ numa_info(char *args)
 }
 
 /*
- * command:  migrate <to-node-id[s]> [<from-node-id[s]>]
+ * command:  migrate <to-node-id[s]> [<from-node-id[s]>] [pid=<pid>|/<child>]
  *
  * Node id[s] - single node id or comma-separated list
  * <to-node-id[s]> - 1-for-1 with <from-node-id[s]>, OR
  * if <from-node-id[s]> omitted, <to-node-id[s]> must be
  * a single node id.
+ * pid= migrates another process -- e.g., a child -- instead of memtoy.
  */
+static pid_t get_child_pid(char *);	/* forward reference */
 static int
 migrate_process(char *args)
 {
@@ -869,7 +1186,8 @@ migrate_process(char *args)
 	nodemask_t     *from_nodes = NULL, *to_nodes = NULL;
 	char          *idlist, *nextarg;
 	struct timeval t_start, t_end;
-	int            nr_to, nr_from;
+	pid_t          pid = 0;
+	int            nr_to, nr_from = 0;
 	int            nr_not_migrated;
 	int            ret = CMD_ERROR;
 	
@@ -887,15 +1205,28 @@ migrate_process(char *args)
 		goto out_free;
 	args = nextarg + strspn(nextarg, whitespace);
 
-	if (*args != '\0') {
-		/*
-		 * apparently, <from-node-id[s]> present
-		 */
+	while (*args != '\0') {
 		idlist = strtok_r(args, whitespace, &nextarg);
-		nr_from = get_nodemask(idlist, &from_nodes);
-		if (nr_from < 0)
+		if (!strncmp(idlist, "pid=", 4)) {
+			pid = get_child_pid(idlist + 4);
+			if (pid < 0)
+				goto out_free;
+		} else if (!from_nodes) {
+			/*
+			 * apparently, <from-node-id[s]> present
+			 */
+			nr_from = get_nodemask(idlist, &from_nodes);
+			if (nr_from < 0)
+				goto out_free;
+		} else {
+			fprintf(stderr, "%s:  unrecognized migrate argument: "
+				"%s\n", gcp->program_name, idlist);
 			goto out_free;
-	} else {
+		}
+		args = nextarg + strspn(nextarg, whitespace);
+	}
+
+	if (!from_nodes) {
 		int i;
 
 #if 0
@@ -922,7 +1253,7 @@ migrate_process(char *args)
 	}
 
 	gettimeofday(&t_start, NULL);
-	nr_not_migrated = migrate_pages(getpid(), NUMA_NUM_NODES,
+	nr_not_migrated = migrate_pages(pid ? pid : getpid(), NUMA_NUM_NODES,
 					 from_nodes->n, to_nodes->n);
 	if (nr_not_migrated < 0) {
 		int err = errno;
@@ -931,11 +1262,15 @@ migrate_process(char *args)
 		goto out_free;
 	}
 	gettimeofday(&t_end, NULL);
-
-	printf("%s:  migration took %6.3fsecs.  %d pages could not be migrated\n",
-		gcp->program_name,
-		(float)(tv_diff_usec(&t_start, &t_end))/1000000.0,
-		nr_not_migrated);
+	result_record("migrate_pages", tv_diff_usec(&t_start, &t_end), 0,
+			gcp->pagesize, nr_not_migrated);
+
+	if (!is_option(QUIET))
+		printf("%s:  migration took %6.3fsecs.  "
+			"%d pages could not be migrated\n",
+			gcp->program_name,
+			(float)(tv_diff_usec(&t_start, &t_end))/1000000.0,
+			nr_not_migrated);
 	ret = CMD_SUCCESS;
 
 out_free:
@@ -1107,6 +1442,7 @@ touch_seg(char *args)
 
 	char *segname, *nextarg;
 	range_t range = { 0L, 0L };
+	unsigned int seconds = 0;
 	int axcs;
 
 	args += strspn(args, whitespace);
@@ -1122,11 +1458,29 @@ touch_seg(char *args)
 		return CMD_ERROR;
 	args = nextarg;
 
-	axcs = get_access(args);
-	if (axcs == AXCS_ERR)
-		return CMD_ERROR;
+	/*
+	 * [read|write] and for=<seconds> are optional
+	 */
+	axcs = AXCS_READ;
+	while (*args != '\0') {
+		args = strtok_r(args, whitespace, &nextarg);
+
+		if (!strncasecmp(args, "for=", 4)) {
+			seconds = get_arg_seconds(args + 4);
+			if (seconds == BOGUS_SECONDS || !seconds) {
+				fprintf(stderr, "%s:  bogus seconds:  %s\n",
+					gcp->program_name, args + 4);
+				return CMD_ERROR;
+			}
+		} else {
+			axcs = get_access(args);
+			if (axcs == AXCS_ERR)
+				return CMD_ERROR;
+		}
+		args = nextarg + strspn(nextarg, whitespace);
+	}
 
-	if (!segment_touch(segname, &range, (axcs == AXCS_WRITE)))
+	if (!segment_touch(segname, &range, (axcs == AXCS_WRITE), seconds))
 		return CMD_ERROR;
 
 	return CMD_SUCCESS;
@@ -1212,6 +1566,7 @@ mbind_seg(char *args)
 	nodemask_t *nodemask = NULL;
 	int         nr_nodes = 0;
 	int         policy, flags = 0;
+	int         nr_threads;
 	int         ret;
 
 	if (!numa_supported(gcp))
@@ -1223,6 +1578,10 @@ mbind_seg(char *args)
 	segname = strtok_r(args, whitespace, &nextarg);
 	args = nextarg + strspn(nextarg, whitespace);
 
+	nr_threads = get_threads_arg(args);
+	if (nr_threads < 0)
+		return CMD_ERROR;
+
 	/*
 	 * offset, length are optional
 	 */
@@ -1251,7 +1610,8 @@ mbind_seg(char *args)
 
 	ret = CMD_SUCCESS;
 #if 1	// for testing
-	if (!segment_mbind(segname, &range, policy, nodemask, flags))
+	if (!segment_mbind(segname, &range, policy, nodemask, flags,
+				nr_threads))
 		ret = CMD_ERROR;
 #endif
 
@@ -1261,79 +1621,540 @@ mbind_seg(char *args)
 }
 
 /*
- *  command:  shmem <seg-name> <seg-size>[k|m|g|p] [huge]
- *
- * create [shmget] and register a SysV shared memory segment
- * of specified size
+ * command:  movepages [/<child>:]<seg-name> [<offset>[kmgp] <length>[kmgp]]
+ *                     <node/list> [batch=<n>|sweep] [all] [threads=<n>]
  */
+static child_t *child_find_by_name(char *);	/* forward references */
+static int child_extent(child_t *, char *, seg_extent_t *);
 static int
-shmem_seg(char *args)
+movepages_seg(char *args)
 {
 	glctx_t *gcp = &glctx;
-	
-	char *segname, *nextarg;
-	range_t range = { 0L, 0L };
-	int segflag = MAP_SHARED;
 
-	args += strspn(args, whitespace);
+	char       *segname, *nextarg, *idlist;
+	range_t     range = { 0L, 0L };
+	nodemask_t *nodemask = NULL;
+	long        batch = 0;
+	int         flags = MPOL_MF_MOVE;
+	int         nr_threads = 1;
+	int         ret = CMD_ERROR;
+
+	if (!numa_supported(gcp))
+		return CMD_ERROR;
 
+	args += strspn(args, whitespace);
 	if(!required_arg(args, "<seg-name>"))
 		return CMD_ERROR;
 	segname = strtok_r(args, whitespace, &nextarg);
 	args = nextarg + strspn(nextarg, whitespace);
 
-	if(!required_arg(args, "<size>"))
+	/*
+	 * offset, length are optional, but <node/list> also starts
+	 * with a digit.  Range present only if followed by a node list.
+	 */
+	if (leading_numeric_args(args) > 2) {
+		if (get_range(args, &range, &nextarg) == CMD_ERROR)
+			return CMD_ERROR;
+		args = nextarg;
+	}
+
+	if(!required_arg(args, "<node/list>"))
 		return CMD_ERROR;
-	args = strtok_r(args, whitespace, &nextarg);
-	range.length = get_scaled_value(args, "size");
-	if (range.length == BOGUS_SIZE)
+	idlist = strtok_r(args, whitespace, &nextarg);
+	if (get_nodemask(idlist, &nodemask) < 0)
 		return CMD_ERROR;
 	args = nextarg + strspn(nextarg, whitespace);
 
-	if (*args) {
-		char *option = args;
-		option = strtok_r(args, whitespace, &nextarg);
-		if (!strncasecmp(option, "huge", strlen(option)))
-			segflag |= MEMTOY_MAP_HUGE;
+	/* optional args */
+	while (*args != '\0') {
+		char *value, *name;
+
+		args = strtok_r(args, whitespace, &nextarg);
+
+		if (!strcasecmp(args, "all")) {
+			flags = MPOL_MF_MOVE_ALL;
+			goto next;
+		}
+		if (!strcasecmp(args, "sweep")) {
+			batch = MOVE_PAGES_SWEEP;
+			goto next;
+		}
+
+		/* name=value argument */
+		name = strtok_r(args, "=", &value);
+		if (!strcasecmp(name, "batch") && *value != '\0') {
+			char *next;
+
+			if (!strcasecmp(value, "sweep")) {
+				batch = MOVE_PAGES_SWEEP;
+				goto next;
+			}
+			batch = strtol(value, &next, 0);
+			if (*next == '\0' && batch > 0)
+				goto next;
+			fprintf(stderr, "%s:  batch must be a positive integer"
+				" or 'sweep'\n", gcp->program_name);
+			goto out_free;
+		}
+		if (!strcasecmp(name, "threads") && *value != '\0') {
+			char *next;
+
+			nr_threads = strtol(value, &next, 0);
+			if (*next == '\0' && nr_threads > 0 &&
+			    nr_threads <= CPU_SETSIZE)
+				goto next;
+			fprintf(stderr, "%s:  threads must be 1 .. %d\n",
+				gcp->program_name, CPU_SETSIZE);
+			goto out_free;
+		}
+
+		fprintf(stderr, "%s:  unrecognized movepages argument: %s\n",
+			gcp->program_name, args);
+		goto out_free;
+	next:
 		args = nextarg + strspn(nextarg, whitespace);
 	}
 
-	if (!segment_register(SEGT_SHM, segname, &range, segflag))
-		return CMD_ERROR;
+	if (*segname == '/') {
+		/*
+		 * a child's segment:  /<child>:<seg-name>
+		 */
+		seg_extent_t extent;
+		child_t     *childp;
+		char        *child_seg = strchr(segname, ':');
 
-	return CMD_SUCCESS;
+		if (!child_seg) {
+			fprintf(stderr, "%s:  expected /<child>:<seg-name>\n",
+				gcp->program_name);
+			goto out_free;
+		}
+		*child_seg++ = '\0';
+		childp = child_find_by_name(segname + 1);
+		if (!childp) {
+			fprintf(stderr, "%s:  I don't have a child named %s\n",
+				gcp->program_name, segname + 1);
+			goto out_free;
+		}
+		if (child_extent(childp, child_seg, &extent) == CMD_ERROR ||
+		    !segment_extent_range(&extent, &range, child_seg))
+			goto out_free;
+		*(child_seg - 1) = ':';	/* for reports */
+		if (segment_move_pages_pid(childp->c_pid, segname + 1, &extent,
+					nodemask, batch, flags, nr_threads))
+			ret = CMD_SUCCESS;
+	} else if (segment_move_pages(segname, &range, nodemask, batch, flags,
+				nr_threads))
+		ret = CMD_SUCCESS;
+
+out_free:
+	free(nodemask);
+	return ret;
 }
 
 /*
- * command:  where <seg-name> [<offset>[kmgp] <length>[kmgp]]  
+ * command:  migbench <size>[kmgp] [<seg-type/list>] [<node/list>]
  *
- * show node location of specified range of segment.
- *
- * NOTE: if neither <offset> nor <length> specified, <offset> defaults
- * to 0 [start of segment], as usual, and length defaults to 64 pages 
- * rather than the entire segment.  Suitable for a "quick look" at where
- * segment resides.
+ * compare migration methods:  for each segment type and each ordered
+ * pair of nodes, populate a fresh segment of <size> on the source node,
+ * migrate it to the destination via migrate_pages(), mbind()+MOVE and
+ * move_pages(), verify placement and report throughput.
+ */
+enum migbench_type {
+	MIGB_ANON,
+	MIGB_FILE,
+	MIGB_SHM,
+	MIGB_HUGE,
+	MIGB_NR_TYPES
+};
+static char *migbench_types[MIGB_NR_TYPES] = {
+	"anon", "file", "shm", "huge"
+};
+
+enum migbench_method {
+	MIGB_MIGRATE_PAGES,
+	MIGB_MBIND,
+	MIGB_MOVE_PAGES,
+	MIGB_NR_METHODS
+};
+static char *migbench_methods[MIGB_NR_METHODS] = {
+	"migrate_pages", "mbind+move", "move_pages"
+};
+
+#define MIGB_SEGNAME "_migbench"
+
+/*
+ * get_migbench_types() - parse comma-separated list of segment types
+ * into a bit mask.  Returns 0 on error.
  */
 static int
-where_seg(char *args)
+get_migbench_types(char *args)
 {
 	glctx_t *gcp = &glctx;
-	
-	char  *segname, *nextarg;
-	range_t range = { 0L, 0L };
-	int    ret;
+	char    *type, *nextarg;
+	int      types = 0;
+
+	for (type = strtok_r(args, ",", &nextarg); type;
+	     type = strtok_r(NULL, ",", &nextarg)) {
+		int t;
+
+		for (t = 0; t < MIGB_NR_TYPES; ++t)
+			if (!strncasecmp(type, migbench_types[t], strlen(type)))
+				break;
+		if (t == MIGB_NR_TYPES) {
+			fprintf(stderr, "%s:  unrecognized segment type: %s\n",
+				gcp->program_name, type);
+			return 0;
+		}
+		types |= 1 << t;
+	}
+	return types;
+}
 
-	if (!numa_supported(gcp))
-		return CMD_ERROR;
+/*
+ * migbench_populate() - fault in all of segment 'segname' on node 'src'
+ * by binding the task policy there for the duration of the touch.
+ */
+static int
+migbench_populate(char *segname, int src)
+{
+	glctx_t    *gcp = &glctx;
+	nodemask_t  saved, srcmask;
+	range_t     range = { 0L, 0L };
+	int         policy, ret;
 
-	args += strspn(args, whitespace);
-	if(!required_arg(args, "<seg-name>"))
+	if (get_mempolicy(&policy, saved.n, NUMA_NUM_NODES, 0, 0) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  get_mempolicy() failed - %s\n",
+			gcp->program_name, strerror(err));
 		return CMD_ERROR;
-	segname = strtok_r(args, whitespace, &nextarg);
-	args = nextarg + strspn(nextarg, whitespace);
+	}
 
-	/*
-	 * offset, length are optional
+	nodemask_zero(&srcmask);
+	nodemask_set(&srcmask, src);
+	if (set_mempolicy(MPOL_BIND, srcmask.n, NUMA_NUM_NODES) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  set_mempolicy() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return CMD_ERROR;
+	}
+
+	ret = segment_touch(segname, &range, 1, 0) ? CMD_SUCCESS : CMD_ERROR;
+
+	(void)set_mempolicy(policy, saved.n, NUMA_NUM_NODES);
+	return ret;
+}
+
+/*
+ * migbench_one() - one segment type, one node pair, one method.
+ * Returns throughput in GB/s, or a negative value if the measurement
+ * couldn't be made.  '*missed' returns # pages not found on 'dst'.
+ */
+static double
+migbench_one(int type, size_t size, int src, int dst, int method,
+		unsigned long *missed)
+{
+	glctx_t       *gcp = &glctx;
+	char           path[PATH_MAX];
+	char          *tmpdir, *regname = MIGB_SEGNAME;
+	range_t        range = { 0L, 0L };
+	nodemask_t     srcmask, dstmask;
+	seg_type_t     segtype = SEGT_ANON;
+	int            segflag = MAP_PRIVATE;
+	unsigned long  nr_pages;
+	size_t         pagesize;
+	long           nr_src, nr_dst, usecs = -1;
+	double         gbps = -1.0;
+
+	range.length = size;
+	switch (type) {
+	case MIGB_FILE: {
+		int fd;
+
+		tmpdir = getenv("TMPDIR");
+		snprintf(path, sizeof(path), "%s/%s-XXXXXX",
+			 tmpdir ? tmpdir : "/var/tmp", MIGB_SEGNAME);
+		fd = mkstemp(path);
+		if (fd < 0 || ftruncate(fd, size) < 0) {
+			int err = errno;
+			fprintf(stderr, "%s:  can't create %s - %s\n",
+				gcp->program_name, path, strerror(err));
+			if (fd >= 0) {
+				close(fd);
+				unlink(path);
+			}
+			return -1.0;
+		}
+		close(fd);
+		regname = path;
+		segtype = SEGT_FILE;
+		segflag = MAP_SHARED;
+		break;
+	}
+	case MIGB_SHM:
+		segtype = SEGT_SHM;
+		segflag = MAP_SHARED;
+		break;
+	case MIGB_HUGE:
+		segtype = SEGT_SHM;
+		segflag = MAP_SHARED | MEMTOY_MAP_HUGE;
+		break;
+	}
+
+	if (!segment_register(segtype, regname, &range, segflag))
+		goto out_unlink;
+	range.length = 0L;
+	if (!segment_map(basename(regname), &range, 0))
+		goto out_remove;
+
+	if (migbench_populate(basename(regname), src) != CMD_SUCCESS)
+		goto out_remove;
+	nr_src = segment_node_pages(basename(regname), src, &nr_pages,
+					&pagesize);
+	if (nr_src < 0)
+		goto out_remove;
+	if (nr_src != nr_pages)
+		fprintf(stderr, "%s:  %s segment:  only %ld of %lu pages "
+			"populated on node %d\n", gcp->program_name,
+			migbench_types[type], nr_src, nr_pages, src);
+
+	nodemask_zero(&srcmask);
+	nodemask_set(&srcmask, src);
+	nodemask_zero(&dstmask);
+	nodemask_set(&dstmask, dst);
+
+	switch (method) {
+	case MIGB_MIGRATE_PAGES: {
+		struct timeval t_start, t_end;
+
+		gettimeofday(&t_start, NULL);
+		if (migrate_pages(getpid(), NUMA_NUM_NODES, srcmask.n,
+				  dstmask.n) < 0) {
+			int err = errno;
+			fprintf(stderr, "%s: migrate_pages() failed - %s\n",
+				gcp->program_name, strerror(err));
+			goto out_remove;
+		}
+		gettimeofday(&t_end, NULL);
+		usecs = tv_diff_usec(&t_start, &t_end);
+		break;
+	}
+	case MIGB_MBIND:
+		if (!segment_mbind(basename(regname), &range, MPOL_BIND,
+				   &dstmask, MPOL_MF_MOVE, 1))
+			goto out_remove;
+		usecs = gcp->result.r_usecs;
+		break;
+	case MIGB_MOVE_PAGES:
+		if (!segment_move_pages(basename(regname), &range, &dstmask,
+					0L, MPOL_MF_MOVE, 1))
+			goto out_remove;
+		usecs = gcp->result.r_usecs;
+		break;
+	}
+
+	nr_dst = segment_node_pages(basename(regname), dst, NULL, NULL);
+	if (nr_dst < 0)
+		goto out_remove;
+	*missed = nr_pages - nr_dst;
+
+	/*
+	 * bytes/usec => MB/s; /1000 => GB/s
+	 */
+	gbps = (double)nr_dst * pagesize / (usecs ? usecs : 1) / 1000.0;
+
+out_remove:
+	segment_remove(basename(regname));
+out_unlink:
+	if (type == MIGB_FILE)
+		unlink(path);
+	return gbps;
+}
+
+static int
+migbench(char *args)
+{
+	glctx_t *gcp = &glctx;
+
+	char         *nextarg;
+	nodemask_t   *nodemask = NULL;
+	size_t        size;
+	unsigned long saved_options = gcp->options;
+	int           types = (1 << MIGB_NR_TYPES) - 1;
+	int           nodes[NUMA_NUM_NODES];
+	int           nr_nodes = 0, node, type, src, dst;
+	bool          partial = false;
+	int           ret = CMD_ERROR;
+
+	if (!numa_supported(gcp))
+		return CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<size>"))
+		return CMD_ERROR;
+	args = strtok_r(args, whitespace, &nextarg);
+	size = get_scaled_value(args, "size");
+	if (size == BOGUS_SIZE)
+		return CMD_ERROR;
+	args = nextarg + strspn(nextarg, whitespace);
+
+	/*
+	 * optional segment type list and/or node list, in either order
+	 */
+	while (*args != '\0') {
+		args = strtok_r(args, whitespace, &nextarg);
+		if (isdigit(*args)) {
+			free(nodemask);
+			if (get_nodemask(args, &nodemask) < 0)
+				return CMD_ERROR;
+		} else {
+			types = get_migbench_types(args);
+			if (!types)
+				goto out_free;
+		}
+		args = nextarg + strspn(nextarg, whitespace);
+	}
+
+	if (!nodemask && get_current_nodemask(&nodemask) <= 0)
+		goto out_free;
+	for (node = 0; node <= gcp->numa_max_node; ++node)
+		if (nodemask_isset(nodemask, node))
+			nodes[nr_nodes++] = node;
+	if (nr_nodes < 2) {
+		fprintf(stderr, "%s:  migbench needs at least 2 nodes\n",
+			gcp->program_name);
+		goto out_free;
+	}
+
+	printf("%s:  migbench %ldk per segment, throughput in GB/s\n",
+		gcp->program_name, size / 1024);
+	printf("  type   from   to  %13s  %13s  %13s\n",
+		migbench_methods[MIGB_MIGRATE_PAGES],
+		migbench_methods[MIGB_MBIND],
+		migbench_methods[MIGB_MOVE_PAGES]);
+
+	set_option(QUIET);
+	for (type = 0; type < MIGB_NR_TYPES; ++type) {
+		if (!(types & (1 << type)))
+			continue;
+		for (src = 0; src < nr_nodes; ++src)
+		for (dst = 0; dst < nr_nodes; ++dst) {
+			int method;
+
+			if (src == dst)
+				continue;
+			printf("  %-4s  %5d  %3d", migbench_types[type],
+				nodes[src], nodes[dst]);
+			for (method = 0; method < MIGB_NR_METHODS; ++method) {
+				unsigned long missed = 0;
+				double gbps;
+
+				gbps = migbench_one(type, size, nodes[src],
+						nodes[dst], method, &missed);
+				if (gbps < 0.0)
+					printf("  %13s", "-");
+				else
+					printf("  %12.3f%c", gbps,
+						missed ? '*' : ' ');
+				if (missed)
+					partial = true;
+				fflush(stdout);
+			}
+			printf("\n");
+
+			if (signalled(gcp)) {
+				reset_signal();
+				goto out_done;
+			}
+		}
+	}
+out_done:
+	if (partial)
+		printf("  * - some pages not on destination node after "
+			"migration\n");
+	printf("  note:  migrate_pages moves all of %s's pages on the "
+		"source node\n", gcp->program_name);
+	ret = CMD_SUCCESS;
+
+out_free:
+	gcp->options = saved_options;
+	free(nodemask);
+	return ret;
+}
+
+/*
+ *  command:  shmem <seg-name> <seg-size>[k|m|g|p] [huge]
+ *
+ * create [shmget] and register a SysV shared memory segment
+ * of specified size
+ */
+static int
+shmem_seg(char *args)
+{
+	glctx_t *gcp = &glctx;
+	
+	char *segname, *nextarg;
+	range_t range = { 0L, 0L };
+	int segflag = MAP_SHARED;
+
+	args += strspn(args, whitespace);
+
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+
+	if(!required_arg(args, "<size>"))
+		return CMD_ERROR;
+	args = strtok_r(args, whitespace, &nextarg);
+	range.length = get_scaled_value(args, "size");
+	if (range.length == BOGUS_SIZE)
+		return CMD_ERROR;
+	args = nextarg + strspn(nextarg, whitespace);
+
+	if (*args) {
+		char *option = args;
+		option = strtok_r(args, whitespace, &nextarg);
+		if (!strncasecmp(option, "huge", strlen(option)))
+			segflag |= MEMTOY_MAP_HUGE;
+		args = nextarg + strspn(nextarg, whitespace);
+	}
+
+	if (!segment_register(SEGT_SHM, segname, &range, segflag))
+		return CMD_ERROR;
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  where <seg-name> [<offset>[kmgp] <length>[kmgp]]  
+ *
+ * show node location of specified range of segment.
+ *
+ * NOTE: if neither <offset> nor <length> specified, <offset> defaults
+ * to 0 [start of segment], as usual, and length defaults to 64 pages 
+ * rather than the entire segment.  Suitable for a "quick look" at where
+ * segment resides.
+ */
+static int
+where_seg(char *args)
+{
+	glctx_t *gcp = &glctx;
+	
+	char  *segname, *nextarg;
+	range_t range = { 0L, 0L };
+	int    ret;
+
+	if (!numa_supported(gcp))
+		return CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+
+	/*
+	 * offset, length are optional
 	 */
 	if (get_range(args, &range, &nextarg) == CMD_ERROR)
 		return CMD_ERROR;
@@ -1493,6 +2314,21 @@ lock_unlock(int lock, int shm, char *args)
 	if (!shm && get_range(args, &range, &nextarg) == CMD_ERROR)
 		return CMD_ERROR;
 
+	/*
+	 * lock ... onfault => mlock2(MLOCK_ONFAULT)
+	 */
+	args = nextarg + strspn(nextarg, whitespace);
+	if (lock && !shm && *args != '\0') {
+		char *arg = strtok_r(args, whitespace, &nextarg);
+
+		if (strcmp(arg, "onfault")) {
+			fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+		lock = SEG_LOCK_ONFAULT;
+	}
+
 	if (!segment_lock_unlock(segname, &range, lock, shm))
 		return CMD_ERROR;
 
@@ -1517,6 +2353,58 @@ unlock_seg(char *args)
 	return(lock_unlock(0, 0, args));
 }
 
+/*
+ * command:  lockall current|future|onfault ...
+ */
+static int
+lockall(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *arg, *nextarg;
+	int      flags = 0;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "current|future|onfault"))
+		return CMD_ERROR;
+
+	for (arg = strtok_r(args, " \t+", &nextarg); arg;
+	     arg = strtok_r(NULL, " \t+", &nextarg)) {
+		if (!strcmp(arg, "current"))
+			flags |= MCL_CURRENT;
+		else if (!strcmp(arg, "future"))
+			flags |= MCL_FUTURE;
+		else if (!strcmp(arg, "onfault"))
+			flags |= MCL_ONFAULT;
+		else {
+			fprintf(stderr, "%s:  unrecognized lockall flag:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+	}
+	if (!(flags & (MCL_CURRENT|MCL_FUTURE))) {
+		fprintf(stderr, "%s:  lockall onfault needs current and/or "
+			"future\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	if (!segment_lockall(flags))
+		return CMD_ERROR;
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  unlockall
+ */
+static int
+unlockall(char *args)
+{
+	if (!segment_unlockall())
+		return CMD_ERROR;
+
+	return CMD_SUCCESS;
+}
+
 /*
  * command:  slock <seg-name>
  */
@@ -1540,16 +2428,120 @@ shm_unlock_seg(char *args)
  * =========================================================================
  * memtoy child processes.
 //TODO:  ref count child_toy structure?
+ *
+ * SIGCLD stays blocked [see set_signals()]; children's exits are read from
+ * a signalfd.  One epoll set watches the signalfd and all children's
+ * response pipes, so that we can collect from many busy children in the
+ * order they finish.  Children are only ever reaped and freed from the
+ * command loop -- no list manipulation in signal handlers.
  */
-static sigset_t sigcld_block;
-static void
+static int children_epfd = -1;	/* epoll set:  responses + signalfd */
+static int children_sigfd = -1;	/* SIGCLD */
+
+#define CHILD_EVENTS 64		/* max epoll events per wait */
+#define CHILD_FANOUT 1024	/* max children per 'child' command */
+
+/*
+ * children_init() - set up the signalfd and epoll set, if not already
+ */
+static int
 children_init()
 {
-	/*
-	 * signal set for temporarily blocking SIGCLD
-	 */
-	sigemptyset(&sigcld_block);
-	sigaddset(&sigcld_block, SIGCLD);
+	glctx_t *gcp = &glctx;
+	struct epoll_event ev;
+	sigset_t sigcld;
+
+	if (children_epfd >= 0)
+		return 0;
+
+	sigemptyset(&sigcld);
+	sigaddset(&sigcld, SIGCLD);
+	children_sigfd = signalfd(-1, &sigcld, SFD_NONBLOCK);
+	if (children_sigfd < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  signalfd() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+
+	children_epfd = epoll_create(CHILD_EVENTS);
+	if (children_epfd < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  epoll_create() failed - %s\n",
+			gcp->program_name, strerror(err));
+		goto out_close;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;		/* => signalfd */
+	if (epoll_ctl(children_epfd, EPOLL_CTL_ADD, children_sigfd, &ev) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  epoll_ctl() failed - %s\n",
+			gcp->program_name, strerror(err));
+		close(children_epfd);
+		goto out_close;
+	}
+	return 0;
+
+out_close:
+	close(children_sigfd);
+	children_epfd = children_sigfd = -1;
+	return -1;
+}
+
+/*
+ * children_fini() - a new child drops its parent's epoll set, which
+ * it shares, and signalfd.  It makes its own, if it has children.
+ */
+static void
+children_fini()
+{
+	if (children_epfd < 0)
+		return;
+	close(children_epfd);
+	close(children_sigfd);
+	children_epfd = children_sigfd = -1;
+}
+
+/*
+ * child_watch() - add child's response pipe to the epoll set
+ */
+static int
+child_watch(child_t *childp)
+{
+	glctx_t *gcp = &glctx;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.ptr = childp;
+	if (epoll_ctl(children_epfd, EPOLL_CTL_ADD, childp->c_rfd, &ev) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  epoll_ctl() for %s failed - %s\n",
+			gcp->program_name, childp->c_name, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * child_free() - free child structure and its remembered extents
+ */
+static void
+child_free(child_t *childp)
+{
+	struct list_head *lp, *safe;
+
+	list_for_each_safe(lp, safe, &childp->c_extents) {
+		child_extent_t *cep = list_entry(lp, child_extent_t, ce_link);
+
+		list_del(&cep->ce_link);
+		free(cep->ce_seg);
+		free(cep);
+	}
+	free(childp->c_name);
+	free(childp);
 }
 
 /*
@@ -1572,10 +2564,20 @@ children_free(int do_kill)
 		child_t *cp = list_entry(lp, child_t, c_link);
 		
 		list_del(&cp->c_link);
-		if (do_kill)
+		if (do_kill && !cp->c_thread)
 			kill(cp->c_pid, SIGQUIT);
-		free(cp->c_name);
-		free(cp);
+		close(cp->c_cfd);
+		close(cp->c_rfd);
+		if (!do_kill && cp->c_tcfd >= 0) {
+			/*
+			 * fork()ed child:  a thread's ends of its pipes
+			 * stay open here, though the thread doesn't
+			 * exist.  Its response pipe would never see EOF.
+			 */
+			close(cp->c_tcfd);
+			close(cp->c_trfd);
+		}
+		child_free(cp);
 	}
 }
 
@@ -1605,7 +2607,17 @@ children_list()
 	list_for_each(lp, &gcp->children) {
 		child_t *cp = list_entry(lp, child_t, c_link);
 		
-		printf(" %6d %4d %s\n", cp->c_pid, cp->c_errs, cp->c_name);
+		if (cp->c_exited)
+			continue;
+		printf(" %6d %4d %s%s%s", cp->c_pid, cp->c_errs, cp->c_name,
+			cp->c_thread ? " [thread]" : "",
+			cp->c_busy ? " [busy]" : "");
+		if (!cp->c_busy && *cp->c_result.cr_cmd)
+			printf("  last:  %s %s %.6f secs", cp->c_result.cr_cmd,
+				cp->c_result.cr_status == CMD_ERROR ?
+					"failed" : "ok",
+				(double)cp->c_result.cr_usecs / 1000000.0);
+		printf("\n");
 	}
 
 }
@@ -1633,61 +2645,154 @@ child_find_by_name(char *child_name)
 }
 
 /*
- * child_find_by_pid() -- look up child toy by process id
+ * =========================================================================
+ * broadcast:  '/', '*', <command> -- slash-star -- sends <command> to all
+ * children, which meet at a barrier in shared memory and start it
+ * together.  Children run broadcast commands quietly; memtoy summarizes
+ * their results.
  */
-static child_t *
-child_find_by_pid(pid_t cpid)
+struct bcast_sync {
+	volatile int   bs_gen;		/* current broadcast */
+	volatile int   bs_arrived;	/* children at the barrier */
+	volatile int   bs_go;		/* >= their gen => start */
+	struct timeval bs_start;	/* barrier release time */
+};
+
+/*
+ * bcast_own is ours, for broadcasting to our children.  It's mapped
+ * before the first child is created, so that all children inherit it.
+ * bcast_parent is our parent's, inherited, for receiving its broadcasts.
+ * Threads receive their creator's -- i.e., our own -- broadcasts.
+ */
+static struct bcast_sync *bcast_own, *bcast_parent;
+
+#define BCAST_TIMEOUT 10	/* secs to wait for children at barrier */
+
+/*
+ * bcast_map() - map our broadcast barrier, if not already mapped
+ */
+static int
+bcast_map(void)
 {
 	glctx_t *gcp = &glctx;
-	struct list_head *lp;
+	void    *addr;
 
-	if (list_empty(&gcp->children))
-		return NULL;
+	if (bcast_own)
+		return 0;
 
-	list_for_each(lp, &gcp->children) {
-		child_t *this_one = list_entry(lp, child_t, c_link);
-		
-		if(cpid == this_one->c_pid)
-			return this_one;
+	addr = mmap(NULL, sizeof(*bcast_own), PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't map broadcast barrier - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
 	}
+	bcast_own = addr;	/* zero filled */
+	return 0;
+}
 
-	return NULL;
+/*
+ * command:  _bcast <gen> <command>  [hidden; children only]
+ *
+ * wait at the barrier for broadcast <gen> to start, then run <command>.
+ */
+static int
+bcast_run(char *args)
+{
+	glctx_t *gcp = &glctx;
+	struct bcast_sync *bsp = gcp->cmd_thread ? bcast_own : bcast_parent;
+	child_result_t *rp = gcp->child_result;
+	struct timeval t_start, t_end;
+	unsigned long saved_options = gcp->options;
+	char    *nextarg;
+	int      gen;
+
+	if (!gcp->child_name || !bsp || !rp) {
+		fprintf(stderr, "%s:  %s is for child processes only\n",
+			gcp->program_name, gcp->cmd_name);
+		return CMD_ERROR;
+	}
+
+	args += strspn(args, whitespace);
+	gen = (int)strtol(args, &nextarg, 0);
+	args = nextarg + strspn(nextarg, whitespace);
+
+	__sync_fetch_and_add(&bsp->bs_arrived, 1);
+	while (bsp->bs_go - gen < 0)
+		sched_yield();
+	__sync_synchronize();		/* bs_start written before bs_go */
+	gettimeofday(&t_start, NULL);
+
+	/*
+	 * the parent reports for all of us
+	 */
+	if (!is_option(VERBOSE))
+		set_option(QUIET);
+	if (*args)
+		(void)parse_command_result(args, rp);
+	gcp->options = saved_options;
+
+	gettimeofday(&t_end, NULL);
+	rp->cr_start = tv_diff_usec(&bsp->bs_start, &t_start);
+	rp->cr_done  = tv_diff_usec(&bsp->bs_start, &t_end);
+
+	/*
+	 * command errors are reported to the parent:  don't exit in
+	 * batch mode.
+	 */
+	return CMD_SUCCESS;
 }
 
+static void child_exited(child_t *);	/* forward reference */
 /*
- * child_wait() -- wait for child ready to read command
+ * child_wait() -- wait for child's result:  it's ready to read a command
  */
-static char *child_ready = "OK";
 static void
 child_wait(child_t *childp)
 {
 	glctx_t *gcp = &glctx;
-	char child_response[8];
+	child_result_t *rp = &childp->c_result;
 	int  ret;
 
-	ret = read(childp->c_rfd, child_response, strlen(child_ready));
+	ret = read(childp->c_rfd, rp, sizeof(*rp));
 	if (ret < 0) {
 		int err = errno;
 		fprintf(stderr, "%s - error reading response from child %s"
 				" - %s\n", 
 			gcp->program_name, childp->c_name, strerror(err));
+	} else if (ret == 0) {
+		child_exited(childp);	/* EOF */
+		return;
 	}
+	if (ret != sizeof(*rp)) {
+		memset(rp, 0, sizeof(*rp));
+		rp->cr_status = CMD_ERROR;	/* no result */
+	}
+	childp->c_busy = false;
 
 }
 
 /*
- * child_respond() -- tell parent we're ready for a command
+ * child_respond() -- send parent the result of the last command, if any;
+ * tells parent we're ready for a command
  */
 static void
 child_respond()
 {
 	glctx_t *gcp = &glctx;
+	child_result_t none, *rp = gcp->child_result;
 	int ret;
 
 	if (!gcp->child_name)
 		return;
 
-	ret = write(gcp->response_fd, child_ready, strlen(child_ready));
+	if (!rp) {
+		memset(&none, 0, sizeof(none));
+		rp = &none;
+	}
+
+	ret = write(gcp->response_fd, rp, sizeof(*rp));
 	if (ret < 0) {
 		int err = errno;
 		fprintf(stderr, "%s - error writing response from child %s"
@@ -1697,29 +2802,442 @@ child_respond()
 }
 
 /*
- * child <child-name> - spawn a child process to handle commands directed
- * at '/<child-name>'
+ * child_exited() - child closed its response pipe:  it quit or died.
+ * Reap it -- or join it, for a thread -- now, so that its name may be
+ * reused by the very next command.  children_reap() frees it.
+ */
+static void
+child_exited(child_t *childp)
+{
+	child_result_t *rp = &childp->c_result;
+	int status = 0;
+
+	if (childp->c_exited)
+		return;
+
+	if (childp->c_thread) {
+		void *retval;
+
+		if (!pthread_join(childp->c_tid, &retval))
+			status = (int)(long)retval;
+		childp->c_tcfd = childp->c_trfd = -1;	/* it closed them */
+	} else if (waitpid(childp->c_pid, &status, 0) < 0)
+		status = 0;		/* already reaped */
+
+	childp->c_exited = true;
+	childp->c_busy   = false;
+	memset(rp, 0, sizeof(*rp));
+	strcpy(rp->cr_cmd, "exit");
+	rp->cr_status = status ? CMD_ERROR : CMD_SUCCESS;
+}
+
+/*
+ * children_sigcld() - drain the signalfd and reap any children that
+ * have exited -- e.g., were killed -- without our having seen EOF.
+ * Only our children:  don't reap other commands' processes.
+ */
+static void
+children_sigcld()
+{
+	glctx_t *gcp = &glctx;
+	struct signalfd_siginfo ssi;
+	struct list_head *lp;
+
+	while (read(children_sigfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+		;
+
+	list_for_each(lp, &gcp->children) {
+		child_t *cp = list_entry(lp, child_t, c_link);
+		int status;
+
+		if (cp->c_thread || cp->c_exited)
+			continue;
+		if (waitpid(cp->c_pid, &status, WNOHANG) == cp->c_pid) {
+			cp->c_exited = true;
+			cp->c_busy   = false;
+		}
+	}
+}
+
+/*
+ * children_events() - wait up to 'timeout' msecs [-1 => forever] for
+ * child events and handle them:  read responses, reap exits.
+ * Returns -1 if interrupted by a signal, else 0.
  */
 static int
-child_spawn(char *args)
+children_events(int timeout)
 {
 	glctx_t *gcp = &glctx;
-	
-	char    *child_name, *nextarg;
-	child_t *childp;
-	int	cmdpipe[2];	/* parent -> child commands */
-	int     resppipe[2];	/* child -> parent response/ready */
-	pid_t	childpid;
+	struct epoll_event events[CHILD_EVENTS];
+	int i, nr_events;
+
+	if (children_epfd < 0)
+		return 0;
+
+	nr_events = epoll_wait(children_epfd, events, CHILD_EVENTS, timeout);
+	if (nr_events < 0) {
+		int err = errno;
+
+		if (err == EINTR)
+			return -1;
+		fprintf(stderr, "%s:  epoll_wait() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+
+	for (i = 0; i < nr_events; ++i) {
+		child_t *childp = events[i].data.ptr;
+
+		if (!childp)
+			children_sigcld();
+		else if (!childp->c_exited)
+			child_wait(childp);	/* won't block */
+	}
+	return 0;
+}
+
+/*
+ * children_collect() - wait for all busy children, in whatever order
+ * they finish.  Returns -1 if interrupted, else 0.
+ */
+static int
+children_collect()
+{
+	glctx_t *gcp = &glctx;
+	struct list_head *lp;
+
+	for (;;) {
+		bool busy = false;
+
+		list_for_each(lp, &gcp->children) {
+			child_t *cp = list_entry(lp, child_t, c_link);
+
+			if (cp->c_busy && !cp->c_exited) {
+				busy = true;
+				break;
+			}
+		}
+		if (!busy)
+			return 0;
+		if (children_events(-1) < 0)
+			return -1;
+	}
+}
+
+/*
+ * children_reap() - handle pending child events without waiting; free
+ * children that have exited.  Called at the top of the command loop.
+ */
+static void
+children_reap(void)
+{
+	glctx_t *gcp = &glctx;
+	struct list_head *lp, *safe;
 
 	if (list_empty(&gcp->children))
-		children_init();		/* whenever we have no children */
+		return;
 
-	args += strspn(args, whitespace);
+	(void)children_events(0);
 
-	if(!required_arg(args, "<child-name>"))
-		return CMD_ERROR;
-	child_name = strtok_r(args, whitespace, &nextarg);
-	args = nextarg + strspn(nextarg, whitespace);
+	list_for_each_safe(lp, safe, &gcp->children) {
+		child_t *cp = list_entry(lp, child_t, c_link);
+
+		if (!cp->c_exited || cp->c_bcast)
+			continue;	/* keep broadcast results for 'wait' */
+		list_del(&cp->c_link);
+		epoll_ctl(children_epfd, EPOLL_CTL_DEL, cp->c_rfd, NULL);
+		close(cp->c_cfd);
+		close(cp->c_rfd);
+		child_free(cp);
+	}
+}
+
+/*
+ * sort and percentile helpers for result summaries
+ */
+static int
+ulong_cmp(const void *a, const void *b)
+{
+	unsigned long ua = *(const unsigned long *)a;
+	unsigned long ub = *(const unsigned long *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+/*
+ * percentile() - 'pct' percentile of 'nr' sorted values
+ */
+static unsigned long
+percentile(unsigned long *values, int nr, int pct)
+{
+	return values[((nr - 1) * pct + 50) / 100];
+}
+
+/*
+ * bcast_show_row() - sort 'values' and show min/p50/p95/max/sum.
+ * 'scale' converts usecs to secs; 1 for counts.
+ */
+static void
+bcast_show_row(char *label, unsigned long *values, int nr, double scale)
+{
+	unsigned long sum = 0;
+	char *fmt = scale == 1.0 ? " %10.0f" : " %10.6f";
+	int   i;
+
+	qsort(values, nr, sizeof(*values), ulong_cmp);
+	for (i = 0; i < nr; ++i)
+		sum += values[i];
+
+	printf("    %-8s", label);
+	printf(fmt, values[0] / scale);
+	printf(fmt, percentile(values, nr, 50) / scale);
+	printf(fmt, percentile(values, nr, 95) / scale);
+	printf(fmt, values[nr - 1] / scale);
+	printf(fmt, sum / scale);
+	printf("\n");
+}
+
+/*
+ * bcast_summary() - once all children in the most recent broadcast have
+ * answered, summarize their results:  one line per quantity, rather
+ * than one per child.  Returns the number of children whose command
+ * failed.
+ */
+static int
+bcast_summary(void)
+{
+	glctx_t *gcp = &glctx;
+	struct list_head *lp;
+	unsigned long *values;
+	char  *cmd = NULL;
+	unsigned long max_done = 0, sum_pages = 0;
+	int    nr = 0, nr_errs = 0, i;
+	bool   have_pages = false;
+	enum { WALL, DONE, CPU, PAGES, FAULTS, MAJFLT, NR_ROWS };
+	static char *labels[NR_ROWS] = {
+		"wall", "done", "cpu", "pages", "faults", "majflt"
+	};
+
+	if (list_empty(&gcp->children))
+		return 0;
+
+	list_for_each(lp, &gcp->children) {
+		child_t *cp = list_entry(lp, child_t, c_link);
+
+		if (!cp->c_bcast)
+			continue;
+		if (cp->c_busy)
+			return 0;	/* not done yet */
+		++nr;
+	}
+	if (!nr)
+		return 0;
+
+	values = calloc(NR_ROWS * nr, sizeof(*values));
+	i = 0;
+	list_for_each(lp, &gcp->children) {
+		child_t *cp = list_entry(lp, child_t, c_link);
+		child_result_t *rp = &cp->c_result;
+
+		if (!cp->c_bcast)
+			continue;
+		cp->c_bcast = false;
+
+		if (rp->cr_status == CMD_ERROR)
+			++nr_errs;
+		if (is_option(VERBOSE))
+			printf("    %-12s %-10s start +%8.6f  wall %9.6f  "
+				"done %9.6f secs%s\n", cp->c_name, rp->cr_cmd,
+				(double)rp->cr_start / 1000000.0,
+				(double)rp->cr_usecs / 1000000.0,
+				(double)rp->cr_done / 1000000.0,
+				rp->cr_status == CMD_ERROR ? "  [error]" : "");
+		if (!cmd && *rp->cr_cmd)
+			cmd = rp->cr_cmd;
+		if (rp->cr_pages)
+			have_pages = true;
+		if (rp->cr_done > max_done)
+			max_done = rp->cr_done;
+		sum_pages += rp->cr_pages;
+		if (!values)
+			continue;
+		values[WALL   * nr + i] = rp->cr_usecs;
+		values[DONE   * nr + i] = rp->cr_done;
+		values[CPU    * nr + i] = rp->cr_cpu_usecs;
+		values[PAGES  * nr + i] = rp->cr_pages;
+		values[FAULTS * nr + i] = rp->cr_faults;
+		values[MAJFLT * nr + i] = rp->cr_majflt;
+		++i;
+	}
+
+	if (nr_errs)
+		fprintf(stderr, "%s:  broadcast failed in %d of %d children\n",
+			gcp->program_name, nr_errs, nr);
+
+	if (values && !is_option(QUIET)) {
+		int row;
+
+		printf("%s:  %s in %d children:\n", gcp->program_name,
+			cmd ? cmd : "broadcast", nr);
+		printf("    %-8s %10s %10s %10s %10s %10s\n", "",
+			"min", "p50", "p95", "max", "sum");
+		for (row = 0; row < NR_ROWS; ++row) {
+			if (row == PAGES && !have_pages)
+				continue;
+			bcast_show_row(labels[row], &values[row * nr], nr,
+				row <= CPU ? 1000000.0 : 1.0);
+		}
+	}
+
+	result_record("broadcast", max_done, sum_pages, 0, nr_errs);
+	free(values);
+	return nr_errs;
+}
+
+/*
+ * child placement:  cpus=<cpu-list> mems=<node-list> mpol=<policy>[:<nodes>]
+ * on the 'child' and 'thread' commands.  The child applies these before
+ * it says it's ready, so its very first allocation lands where intended.
+ */
+struct child_place {
+	cpu_set_t  *cpl_cpus;		/* NULL => inherit */
+	nodemask_t *cpl_mems;		/* NULL => inherit */
+	int         cpl_policy;		/* -1 => inherit */
+	nodemask_t *cpl_nodes;		/*   policy nodes, if any */
+};
+
+static void
+child_place_free(struct child_place *placep)
+{
+	free(placep->cpl_cpus);
+	free(placep->cpl_mems);
+	free(placep->cpl_nodes);
+}
+
+/*
+ * get_child_place() - parse placement arguments.  'mems' and 'mpol'
+ * both set the task memory policy, so allow only one.
+ */
+static int
+get_child_place(char *args, struct child_place *placep)
+{
+	glctx_t *gcp = &glctx;
+	char    *arg, *nextarg;
+
+	memset(placep, 0, sizeof(*placep));
+	placep->cpl_policy = -1;
+
+	for (arg = strtok_r(args, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		char *value = strchr(arg, '=');
+
+		if (!value || !*(value + 1))
+			goto bad_arg;
+		*value++ = '\0';
+
+		if (!strcmp(arg, "cpus") && !placep->cpl_cpus) {
+			int ret;
+
+			if (*value == '0' && tolower(*(value + 1)) == 'x')
+				ret = get_cpuset_from_mask(value,
+							&placep->cpl_cpus);
+			else
+				ret = get_cpuset_from_ids(value,
+							&placep->cpl_cpus);
+			if (ret < 0)
+				goto out_err;
+		} else if (!strcmp(arg, "mems") && !placep->cpl_mems) {
+			if (get_nodemask(value, &placep->cpl_mems) < 0)
+				goto out_err;
+		} else if (!strcmp(arg, "mpol") && placep->cpl_policy < 0) {
+			char *nodes = strchr(value, ':'), *rest;
+			int   policy;
+
+			if (nodes)
+				*nodes++ = '\0';
+			else
+				nodes = "";
+			policy = get_mbind_policy(value, &rest);
+			if (policy < 0)
+				goto out_err;
+			if (get_arg_nodemask(nodes, policy,
+						&placep->cpl_nodes) < 0)
+				goto out_err;
+			placep->cpl_policy = policy;
+		} else {
+			*(value - 1) = '=';
+			goto bad_arg;
+		}
+	}
+
+	if (placep->cpl_mems && placep->cpl_policy >= 0) {
+		fprintf(stderr, "%s:  mems= and mpol= both set the task "
+			"memory policy; use one\n", gcp->program_name);
+		goto out_err;
+	}
+	return 0;
+
+bad_arg:
+	fprintf(stderr, "%s:  expected cpus=, mems= or mpol=, at most once "
+		"each:  %s\n", gcp->program_name, arg);
+out_err:
+	child_place_free(placep);
+	return -1;
+}
+
+/*
+ * child_place_apply() - in the new child, apply its placement
+ */
+static int
+child_place_apply(struct child_place *placep)
+{
+	glctx_t *gcp = &glctx;
+
+	if (placep->cpl_cpus &&
+	    sched_setaffinity(0, sizeof(*placep->cpl_cpus),
+				placep->cpl_cpus) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  sched_setaffinity() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+
+	if (placep->cpl_mems)
+		numa_set_membind(placep->cpl_mems);	/* void fcn */
+
+	if (placep->cpl_policy >= 0 && placep->cpl_policy != MPOL_NOOP) {
+		unsigned long *nodebits = NULL;
+		unsigned long  maxnode = 0;
+
+		if (placep->cpl_nodes) {
+			nodebits = placep->cpl_nodes->n;
+			maxnode  = NUMA_NUM_NODES;
+		}
+		if (set_mempolicy(placep->cpl_policy, nodebits, maxnode)) {
+			int err = errno;
+			fprintf(stderr, "%s:  set_mempolicy() failed - %s\n",
+				gcp->program_name, strerror(err));
+			return -1;
+		}
+	}
+
+	refresh_cpus_allowed(gcp);
+	refresh_mems_allowed(gcp);
+	return 0;
+}
+
+/*
+ * child_fork() - create child process 'child_name', placed per 'placep'.
+ * Don't wait for it to say it's ready:  it's busy until it does.
+ */
+static child_t *
+child_fork(char *child_name, struct child_place *placep)
+{
+	glctx_t *gcp = &glctx;
+	child_t *childp;
+	int	cmdpipe[2];	/* parent -> child commands */
+	int     resppipe[2];	/* child -> parent response/ready */
+	pid_t	childpid;
 
 	/*
 	 * lookup child name to insure uniqueness
@@ -1728,12 +3246,14 @@ child_spawn(char *args)
 	if (childp != NULL) {
 		fprintf(stderr, "%s:  child name %s already in use\n",
 			gcp->program_name, childp->c_name);
-		return CMD_ERROR;
+		return NULL;
 	}
 
 	childp = (child_t *)calloc(1, sizeof(child_t));
 	childp->c_name = strdup(child_name);
 	childp->c_cfd =  childp->c_rfd = -1;
+	childp->c_tcfd = childp->c_trfd = -1;
+	INIT_LIST_HEAD(&childp->c_extents);
 
 	/*
 	 * setup command and response pipes
@@ -1755,7 +3275,6 @@ child_spawn(char *args)
 	}
 
 	switch (childpid = fork()) {
-		sigset_t saved_mask;
 		int err;
 	case -1:
 		err = errno;
@@ -1781,6 +3300,16 @@ child_spawn(char *args)
 		gcp->child_name = strdup(child_name);
 		set_program_name();
 		children_free(0);	/* no kill */
+		children_fini();
+		server_fini();
+		segment_locks_forget();	/* not inherited */
+		cgroup_fini();
+		stats_fini();
+		bcast_parent = bcast_own;	/* parent's broadcasts */
+		bcast_own = NULL;		/* map our own, if needed */
+
+		if (child_place_apply(placep) < 0)
+			exit(4);		/* parent sees EOF */
 
 		child_respond();
 		process_commands();
@@ -1795,19 +3324,14 @@ child_spawn(char *args)
 
 		close(resppipe[1]);		/* child write fd */
 		childp->c_rfd = resppipe[0];	/* parend read fd */
-	
 
-		sigprocmask(SIG_BLOCK, &sigcld_block, &saved_mask);
 		list_add_tail(&childp->c_link, &gcp->children);
-		sigprocmask(SIG_SETMASK, &saved_mask, NULL);
-
-		printf("%s:  child %s - pid %d\n",
-			 gcp->program_name, childp->c_name, childp->c_pid);
-
-		child_wait(childp);
+		childp->c_busy = true;		/* until it says it's ready */
+		if (child_watch(childp) < 0)
+			child_wait(childp);	/* the old fashioned way */
 	}
 
-	return CMD_SUCCESS;
+	return childp;
 
 out_closeall:
 	close(resppipe[0]);
@@ -1818,52 +3342,464 @@ out_closecmd:
 	close(cmdpipe[1]);
 
 out_free:
-	free(childp);
-	return CMD_ERROR;
+	child_free(childp);
+	return NULL;
 }
 
 /*
- * child_reap() -- called from SIGCLD handler to reap
- * child indicated by pid
+ * get_child_names() - parse <prefix>[<first>-<last>]<suffix> fan-out
+ * child name.  Returns the number of names; a plain name is 1.
  */
-void
-child_reap(pid_t cpid, int cstatus)
+static int
+get_child_names(char *name, char **prefix, int *first, char **suffix)
 {
 	glctx_t *gcp = &glctx;
-	child_t *childp;
+	char *lb, *rb, *next;
+	int   last;
+
+	lb = strchr(name, '[');
+	if (!lb)
+		return 1;
+
+	rb = strchr(lb, ']');
+	*first = (int)strtol(lb + 1, &next, 10);
+	if (!rb || next == lb + 1 || *next != '-')
+		goto bad_range;
+	last = (int)strtol(next + 1, &next, 10);
+	if (next != rb || *first < 0 || last < *first)
+		goto bad_range;
+	if (last - *first + 1 > CHILD_FANOUT) {
+		fprintf(stderr, "%s:  at most %d children at a time\n",
+			gcp->program_name, CHILD_FANOUT);
+		return -1;
+	}
 
-	childp = child_find_by_pid(cpid);
-	if (!childp) {
-		fprintf(stderr, "%s couldn't find child %d to reap\n",
-			gcp->program_name, cpid);
-		return;
+	*lb = '\0';
+	*prefix = name;
+	*suffix = rb + 1;
+	return last - *first + 1;
+
+bad_range:
+	fprintf(stderr, "%s:  bad child name range in %s\n",
+		gcp->program_name, name);
+	return -1;
+}
+
+/*
+ * child <child-name> [cpus=<cpu-list>] [mems=<node-list>]
+ *                    [mpol=<policy>[:<node-list>]]
+ *
+ * spawn a child process to handle commands directed at '/<child-name>'.
+ * <prefix>[<first>-<last>]<suffix> spawns a child for each name in the
+ * range.  They all start before we wait for any.
+ */
+static int
+child_spawn(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *child_name, *nextarg, *prefix = "", *suffix = "";
+	child_t *childp = NULL;
+	struct child_place place;
+	int      i, first = 0, nr_names, nr_started = 0, nr_failed = 0;
+	int      ret = CMD_ERROR;
+
+	if (gcp->cmd_thread) {
+		fprintf(stderr, "%s:  threads can't have children\n",
+			gcp->program_name);
+		return CMD_ERROR;
 	}
 
-	list_del(&childp->c_link);
-	close(childp->c_cfd);
-	close(childp->c_rfd);
-	free(childp->c_name);
-	free(childp);
+	args += strspn(args, whitespace);
+
+	if(!required_arg(args, "<child-name>"))
+		return CMD_ERROR;
+	child_name = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+
+	nr_names = get_child_names(child_name, &prefix, &first, &suffix);
+	if (nr_names < 0)
+		return CMD_ERROR;
+
+	if (get_child_place(args, &place) < 0)
+		return CMD_ERROR;
+
+	if (children_init() < 0 || bcast_map() < 0)
+		goto out_free;		/* before fork, for all children */
+
+	if (nr_names == 1) {
+		childp = child_fork(child_name, &place);
+		if (!childp)
+			goto out_free;
+		printf("%s:  child %s - pid %d\n",
+			 gcp->program_name, childp->c_name, childp->c_pid);
+		child_wait(childp);
+		if (childp->c_exited) {
+			fprintf(stderr, "%s:  child %s failed to start\n",
+				gcp->program_name, childp->c_name);
+			goto out_free;
+		}
+		ret = CMD_SUCCESS;
+		goto out_free;
+	}
+
+	for (i = 0; i < nr_names; ++i) {
+		char name[CMDBUFSZ];
+
+		snprintf(name, sizeof(name), "%s%d%s", prefix, first + i,
+			suffix);
+		if (!child_fork(name, &place))
+			break;
+		++nr_started;
+	}
+	if (children_collect() < 0)
+		goto out_free;
+
+	for (i = 0; i < nr_started; ++i) {
+		char name[CMDBUFSZ];
+
+		snprintf(name, sizeof(name), "%s%d%s", prefix, first + i,
+			suffix);
+		childp = child_find_by_name(name);
+		if (childp && childp->c_exited)
+			++nr_failed;
+	}
+
+	if (nr_started)
+		printf("%s:  %d children %s%d%s .. %s%d%s\n",
+			gcp->program_name, nr_started, prefix, first, suffix,
+			prefix, first + nr_started - 1, suffix);
+	if (nr_failed)
+		fprintf(stderr, "%s:  %d children failed to start\n",
+			gcp->program_name, nr_failed);
+
+	if (nr_started == nr_names && !nr_failed)
+		ret = CMD_SUCCESS;
+out_free:
+	child_place_free(&place);
+	return ret;
+}
+
+/*
+ * =========================================================================
+ * memtoy command threads.
+ *
+ * A 'thread' takes commands from the parent over the same pipes as a
+ * child process and is addressed the same way -- '/<thread-name> ...' --
+ * but runs in memtoy's own address space.  Its task memory policy and
+ * cpu affinity are its own, so one can, e.g., touch a segment from a
+ * thread bound to another node while the main thread migrates it.
+ */
+struct thread_start {
+	glctx_t *ts_gcp;	/* creator's context */
+	struct child_place *ts_place;
+	child_t *ts_childp;
+	int      ts_cmdfd;	/* read commands on this fd */
+	int      ts_respfd;	/* ack creator on this fd */
+};
+
+static void *
+thread_main(void *arg)
+{
+	struct thread_start *tsp = arg;
+	glctx_t *gcp = &glctx;
+
+	glctx = *tsp->ts_gcp;	/* creator waits for our first ack */
+	INIT_LIST_HEAD(&gcp->children);
+	gcp->siginfo  = NULL;
+	gcp->signame  = NULL;
+	gcp->sigjmp   = false;
+	gcp->interrupted = false;
+	gcp->cmd_name = NULL;
+
+	gcp->cpus_allowed = NULL;	/* creator's; get our own */
+	gcp->mems_allowed = NULL;
+	commands_init(gcp);
+
+	gcp->cmd_thread  = true;
+	gcp->child_name  = strdup(tsp->ts_childp->c_name);
+	gcp->response_fd = tsp->ts_respfd;
+	gcp->cmd_input   = fdopen(tsp->ts_cmdfd, "r");
+	if (!gcp->cmd_input) {
+		close(gcp->response_fd);	/* creator sees EOF */
+		free(tsp);
+		return (void *)4L;
+	}
+	set_program_name();
+
+	if (child_place_apply(tsp->ts_place) < 0) {
+		free(tsp);
+		thread_exit(4);
+	}
+	free(tsp);
+
+	child_respond();
+	process_commands();
+	thread_exit(0);		/* shouldn't get here */
+	return NULL;
+}
+
+/*
+ * thread_exit() - command thread quits with exit 'status'.  The creator
+ * sees EOF on the response pipe and joins us.  See child_exited().
+ */
+static void
+thread_exit(int status)
+{
+	glctx_t *gcp = &glctx;
+
+	fclose(gcp->cmd_input);
+	close(gcp->response_fd);
+	free(gcp->child_name);
+	free(gcp->cpus_allowed);
+	free(gcp->mems_allowed);
+	pthread_exit((void *)(long)status);
+}
+
+/*
+ * thread <thread-name> [cpus=<cpu-list>] [mems=<node-list>]
+ *                      [mpol=<policy>[:<node-list>]]
+ *
+ * create a thread to handle commands directed at '/<thread-name>'
+ */
+static int
+thread_spawn(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *thread_name, *nextarg;
+	child_t *childp;
+	struct child_place place;
+	struct thread_start *tsp;
+	int      cmdpipe[2];	/* creator -> thread commands */
+	int      resppipe[2];	/* thread -> creator response/ready */
+	sigset_t block, saved;
+	int      err;
+
+	if (gcp->cmd_thread) {
+		fprintf(stderr, "%s:  threads can't create threads\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	args += strspn(args, whitespace);
+	if (!required_arg(args, "<thread-name>"))
+		return CMD_ERROR;
+	thread_name = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+
+	childp = child_find_by_name(thread_name);
+	if (childp != NULL) {
+		fprintf(stderr, "%s:  child name %s already in use\n",
+			gcp->program_name, childp->c_name);
+		return CMD_ERROR;
+	}
+
+	if (children_init() < 0 || bcast_map() < 0)
+		return CMD_ERROR;
+
+	if (get_child_place(args, &place) < 0)
+		return CMD_ERROR;
+
+	childp = (child_t *)calloc(1, sizeof(child_t));
+	tsp = (struct thread_start *)calloc(1, sizeof(*tsp));
+	if (!childp || !tsp) {
+		fprintf(stderr, "%s:  can't allocate thread %s\n",
+			gcp->program_name, thread_name);
+		free(childp);
+		free(tsp);
+		child_place_free(&place);
+		return CMD_ERROR;
+	}
+	childp->c_name = strdup(thread_name);
+	childp->c_cfd =  childp->c_rfd = -1;
+	childp->c_tcfd = childp->c_trfd = -1;
+	childp->c_thread = true;
+	childp->c_pid = getpid();	/* for migrate pid=/<thread-name> */
+	INIT_LIST_HEAD(&childp->c_extents);
+
+	if (pipe(cmdpipe) < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  command pipe creation for %s failed\n"
+				"\t%s\n", gcp->program_name, childp->c_name,
+				strerror(err));
+		goto out_free;
+	}
+
+	if (pipe(resppipe) < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  response pipe creation for %s failed\n"
+				"\t%s\n", gcp->program_name, childp->c_name,
+				strerror(err));
+		goto out_closecmd;
+	}
+
+	tsp->ts_gcp    = gcp;
+	tsp->ts_place  = &place;	/* we wait for the thread's ack */
+	tsp->ts_childp = childp;
+	tsp->ts_cmdfd  = cmdpipe[0];
+	tsp->ts_respfd = resppipe[1];
+
+	/*
+	 * like workers, command threads leave signal handling, other
+	 * than faults, to the main thread.
+	 */
+	sigfillset(&block);
+	sigdelset(&block, SIGSEGV);
+	sigdelset(&block, SIGBUS);
+	pthread_sigmask(SIG_BLOCK, &block, &saved);
+	err = pthread_create(&childp->c_tid, NULL, thread_main, tsp);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (err) {
+		fprintf(stderr, "%s:  failed to create thread %s - %s\n",
+			gcp->program_name, childp->c_name, strerror(err));
+		goto out_closeall;
+	}
+
+	childp->c_cfd  = cmdpipe[1];
+	childp->c_rfd  = resppipe[0];
+	childp->c_tcfd = cmdpipe[0];
+	childp->c_trfd = resppipe[1];
+	list_add_tail(&childp->c_link, &gcp->children);
+	(void)child_watch(childp);
+
+	printf("%s:  thread %s - pid %d\n",
+		 gcp->program_name, childp->c_name, childp->c_pid);
+
+	child_wait(childp);
+	child_place_free(&place);
+	if (childp->c_exited) {
+		fprintf(stderr, "%s:  thread %s failed to start\n",
+			gcp->program_name, childp->c_name);
+		return CMD_ERROR;
+	}
+	return CMD_SUCCESS;
+
+out_closeall:
+	close(resppipe[0]);
+	close(resppipe[1]);
+
+out_closecmd:
+	close(cmdpipe[0]);
+	close(cmdpipe[1]);
+
+out_free:
+	free(tsp);
+	child_free(childp);
+	child_place_free(&place);
+	return CMD_ERROR;
+}
+
+/*
+ * child_broadcast() - send 'cmd_str' to all children; release them
+ * together when all have arrived at the barrier.  If 'async', don't
+ * wait for them to finish:  'wait' collects and summarizes results.
+ */
+static int
+child_broadcast(char *cmd_str, bool async)
+{
+	glctx_t *gcp = &glctx;
+	struct bcast_sync *bsp = bcast_own;
+	struct list_head *lp;
+	struct timeval t_wait, t_now;
+	char     cmd[CMDBUFSZ];
+	int      len, gen, nr_sent = 0, nr_errs;
+
+	if (list_empty(&gcp->children) || !bsp) {
+		fprintf(stderr, "%s:  no children to broadcast to\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	if (children_collect() < 0)	/* one command at a time */
+		return CMD_ERROR;
+	(void)bcast_summary();		/* previous broadcast, if any */
+
+	gen = bsp->bs_gen + 1;
+	len = snprintf(cmd, sizeof(cmd), "_bcast %d %s\n", gen, cmd_str);
+	if (len >= sizeof(cmd)) {
+		fprintf(stderr, "%s:  broadcast command too long\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	bsp->bs_arrived = 0;
+	bsp->bs_gen = gen;
+
+	list_for_each(lp, &gcp->children) {
+		child_t *cp = list_entry(lp, child_t, c_link);
+
+		if (cp->c_exited)
+			continue;
+		if (write(cp->c_cfd, cmd, len) != len) {
+			int err = errno;
+			fprintf(stderr, "%s:  write to child %s failed - %s\n",
+					gcp->program_name, cp->c_name,
+					strerror(err));
+			cp->c_errs += 1;
+			continue;
+		}
+		cp->c_errs  = 0;
+		cp->c_busy  = true;
+		cp->c_bcast = true;
+		++nr_sent;
+	}
+	if (!nr_sent)
+		return CMD_ERROR;
+
+	gettimeofday(&t_wait, NULL);
+	while (bsp->bs_arrived < nr_sent) {
+		sched_yield();
+		gettimeofday(&t_now, NULL);
+		if (tv_diff_usec(&t_wait, &t_now) > BCAST_TIMEOUT * 1000000UL) {
+			fprintf(stderr, "%s:  only %d of %d children reached "
+				"the barrier; starting anyway\n",
+				gcp->program_name, bsp->bs_arrived, nr_sent);
+			break;
+		}
+	}
+
+	gettimeofday(&bsp->bs_start, NULL);
+	__sync_synchronize();		/* bs_start before bs_go */
+	bsp->bs_go = gen;
+
+	if (async)
+		return CMD_SUCCESS;
+
+	if (children_collect() < 0)
+		return CMD_ERROR;	/* interrupted */
+	nr_errs = bcast_summary();
+
+	return nr_errs ? CMD_ERROR : CMD_SUCCESS;
 }
 
 /*
  * child_send() - send command to named child.
  *
- * From '/<child-name> <command & args>' input
+ * From '/<child-name> <command & args> [&]' input
  *
  * special handling of <child-name> terminator so that
  * we can write:  /child/grandchild/...  command ...
  * i.e., w/o requiring whitespace after child names.
+ *
+ * A trailing '&' sends the command without waiting for the child to
+ * finish it, so the child can run a workload while we do something
+ * else -- e.g., migrate its memory.  See 'wait'.  The next command
+ * sent to a busy child waits for the previous one first.
+ *
+ * A slash-star prefix -- '/', '*' -- broadcasts <command> to all
+ * children.  See child_broadcast().
+ *
+ * If 'rp' is non-NULL, a synchronous command's result is copied there;
+ * otherwise it's left alone.
  */
 static char *child_delim = "\t /";
 static int
-child_send(char *cmd_str)
+child_send(char *cmd_str, child_result_t *rp)
 {
 	glctx_t *gcp = &glctx;
 	char    *child_name, *nextarg;
 	child_t *childp;
 	size_t   cmdlen;
 	char	 csave = 0;
+	bool     async = false;
 
 	cmd_str += strspn(cmd_str, child_delim);  /* initial cruft */
 
@@ -1883,6 +3819,23 @@ child_send(char *cmd_str)
 	nextarg = ++cmd_str;
 	cmd_str = nextarg + strspn(nextarg, whitespace);
 
+	/*
+	 * restore saved '/', if any
+	 */
+	if (csave)
+		*(--cmd_str) = csave;
+
+	cmdlen = strlen(cmd_str);
+	if (cmdlen && cmd_str[cmdlen-1] == '&') {
+		async = true;
+		cmd_str[--cmdlen] = '\0';
+		while (cmdlen && strchr(whitespace, cmd_str[cmdlen-1]))
+			cmd_str[--cmdlen] = '\0';
+	}
+
+	if (!strcmp(child_name, "*"))
+		return child_broadcast(cmd_str, async);
+
 	childp = child_find_by_name(child_name);
 	if (!childp) {
 		fprintf(stderr, "%s-send:  I don't have a child named %s\n",
@@ -1890,13 +3843,15 @@ child_send(char *cmd_str)
 		return CMD_ERROR;
 	}
 
-	/*
-	 * restore saved '/', if any
-	 */
-	if (csave)
-		*(--cmd_str) = csave;
+	if (childp->c_busy)
+		child_wait(childp);	/* one command at a time */
+
+	if (childp->c_exited) {
+		fprintf(stderr, "%s-send:  child %s has exited\n",
+			gcp->program_name, child_name);
+		return CMD_ERROR;	/* and don't take SIGPIPE */
+	}
 
-	cmdlen = strlen(cmd_str);
 	cmd_str[cmdlen++] = '\n';	/* for child's fgets() */
 
 	if (cmdlen != write(childp->c_cfd, cmd_str, cmdlen)) {
@@ -1909,7 +3864,16 @@ child_send(char *cmd_str)
 		return CMD_ERROR;
 	}
 
-	child_wait(childp);
+	if (async)
+		childp->c_busy = true;
+	else {
+		child_wait(childp);
+		if (rp)
+			*rp = childp->c_result;
+		if (childp->c_exited &&
+		    childp->c_result.cr_status != CMD_SUCCESS)
+			return CMD_ERROR;	/* died on an error */
+	}
 
 	childp->c_errs = 0;	/* reset on success */
 	
@@ -1917,50 +3881,234 @@ child_send(char *cmd_str)
 }
 
 /*
- * parse_signal - parse signal name/number argument
+ * command:  wait [<child-name>]
+ *
+ * wait for named child, or all children, to finish commands sent
+ * with a trailing '&'.
  */
 static int
-parse_signal(char *args)
+child_wait_cmd(char *args)
 {
 	glctx_t *gcp = &glctx;
-	char *nextarg, *sigend = strpbrk(args, whitespace);
-	int signum;
-
-	if (sigend)
-		*sigend = '\0';
-
-	if (!isdigit(*args)) {
-		signum = signum_from_name(args);
+	char    *child_name, *nextarg;
+	child_t *childp;
 
-		if (signum < 0) {
-			fprintf(stderr,
-			    "%s doesn't recognize signal %s\n",
-			    gcp->program_name, args);
-			return -1;
-		}
-	} else {
-		signum = strtoul(args, &nextarg, 0);
-		if (!signum || signum >= _NSIG) {
-			fprintf(stderr,
-			    "%s signal out of range - %d\n",
-			    gcp->program_name, signum);
-			return -1;
+	args += strspn(args, whitespace);
+	if (*args != '\0') {
+		child_name = strtok_r(args, whitespace, &nextarg);
+		child_name += strspn(child_name, "/");
+		childp = child_find_by_name(child_name);
+		if (!childp) {
+			fprintf(stderr, "%s-wait:  I don't have a child named "
+				"%s\n", gcp->program_name, child_name);
+			return CMD_ERROR;
 		}
+		if (childp->c_busy)
+			child_wait(childp);
+		(void)bcast_summary();	/* if this was the last */
+		return CMD_SUCCESS;
 	}
 
-	return signum;
+	if (list_empty(&gcp->children))
+		return CMD_SUCCESS;
+
+	if (children_collect() < 0)
+		return CMD_ERROR;	/* interrupted */
+	(void)bcast_summary();
+	return CMD_SUCCESS;
 }
 
 /*
- * Cruel, yes.  But sometimes necessary...
+ * child extent query:  parent sends '_extent <seg-name>'; child replies
+ * with this record on the response pipe, ahead of the command result.
+ */
+struct extent_reply {
+	int          er_ok;
+	seg_extent_t er_extent;
+};
+
+/*
+ * command:  _extent <seg-name>  [hidden; children only]
  */
 static int
-child_kick(char *args)
+extent_seg(char *args)
 {
 	glctx_t *gcp = &glctx;
-	char    *child_name, *nextarg;
-	child_t *childp;
-	int      signum = SIGINT;	/* default */
+	struct extent_reply reply;
+	char    *segname, *nextarg;
+
+	if (!gcp->child_name) {
+		fprintf(stderr, "%s:  %s is for child processes only\n",
+			gcp->program_name, gcp->cmd_name);
+		return CMD_ERROR;
+	}
+
+	args += strspn(args, whitespace);
+	memset(&reply, 0, sizeof(reply));
+	if (*args != '\0') {
+		segname = strtok_r(args, whitespace, &nextarg);
+		reply.er_ok = segment_extent(segname, &reply.er_extent);
+	}
+
+	if (write(gcp->response_fd, &reply, sizeof(reply)) != sizeof(reply)) {
+		int err = errno;
+		fprintf(stderr, "%s - error writing extent to parent - %s\n",
+			gcp->program_name, strerror(err));
+	}
+
+	/*
+	 * lookup failure is the parent's error, not ours:  don't
+	 * exit in batch mode.
+	 */
+	return CMD_SUCCESS;
+}
+
+/*
+ * child_extent() - look up extent of segment 'segname' in 'childp'.
+ * Ask the child if it's idle, remembering the answer.  A busy child --
+ * one running a command sent with '&' -- can't answer, so use the
+ * extent from the most recent lookup, if any.  Threads share our
+ * segment table, so just look there.
+ */
+static int
+child_extent(child_t *childp, char *segname, seg_extent_t *extent)
+{
+	glctx_t *gcp = &glctx;
+	struct extent_reply reply;
+	struct list_head *lp;
+	child_extent_t *cep = NULL;
+	char     cmd[CMDBUFSZ];
+	int      len;
+
+	if (childp->c_thread)
+		return segment_extent(segname, extent) ?
+			CMD_SUCCESS : CMD_ERROR;
+
+	list_for_each(lp, &childp->c_extents) {
+		child_extent_t *this_one = list_entry(lp, child_extent_t,
+							ce_link);
+		if (!strcmp(this_one->ce_seg, segname)) {
+			cep = this_one;
+			break;
+		}
+	}
+
+	if (childp->c_busy) {
+		if (!cep) {
+			fprintf(stderr, "%s:  child %s is busy and segment %s "
+				"has not been looked up\n", gcp->program_name,
+				childp->c_name, segname);
+			return CMD_ERROR;
+		}
+		*extent = cep->ce_extent;
+		return CMD_SUCCESS;
+	}
+
+	len = snprintf(cmd, sizeof(cmd), "_extent %s\n", segname);
+	if (write(childp->c_cfd, cmd, len) != len) {
+		int err = errno;
+		fprintf(stderr, "%s:  write to child %s failed - %s\n",
+				gcp->program_name, childp->c_name,
+				strerror(err));
+		return CMD_ERROR;
+	}
+	if (read(childp->c_rfd, &reply, sizeof(reply)) != sizeof(reply)) {
+		fprintf(stderr, "%s:  no extent reply from child %s\n",
+				gcp->program_name, childp->c_name);
+		return CMD_ERROR;
+	}
+	child_wait(childp);
+
+	if (!reply.er_ok)
+		return CMD_ERROR;	/* child said why */
+
+	if (!cep) {
+		cep = calloc(1, sizeof(*cep));
+		if (!cep)
+			return CMD_ERROR;
+		cep->ce_seg = strdup(segname);
+		list_add_tail(&cep->ce_link, &childp->c_extents);
+	}
+	cep->ce_extent = reply.er_extent;
+	*extent = reply.er_extent;
+	return CMD_SUCCESS;
+}
+
+/*
+ * get_child_pid() - parse '/<child-name>' or numeric pid argument
+ */
+static pid_t
+get_child_pid(char *arg)
+{
+	glctx_t *gcp = &glctx;
+	child_t *childp;
+	char    *next;
+	pid_t    pid;
+
+	if (*arg == '/') {
+		childp = child_find_by_name(arg + 1);
+		if (!childp) {
+			fprintf(stderr, "%s:  I don't have a child named %s\n",
+				gcp->program_name, arg + 1);
+			return -1;
+		}
+		return childp->c_pid;
+	}
+
+	pid = strtol(arg, &next, 0);
+	if (*next != '\0' || pid <= 0) {
+		fprintf(stderr, "%s:  pid must be /<child-name> or a "
+			"process id\n", gcp->program_name);
+		return -1;
+	}
+	return pid;
+}
+
+/*
+ * parse_signal - parse signal name/number argument
+ */
+static int
+parse_signal(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char *nextarg, *sigend = strpbrk(args, whitespace);
+	int signum;
+
+	if (sigend)
+		*sigend = '\0';
+
+	if (!isdigit(*args)) {
+		signum = signum_from_name(args);
+
+		if (signum < 0) {
+			fprintf(stderr,
+			    "%s doesn't recognize signal %s\n",
+			    gcp->program_name, args);
+			return -1;
+		}
+	} else {
+		signum = strtoul(args, &nextarg, 0);
+		if (!signum || signum >= _NSIG) {
+			fprintf(stderr,
+			    "%s signal out of range - %d\n",
+			    gcp->program_name, signum);
+			return -1;
+		}
+	}
+
+	return signum;
+}
+
+/*
+ * Cruel, yes.  But sometimes necessary...
+ */
+static int
+child_kick(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *child_name, *nextarg;
+	child_t *childp;
+	int      signum = SIGINT;	/* default */
 
 	args += strspn(args, whitespace);
 	if(!required_arg(args, "<child-name>"))
@@ -1980,6 +4128,12 @@ child_kick(char *args)
 		return CMD_ERROR;
 	}
 
+	if (childp->c_thread) {
+		fprintf(stderr, "%s-kick:  %s is a thread; can't kick it\n",
+			gcp->program_name, child_name);
+		return CMD_ERROR;
+	}
+
 	if (*args != '\0') {
 		signum = parse_signal(args);
 		if (signum < 0 )
@@ -2090,32 +4244,3246 @@ mprotect_seg(char *args)
 	segname = strtok_r(args, whitespace, &nextarg);
 	args = nextarg + strspn(nextarg, whitespace);
 
-	while (*args != '\0') {
-		args = strtok_r(args, whitespace, &nextarg);
+	while (*args != '\0') {
+		args = strtok_r(args, whitespace, &nextarg);
+
+		if (!strncasecmp(args, "none", strlen(args))) {
+			prot = PROT_NONE;
+			break;
+		}
+		if (!strncasecmp(args, "read", strlen(args))) {
+			prot |= PROT_READ;
+			goto next;
+		}
+		if (!strncasecmp(args, "write", strlen(args))) {
+			prot |= PROT_WRITE;
+			goto next;
+		}
+		if (!strncasecmp(args, "exec", strlen(args))) {
+			prot |= PROT_EXEC;
+			goto next;
+		}
+	next:
+		args = nextarg + strspn(nextarg, whitespace);
+	}
+
+	segment_mprotect(segname, prot);
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  vmstat [on|off]
+ */
+static int
+vmstat(char *args)
+{
+	glctx_t *gcp = &glctx;
+
+	args += strspn(args, whitespace);
+	if (*args == '\0') {
+		printf("%s:  vmstat deltas %s\n", gcp->program_name,
+			show_option(VMSTAT, off, on));
+		return CMD_SUCCESS;
+	}
+
+	if (!strcasecmp(args, "on"))
+		set_option(VMSTAT);
+	else if (!strcasecmp(args, "off"))
+		clear_option(VMSTAT);
+	else {
+		fprintf(stderr, "%s:  vmstat expects 'on' or 'off'\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  psi [on|off]
+ *           psi trigger some|full <stall-msecs> <window-msecs> [<cgroup>]
+ *           psi trigger off
+ */
+static int
+psi(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *arg, *kind, *nextarg;
+	char     path[PATH_MAX];
+	unsigned long stall, window;
+
+	args += strspn(args, whitespace);
+	if (*args == '\0') {
+		stats_psi_show();
+		return CMD_SUCCESS;
+	}
+
+	arg = strtok_r(args, whitespace, &nextarg);
+	if (!strcasecmp(arg, "on")) {
+		if (stats_psi_check() < 0)
+			return CMD_ERROR;
+		set_option(PSI);
+		return CMD_SUCCESS;
+	}
+	if (!strcasecmp(arg, "off")) {
+		clear_option(PSI);
+		return CMD_SUCCESS;
+	}
+	if (strcmp(arg, "trigger")) {
+		fprintf(stderr, "%s:  psi expects 'on', 'off' or 'trigger'\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	kind = strtok_r(NULL, whitespace, &nextarg);
+	if (kind && !strcmp(kind, "off")) {
+		stats_psi_trigger_off();
+		return CMD_SUCCESS;
+	}
+	if (!kind || (strcmp(kind, "some") && strcmp(kind, "full"))) {
+		fprintf(stderr, "%s:  psi trigger expects 'some', 'full' or "
+			"'off'\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	arg = strtok_r(NULL, whitespace, &nextarg);
+	if (!arg || !isdigit(*arg) || !(stall = strtoul(arg, NULL, 0)))
+		goto bad_time;
+	arg = strtok_r(NULL, whitespace, &nextarg);
+	if (!arg || !isdigit(*arg) || !(window = strtoul(arg, NULL, 0)))
+		goto bad_time;
+
+	arg = strtok_r(NULL, whitespace, &nextarg);
+	if (arg && cgroup_file(arg, "memory.pressure", path,
+				sizeof(path)) < 0)
+		return CMD_ERROR;
+	if (!arg && stats_psi_check() < 0)
+		return CMD_ERROR;
+
+	if (stats_psi_trigger(arg ? path : NULL, kind, stall * 1000,
+				window * 1000) < 0)
+		return CMD_ERROR;
+	return CMD_SUCCESS;
+
+bad_time:
+	fprintf(stderr, "%s:  psi trigger expects <stall-msecs> "
+		"<window-msecs>\n", gcp->program_name);
+	return CMD_ERROR;
+}
+
+/*
+ * =========================================================================
+ * script variables, arithmetic and repeat blocks
+ *
+ * 'set' variables are per command stream:  memtoy and each child or
+ * thread has its own.  ${<name>} and $((<expr>)) are expanded by the
+ * memtoy that reads the command line -- before it forwards the line to
+ * a child.  A 'repeat' block is read and parsed once into a list of
+ * commands; each pass just expands and dispatches the list.
+ */
+struct script_var {
+	struct script_var *sv_next;
+	char              *sv_name;
+	char              *sv_value;
+};
+
+static __thread struct script_var *script_vars;
+
+struct script_cmd {
+	struct script_cmd *sc_next;
+	struct script_cmd *sc_body;	/* repeat:  commands in block */
+	char              *sc_line;	/* command line or repeat header */
+};
+
+static __thread int script_depth;	/* > 0 => reading a block */
+static bool cmd_from_socket;		/* no input to read blocks from */
+
+#define SCRIPT_INTR 2	/* repeat interrupted -- neither success nor error */
+
+static struct script_var *
+script_var_find(char *name, size_t len)
+{
+	struct script_var *svp;
+
+	for (svp = script_vars; svp; svp = svp->sv_next)
+		if (!strncmp(svp->sv_name, name, len) &&
+		    svp->sv_name[len] == '\0')
+			return svp;
+	return NULL;
+}
+
+/*
+ * script_var_set() - define, or redefine, variable 'name'.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int
+script_var_set(char *name, char *value)
+{
+	glctx_t *gcp = &glctx;
+	struct script_var *svp, **svpp;
+	char *newval;
+
+	newval = strdup(value);
+	if (!newval)
+		goto nomem;
+
+	svp = script_var_find(name, strlen(name));
+	if (svp) {
+		free(svp->sv_value);
+		svp->sv_value = newval;
+		return 0;
+	}
+
+	svp = calloc(1, sizeof(*svp));
+	if (!svp || !(svp->sv_name = strdup(name))) {
+		free(svp);
+		free(newval);
+		goto nomem;
+	}
+	svp->sv_value = newval;
+
+	for (svpp = &script_vars; *svpp; svpp = &(*svpp)->sv_next)
+		;		/* keep definition order for 'set' listing */
+	*svpp = svp;
+	return 0;
+
+nomem:
+	fprintf(stderr, "%s:  can't allocate variable %s\n",
+		gcp->program_name, name);
+	return -1;
+}
+
+static void
+script_var_unset(char *name)
+{
+	struct script_var *svp, **svpp;
+
+	for (svpp = &script_vars; (svp = *svpp); svpp = &svp->sv_next) {
+		if (strcmp(svp->sv_name, name))
+			continue;
+		*svpp = svp->sv_next;
+		free(svp->sv_name);
+		free(svp->sv_value);
+		free(svp);
+		return;
+	}
+}
+
+static bool
+script_var_name_ok(char *name)
+{
+	if (!isalpha(*name) && *name != '_')
+		return false;
+	while (*++name)
+		if (!isalnum(*name) && *name != '_')
+			return false;
+	return true;
+}
+
+/*
+ * expression evaluation for 'set' and $((...)):  + - * / % and
+ * parentheses over integers, each with an optional k, m, g or p [pages]
+ * scale factor, as for segment sizes and offsets.
+ */
+static bool expr_sum(char **, long long *);
+
+static bool
+expr_factor(char **sp, long long *valp)
+{
+	char *s = *sp + strspn(*sp, whitespace);
+	unsigned long long val;
+
+	if (*s == '-') {
+		*sp = s + 1;
+		if (!expr_factor(sp, valp))
+			return false;
+		*valp = -*valp;
+		return true;
+	}
+
+	if (*s == '(') {
+		*sp = s + 1;
+		if (!expr_sum(sp, valp))
+			return false;
+		s = *sp + strspn(*sp, whitespace);
+		if (*s != ')')
+			return false;
+		*sp = s + 1;
+		return true;
+	}
+
+	if (!isdigit(*s))
+		return false;
+	val = strtoull(s, &s, 0);
+
+	switch (tolower(*s)) {
+	case 'p':	/* pages */
+		val *= glctx.pagesize;
+		++s;
+		break;
+
+	case 'k':
+		val <<= KILO_SHIFT;
+		++s;
+		break;
+
+	case 'm':
+		val <<= KILO_SHIFT * 2;
+		++s;
+		break;
+
+	case 'g':
+		val <<= KILO_SHIFT * 3;
+		++s;
+		break;
+	}
+	if (isalnum(*s) || *s == '_')
+		return false;	/* bogus chars after number */
+
+	*sp = s;
+	*valp = (long long)val;
+	return true;
+}
+
+static bool
+expr_term(char **sp, long long *valp)
+{
+	long long rhs;
+	char *s, op;
+
+	if (!expr_factor(sp, valp))
+		return false;
+
+	for (;;) {
+		s = *sp + strspn(*sp, whitespace);
+		op = *s;
+		if (op != '*' && op != '/' && op != '%')
+			return true;
+		*sp = s + 1;
+		if (!expr_factor(sp, &rhs))
+			return false;
+		if (op == '*')
+			*valp *= rhs;
+		else if (!rhs)
+			return false;	/* divide by zero */
+		else if (op == '/')
+			*valp /= rhs;
+		else
+			*valp %= rhs;
+	}
+}
+
+static bool
+expr_sum(char **sp, long long *valp)
+{
+	long long rhs;
+	char *s, op;
+
+	if (!expr_term(sp, valp))
+		return false;
+
+	for (;;) {
+		s = *sp + strspn(*sp, whitespace);
+		op = *s;
+		if (op != '+' && op != '-')
+			return true;
+		*sp = s + 1;
+		if (!expr_term(sp, &rhs))
+			return false;
+		*valp = (op == '+') ? *valp + rhs : *valp - rhs;
+	}
+}
+
+/*
+ * expr_eval() - evaluate all of 'str' as an expression.
+ * Returns false, quietly, if 'str' isn't a valid expression.
+ */
+static bool
+expr_eval(char *str, long long *valp)
+{
+	char *s = str;
+
+	if (!expr_sum(&s, valp))
+		return false;
+	s += strspn(s, whitespace);
+	return *s == '\0';
+}
+
+/*
+ * script_expand() - copy 'line' to 'buf', replacing ${<name>} with the
+ * variable's value and $((<expr>)) with the expression's value.  'line'
+ * is not modified, so that a block's commands may be expanded on each
+ * pass.  Returns 'buf', or NULL on error.
+ */
+static char *
+script_expand(char *line, char *buf, size_t bufsz)
+{
+	glctx_t *gcp = &glctx;
+	char *out = buf, *end = buf + bufsz - 1;
+
+	while (*line) {
+		char  *val, valbuf[32];
+		size_t len;
+
+		if (line[0] != '$' ||
+		    (line[1] != '{' && strncmp(line + 1, "((", 2))) {
+			if (out == end)
+				goto too_long;
+			*out++ = *line++;
+			continue;
+		}
+
+		if (line[1] == '{') {
+			struct script_var *svp;
+			char *close = strchr(line, '}');
+
+			if (!close) {
+				fprintf(stderr, "%s:  missing '}' after '${'\n",
+					gcp->program_name);
+				return NULL;
+			}
+			len = close - (line + 2);
+			svp = script_var_find(line + 2, len);
+			if (!svp) {
+				fprintf(stderr, "%s:  undefined variable %.*s\n",
+					gcp->program_name, (int)len, line + 2);
+				return NULL;
+			}
+			val  = svp->sv_value;
+			line = close + 1;
+		} else {
+			char  expr[CMDBUFSZ], expanded[CMDBUFSZ], *p;
+			long long value;
+			int   depth = 0;
+
+			for (p = line + 3; *p; ++p) {
+				if (*p == '(')
+					++depth;
+				else if (*p == ')' && depth)
+					--depth;
+				else if (*p == ')' && p[1] == ')')
+					break;
+			}
+			if (!*p) {
+				fprintf(stderr, "%s:  missing '))' after '$(('\n",
+					gcp->program_name);
+				return NULL;
+			}
+			len = p - (line + 3);
+			memcpy(expr, line + 3, len);	/* line < CMDBUFSZ */
+			expr[len] = '\0';
+			if (!script_expand(expr, expanded, sizeof(expanded)))
+				return NULL;
+			if (!expr_eval(expanded, &value)) {
+				fprintf(stderr, "%s:  bad expression:  %s\n",
+					gcp->program_name, expanded);
+				return NULL;
+			}
+			snprintf(valbuf, sizeof(valbuf), "%lld", value);
+			val  = valbuf;
+			line = p + 2;
+		}
+
+		len = strlen(val);
+		if (len > end - out)
+			goto too_long;
+		memcpy(out, val, len);
+		out += len;
+	}
+
+	*out = '\0';
+	return buf;
+
+too_long:
+	fprintf(stderr, "%s:  expanded command line too long\n",
+		gcp->program_name);
+	return NULL;
+}
+
+static void
+script_free(struct script_cmd *scp)
+{
+	while (scp) {
+		struct script_cmd *next = scp->sc_next;
+
+		script_free(scp->sc_body);
+		free(scp->sc_line);
+		free(scp);
+		scp = next;
+	}
+}
+
+/*
+ * script_is_repeat() - does command line 'cmdline' open a repeat block?
+ */
+static bool
+script_is_repeat(char *cmdline)
+{
+	size_t len = strcspn(cmdline, whitespace);
+
+	return len == strlen("repeat") && !strncmp(cmdline, "repeat", len) &&
+		cmdline[strlen(cmdline) - 1] == '{';
+}
+
+/*
+ * script_read() - read the commands of a block, up to its closing '}',
+ * into a list.  Nested repeat blocks become a header with a body list.
+ */
+static struct script_cmd *
+script_read(bool *errp)
+{
+	glctx_t *gcp = &glctx;
+	struct script_cmd *list = NULL, **tailp = &list;
+
+	++script_depth;
+	for (;;) {
+		struct script_cmd *scp;
+		char *saved_cmdline, *cmdline;
+
+		saved_cmdline = read_command_line("> ");
+		cmdline = cmd_trim(saved_cmdline);
+		if (!cmdline) {
+			cmd_free(saved_cmdline);
+			continue;	/* blank line or comment */
+		}
+		if (!strcmp(cmdline, "}")) {
+			cmd_free(saved_cmdline);
+			break;
+		}
+
+		scp = calloc(1, sizeof(*scp));
+		if (!scp || !(scp->sc_line = strdup(cmdline))) {
+			fprintf(stderr, "%s:  can't allocate repeat block\n",
+				gcp->program_name);
+			free(scp);
+			cmd_free(saved_cmdline);
+			*errp = true;
+			continue;	/* consume the rest of the block */
+		}
+		cmd_free(saved_cmdline);
+		*tailp = scp;
+		tailp = &scp->sc_next;
+
+		if (script_is_repeat(scp->sc_line))
+			scp->sc_body = script_read(errp);
+	}
+	--script_depth;
+
+	return list;
+}
+
+static int script_repeat(char *, struct script_cmd *);
+
+/*
+ * script_run() - run a list of commands once.  Stop at the first error,
+ * or if a signal arrives between commands.  A SIGINT counts even if the
+ * command it interrupted took it.
+ */
+static int
+script_run(struct script_cmd *list)
+{
+	glctx_t *gcp = &glctx;
+	struct script_cmd *scp;
+
+	for (scp = list; scp; scp = scp->sc_next) {
+		int ret;
+
+		if (signalled(gcp) || gcp->interrupted)
+			return SCRIPT_INTR;
+
+		if (scp->sc_body) {
+			char cmdbuf[CMDBUFSZ], *args;
+
+			if (!script_expand(scp->sc_line, cmdbuf, sizeof(cmdbuf)))
+				return CMD_ERROR;
+			vprint("%s>%s\n", gcp->program_name, cmdbuf);
+			args = cmdbuf + strcspn(cmdbuf, whitespace);
+			ret = script_repeat(args, scp->sc_body);
+		} else
+			ret = run_command_line(scp->sc_line);
+
+		if (ret != CMD_SUCCESS)
+			return ret;
+	}
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * script_repeat_args() - parse "<count> [<var>] {"
+ */
+static int
+script_repeat_args(char *args, long long *countp, char **varp)
+{
+	glctx_t *gcp = &glctx;
+	char *brace, *var;
+
+	args += strspn(args, whitespace);
+	brace = strrchr(args, '{');
+	if (!brace || brace[1] != '\0') {
+		fprintf(stderr, "%s:  repeat expects '{' at end of line\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	*brace = '\0';
+
+	/*
+	 * optional loop variable follows the count expression
+	 */
+	*varp = NULL;
+	while (brace > args && strchr(whitespace, brace[-1]))
+		*--brace = '\0';
+	var = brace;
+	while (var > args && (isalnum(var[-1]) || var[-1] == '_'))
+		--var;
+	if (var > args && strchr(whitespace, var[-1]) &&
+	    script_var_name_ok(var)) {
+		*varp = var;
+		var[-1] = '\0';
+	}
+
+	if (!expr_eval(args, countp) || *countp < 0) {
+		fprintf(stderr, "%s:  bad repeat count:  %s\n",
+			gcp->program_name, args);
+		return CMD_ERROR;
+	}
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * script_repeat() - run a block <count> times
+ */
+static int
+script_repeat(char *args, struct script_cmd *body)
+{
+	glctx_t *gcp = &glctx;
+	long long count, pass;
+	char *var;
+	int ret = CMD_SUCCESS;
+
+	if (script_repeat_args(args, &count, &var) != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	for (pass = 0; pass < count; ++pass) {
+		children_reap();	/* as between top level commands */
+
+		if (var) {
+			char value[32];
+
+			snprintf(value, sizeof(value), "%lld", pass);
+			if (script_var_set(var, value) < 0)
+				return CMD_ERROR;
+		}
+
+		ret = script_run(body);
+		if (ret == SCRIPT_INTR) {
+			printf("%s:  repeat interrupted after %lld of %lld "
+				"passes\n", gcp->program_name, pass, count);
+			break;
+		}
+		if (ret != CMD_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * command:  set [<name>=[<value>]]
+ */
+static int
+set_var(char *args)
+{
+	glctx_t *gcp = &glctx;
+	struct script_var *svp;
+	char *eq, *end, *value, valbuf[32];
+	long long expr;
+
+	args += strspn(args, whitespace);
+	if (*args == '\0') {
+		for (svp = script_vars; svp; svp = svp->sv_next)
+			printf("%s=%s\n", svp->sv_name, svp->sv_value);
+		return CMD_SUCCESS;
+	}
+
+	eq = strchr(args, '=');
+	if (!eq) {
+		fprintf(stderr, "%s:  set expects <name>=<value>\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	for (end = eq; end > args && strchr(whitespace, end[-1]); --end)
+		;
+	*end = '\0';
+	value = eq + 1;
+	value += strspn(value, whitespace);
+
+	if (!script_var_name_ok(args)) {
+		fprintf(stderr, "%s:  bad variable name:  %s\n",
+			gcp->program_name, args);
+		return CMD_ERROR;
+	}
+
+	if (*value == '\0') {
+		script_var_unset(args);
+		return CMD_SUCCESS;
+	}
+
+	/*
+	 * store arithmetic as its value; anything else as is
+	 */
+	if (expr_eval(value, &expr)) {
+		snprintf(valbuf, sizeof(valbuf), "%lld", expr);
+		value = valbuf;
+	}
+
+	if (script_var_set(args, value) < 0)
+		return CMD_ERROR;
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  repeat <count> [<var>] {
+ *	...
+ *	}
+ */
+static int
+repeat_cmd(char *args)
+{
+	glctx_t *gcp = &glctx;
+	struct script_cmd *body;
+	long long count;
+	char *header, *var;
+	bool err = false;
+	int ret;
+
+	if (gcp->child_name) {
+		fprintf(stderr, "%s:  children and threads can't read repeat "
+			"blocks -- repeat '/<child> ...' commands instead\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	if (cmd_from_socket) {
+		fprintf(stderr, "%s:  repeat blocks aren't supported over the "
+			"control socket\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	/*
+	 * check the header before reading the block, but keep it intact
+	 * for script_repeat()
+	 */
+	header = strdup(args);
+	if (!header) {
+		fprintf(stderr, "%s:  can't allocate repeat block\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	if (script_repeat_args(header, &count, &var) != CMD_SUCCESS) {
+		free(header);
+		return CMD_ERROR;
+	}
+	free(header);
+
+	body = script_read(&err);
+	if (err) {
+		script_free(body);
+		return CMD_ERROR;
+	}
+
+	ret = script_repeat(args, body);
+	script_free(body);
+
+	if (ret == SCRIPT_INTR) {
+		if (signalled(gcp)) {
+			if (!is_option(INTERACTIVE) &&
+			    gcp->siginfo->si_signo == SIGQUIT)
+				exit(0);
+			reset_signal();
+		}
+		gcp->interrupted = false;
+		ret = CMD_SUCCESS;
+	}
+	return ret;
+}
+
+/*
+ * bench_run() - run 'cmd' once; return its elapsed usecs, or -1 on error.
+ * Prefer the operation's own timing [result_record()] or a child's result
+ * record over our wall time around the command, which includes parsing
+ * and, for children, the pipe round trip.
+ */
+static long
+bench_run(char *cmd)
+{
+	glctx_t *gcp = &glctx;
+	char     cmdbuf[CMDBUFSZ];
+	child_t *childp = NULL;
+	struct timeval t_start, t_end;
+	char    *cmd_name = gcp->cmd_name, *result_name = last_cmd_name;
+	long     usecs;
+	int      ret;
+
+	strcpy(cmdbuf, cmd);		/* parsing modifies command */
+	gcp->result.r_op = NULL;
+
+	if (*cmdbuf == '/') {
+		char  *name = cmdbuf + strspn(cmdbuf, child_delim);
+		size_t len  = strcspn(name, child_delim);
+		char   csave = name[len];
+
+		name[len] = '\0';
+		if (strcmp(name, "*"))
+			childp = child_find_by_name(name);
+		name[len] = csave;
+		if (childp)
+			memset(&childp->c_result, 0, sizeof(childp->c_result));
+	}
+
+	gettimeofday(&t_start, NULL);
+	if (*cmdbuf == '/')
+		ret = child_send(cmdbuf + 1, NULL);
+	else
+		ret = parse_command(cmdbuf);
+	gettimeofday(&t_end, NULL);
+
+	/*
+	 * the benched command's result is reported as bench's own
+	 */
+	gcp->cmd_name = cmd_name;
+	last_cmd_name = result_name;
+
+	if (ret == CMD_ERROR)
+		return -1;
+
+	usecs = tv_diff_usec(&t_start, &t_end);
+	if (childp && *childp->c_result.cr_cmd) {
+		if (childp->c_result.cr_status == CMD_ERROR)
+			return -1;
+		usecs = childp->c_result.cr_usecs;
+	} else if (gcp->result.r_op)
+		usecs = gcp->result.r_usecs;
+
+	return usecs;
+}
+
+/*
+ * command:  bench <count> [warmup=<n>] <command>
+ */
+static int
+bench(char *args)
+{
+	glctx_t *gcp = &glctx;
+	unsigned long saved_options = gcp->options;
+	unsigned long *values, nr_warmup = 0, nr_runs;
+	char   *nextarg, *cmd, *end, *op;
+	double  mean = 0.0, stddev = 0.0;
+	int     ret = CMD_ERROR;
+	int     i, nr = 0;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<count>"))
+		return CMD_ERROR;
+	args = strtok_r(args, whitespace, &nextarg);
+	nr_runs = strtoul(args, &end, 0);
+	if (*end != '\0' || !nr_runs) {
+		fprintf(stderr, "%s:  bench <count> must be a positive "
+			"number\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	args = nextarg + strspn(nextarg, whitespace);
+	if (!strncmp(args, "warmup=", 7)) {
+		args = strtok_r(args, whitespace, &nextarg);
+		nr_warmup = strtoul(args + 7, &end, 0);
+		if (*end != '\0') {
+			fprintf(stderr, "%s:  bad warmup count:  %s\n",
+				gcp->program_name, args + 7);
+			return CMD_ERROR;
+		}
+		args = nextarg + strspn(nextarg, whitespace);
+	}
+
+	if(!required_arg(args, "<command>"))
+		return CMD_ERROR;
+	cmd = args;
+	if (script_is_repeat(cmd) || cmd[strlen(cmd) - 1] == '&') {
+		fprintf(stderr, "%s:  can't bench a repeat block or an "
+			"asynchronous child command\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	values = calloc(nr_runs, sizeof(*values));
+	if (!values) {
+		fprintf(stderr, "%s:  can't allocate %lu bench results\n",
+			gcp->program_name, nr_runs);
+		return CMD_ERROR;
+	}
+
+	set_option(QUIET);
+	for (i = 0; i < nr_warmup + nr_runs; ++i) {
+		long usecs = bench_run(cmd);
+
+		/*
+		 * the command may have taken the signal itself; either way
+		 * the interrupted run's time is partial, so drop it
+		 */
+		if (signalled(gcp) || gcp->interrupted) {
+			if (signalled(gcp))
+				reset_signal();
+			gcp->interrupted = false;
+			printf("%s:  bench interrupted after %d runs\n",
+				gcp->program_name, nr);
+			break;
+		}
+		if (usecs < 0) {
+			fprintf(stderr, "%s:  bench:  '%s' failed on run %d\n",
+				gcp->program_name, cmd, i + 1);
+			goto out_free;
+		}
+		if (i >= nr_warmup)
+			values[nr++] = usecs;
+	}
+	gcp->options = saved_options;
+
+	ret = CMD_SUCCESS;
+	if (!nr)
+		goto out_free;
+
+	if (is_option(VERBOSE))
+		for (i = 0; i < nr; ++i)
+			printf("    run %4d  %10.6f secs\n", i + 1,
+				values[i] / 1000000.0);
+
+	for (i = 0; i < nr; ++i)
+		mean += values[i];
+	mean /= nr;
+	for (i = 0; i < nr; ++i)
+		stddev += (values[i] - mean) * (values[i] - mean);
+	if (nr > 1)
+		stddev = sqrt(stddev / (nr - 1));
+	else
+		stddev = 0.0;
+
+	qsort(values, nr, sizeof(*values), ulong_cmp);
+
+	op = gcp->result.r_op ? gcp->result.r_op : cmd;
+	printf("%s:  bench %s:  %d runs", gcp->program_name, op, nr);
+	if (nr_warmup)
+		printf(", %lu warmup", nr_warmup);
+	printf("\n");
+	printf("    %10s %10s %10s %10s %10s %10s\n",
+		"min", "mean", "median", "p95", "max", "stddev");
+	printf("    %10.6f %10.6f %10.6f %10.6f %10.6f %10.6f secs",
+		values[0] / 1000000.0, mean / 1000000.0,
+		percentile(values, nr, 50) / 1000000.0,
+		percentile(values, nr, 95) / 1000000.0,
+		values[nr - 1] / 1000000.0, stddev / 1000000.0);
+	if (mean > 0.0)
+		printf("  [%.1f%%]", 100.0 * stddev / mean);
+	printf("\n");
+
+	/*
+	 * throughput, if the operation recorded its size
+	 */
+	if (gcp->result.r_op && gcp->result.r_pages &&
+	    gcp->result.r_pagesize && percentile(values, nr, 50)) {
+		double bytes = (double)gcp->result.r_pages *
+			       gcp->result.r_pagesize;
+
+		printf("    %lu %ldk pages per run:  %.3f GB/s at median\n",
+			gcp->result.r_pages, gcp->result.r_pagesize / 1024,
+			bytes / percentile(values, nr, 50) / 1000.0);
+	}
+
+	result_record("bench", percentile(values, nr, 50),
+		gcp->result.r_op ? gcp->result.r_pages : 0,
+		gcp->result.r_op ? gcp->result.r_pagesize : 0, 0);
+
+out_free:
+	gcp->options = saved_options;
+	free(values);
+	return ret;
+}
+
+/*
+ * =========================================================================
+ * cgroup v2 sandboxes -- see cgroup.c
+ */
+/*
+ * cgroup_settings() - write each <file>=<value> arg to cgroup 'name'.
+ * memory.* values may be scaled, as for segment sizes.
+ */
+static int
+cgroup_settings(char *name, char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *arg, *value, *nextarg;
+	char     scaled[32];
+
+	for (arg = strtok_r(args, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		value = strchr(arg, '=');
+		if (!value || value == arg || !value[1]) {
+			fprintf(stderr, "%s:  expected <file>=<value>, not %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+		*value++ = '\0';
+
+		if (!strncmp(arg, "memory.", 7) && isdigit(*value)) {
+			size_t size = size_kmgp(value);
+
+			if (size == BOGUS_SIZE) {
+				fprintf(stderr, "%s:  cgroup %s must be numeric "
+					"value followed by optional k, m, g or p "
+					"[pages] scale factor.\n",
+					gcp->program_name, arg);
+				return CMD_ERROR;
+			}
+			snprintf(scaled, sizeof(scaled), "%lu", size);
+			value = scaled;
+		}
+
+		if (cgroup_set(name, arg, value) < 0)
+			return CMD_ERROR;
+	}
+	return CMD_SUCCESS;
+}
+
+/*
+ * cgroup_pid() - pid of memtoy [NULL], a child by name, or a pid
+ */
+static pid_t
+cgroup_pid(char *arg)
+{
+	glctx_t *gcp = &glctx;
+	child_t *childp;
+
+	if (!arg)
+		return getpid();
+
+	childp = child_find_by_name(arg);
+	if (childp) {
+		if (childp->c_thread) {
+			fprintf(stderr, "%s:  %s is a thread -- it shares "
+				"memtoy's cgroup\n", gcp->program_name, arg);
+			return -1;
+		}
+		return childp->c_pid;
+	}
+
+	if (isdigit(*arg) && strspn(arg, "0123456789") == strlen(arg))
+		return atoi(arg);
+
+	fprintf(stderr, "%s:  no such child:  %s\n", gcp->program_name, arg);
+	return -1;
+}
+
+/*
+ * command:  cgroup [create|set|move|show|watch|remove ...]
+ */
+static int
+cgroup(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *subcmd, *name, *nextarg;
+	pid_t    pid;
+
+	if (gcp->cmd_thread) {
+		fprintf(stderr, "%s:  threads can't manage cgroups\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	args += strspn(args, whitespace);
+	if (*args == '\0')
+		return cgroup_show(NULL) < 0 ? CMD_ERROR : CMD_SUCCESS;
+
+	subcmd = strtok_r(args, whitespace, &nextarg);
+	name   = strtok_r(NULL, whitespace, &nextarg);
+	args   = nextarg + strspn(nextarg, whitespace);
+	if (!name) {
+		fprintf(stderr, "%s:  cgroup %s needs a <cgroup-name>\n",
+			gcp->program_name, subcmd);
+		return CMD_ERROR;
+	}
+
+	if (!strcmp(subcmd, "create")) {
+		if (cgroup_create(name) < 0)
+			return CMD_ERROR;
+		if (cgroup_settings(name, args) != CMD_SUCCESS) {
+			(void)cgroup_remove(name);
+			return CMD_ERROR;
+		}
+		return CMD_SUCCESS;
+	}
+
+	if (!strcmp(subcmd, "set")) {
+		if(!required_arg(args, "<file>=<value>"))
+			return CMD_ERROR;
+		return cgroup_settings(name, args);
+	}
+
+	if (!strcmp(subcmd, "move")) {
+		pid = cgroup_pid(*args ? strtok_r(args, whitespace, &nextarg)
+					: NULL);
+		if (pid < 0 || cgroup_move(name, pid) < 0)
+			return CMD_ERROR;
+		return CMD_SUCCESS;
+	}
+
+	if (!strcmp(subcmd, "show"))
+		return cgroup_show(name) < 0 ? CMD_ERROR : CMD_SUCCESS;
+
+	if (!strcmp(subcmd, "watch"))
+		return cgroup_watch(strcmp(name, "off") ? name : NULL) < 0 ?
+			CMD_ERROR : CMD_SUCCESS;
+
+	if (!strcmp(subcmd, "remove"))
+		return cgroup_remove(name) < 0 ? CMD_ERROR : CMD_SUCCESS;
+
+	fprintf(stderr, "%s:  unrecognized cgroup command:  %s\n",
+		gcp->program_name, subcmd);
+	return CMD_ERROR;
+}
+
+/*
+ * =========================================================================
+ * swapbench:  page a segment out with MADV_PAGEOUT, and fault it back in
+ */
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define ZSWAP_DEBUGFS "/sys/kernel/debug/zswap"
+
+static char *swap_vm_names[] = {
+	"pswpout", "pswpin", "zswpout", "zswpin", NULL
+};
+static char *swap_mi_names[] = { "Zswap", "Zswapped", NULL };
+
+struct swap_stats {
+	unsigned long ss_vm[4];		/* swap_vm_names */
+	unsigned long ss_zswap[2];	/* compressed, stored kB */
+	bool          ss_have_zswap;
+	unsigned long ss_zram[3];	/* orig, compr, used bytes */
+	int           ss_nr_zram;
+};
+
+static unsigned long
+read_ulong(char *path, bool *okp)
+{
+	FILE         *fp = fopen(path, "r");
+	unsigned long value = 0;
+
+	*okp = fp && fscanf(fp, "%lu", &value) == 1;
+	if (fp)
+		fclose(fp);
+	return value;
+}
+
+/*
+ * swap_stats_read() - swap counters, and what zswap and zram hold:  from
+ * /proc/meminfo Zswap/Zswapped or, for older kernels, zswap's debugfs;
+ * from each zram device's mm_stat.
+ */
+static void
+swap_stats_read(struct swap_stats *ssp)
+{
+	glctx_t       *gcp = &glctx;
+	DIR           *dp;
+	struct dirent *dep;
+	unsigned long  stored, pool;
+	bool           ok1, ok2;
+
+	memset(ssp, 0, sizeof(*ssp));
+	(void)stats_read_values("/proc/vmstat", swap_vm_names, ssp->ss_vm);
+
+	if (stats_read_values("/proc/meminfo", swap_mi_names,
+				ssp->ss_zswap) == 2)
+		ssp->ss_have_zswap = true;
+	else {
+		stored = read_ulong(ZSWAP_DEBUGFS "/stored_pages", &ok1);
+		pool   = read_ulong(ZSWAP_DEBUGFS "/pool_total_size", &ok2);
+		if (ok1 && ok2) {
+			ssp->ss_zswap[0] = pool / 1024;
+			ssp->ss_zswap[1] = stored * gcp->pagesize / 1024;
+			ssp->ss_have_zswap = true;
+		}
+	}
+
+	dp = opendir("/sys/block");
+	if (!dp)
+		return;
+	while ((dep = readdir(dp))) {
+		char          path[PATH_MAX];
+		unsigned long orig, compr, used;
+		FILE         *fp;
+
+		if (strncmp(dep->d_name, "zram", 4))
+			continue;
+		snprintf(path, sizeof(path), "/sys/block/%s/mm_stat",
+			dep->d_name);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (fscanf(fp, "%lu %lu %lu", &orig, &compr, &used) == 3) {
+			ssp->ss_zram[0] += orig;
+			ssp->ss_zram[1] += compr;
+			ssp->ss_zram[2] += used;
+			++ssp->ss_nr_zram;
+		}
+		fclose(fp);
+	}
+	closedir(dp);
+}
+
+static void
+swap_stats_show(struct swap_stats *before, struct swap_stats *after)
+{
+	long stored, compr;
+	int  i;
+
+	if (after->ss_have_zswap) {
+		compr  = after->ss_zswap[0] - before->ss_zswap[0];
+		stored = after->ss_zswap[1] - before->ss_zswap[1];
+		printf("    zswap:    %+ld kB stored in %+ld kB", stored, compr);
+		if (stored > 0 && compr > 0)
+			printf(" -- %.2f:1", (double)stored / compr);
+		printf("\n");
+	}
+
+	if (after->ss_nr_zram) {
+		stored = after->ss_zram[0] - before->ss_zram[0];
+		compr  = after->ss_zram[1] - before->ss_zram[1];
+		printf("    zram:     %+ld kB stored in %+ld kB [%+ld kB used]",
+			stored / 1024, compr / 1024,
+			(long)(after->ss_zram[2] - before->ss_zram[2]) / 1024);
+		if (stored > 0 && compr > 0)
+			printf(" -- %.2f:1", (double)stored / compr);
+		printf("\n");
+	}
+
+	printf("    vmstat:  ");
+	for (i = 0; swap_vm_names[i]; ++i)
+		printf(" %s %+ld", swap_vm_names[i],
+			(long)(after->ss_vm[i] - before->ss_vm[i]));
+	printf("\n");
+}
+
+/*
+ * resident_pages() - how many of 'nr_pages' pages at 'start' are in memory
+ */
+static long
+resident_pages(char *start, unsigned long nr_pages, size_t pagesize)
+{
+	glctx_t       *gcp = &glctx;
+	unsigned char *vec;
+	unsigned long  i;
+	long           nr_resident = 0;
+
+	vec = malloc(nr_pages);
+	if (!vec || mincore(start, nr_pages * pagesize, vec) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  mincore() failed - %s\n",
+			gcp->program_name, vec ? strerror(err) : "no memory");
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < nr_pages; ++i)
+		nr_resident += vec[i] & 1;
+	free(vec);
+	return nr_resident;
+}
+
+/*
+ * is_swapped() - pagemap_walk() func:  pte replaced by a swap entry?
+ */
+static int
+is_swapped(unsigned long long entry, void *arg)
+{
+	return !(entry & PM_PRESENT) && (entry & PM_SWAPPED);
+}
+
+/*
+ * swapped_pages() - how many of 'nr_pages' pages at 'start' have their
+ * pte replaced by a swap entry, per /proc/self/pagemap.  A page whose
+ * swap writeback hasn't completed stays in the swap cache -- resident,
+ * to mincore() -- though it has been unmapped.
+ */
+static long
+swapped_pages(char *start, unsigned long nr_pages, size_t pagesize)
+{
+	glctx_t *gcp = &glctx;
+	long     nr_swapped;
+
+	nr_swapped = pagemap_walk(start, nr_pages, pagesize, is_swapped, NULL);
+	if (nr_swapped < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't read /proc/self/pagemap - %s\n",
+			gcp->program_name, strerror(err));
+	}
+	return nr_swapped;
+}
+
+/*
+ * swap_pattern() - parse pattern=zero|compressible[:<ratio>]|random into
+ * a fill_page() compression ratio
+ */
+static int
+swap_pattern(char *pattern, double *ratiop)
+{
+	glctx_t *gcp = &glctx;
+	char    *end;
+
+	if (!strcmp(pattern, "zero"))
+		*ratiop = 0.0;
+	else if (!strcmp(pattern, "random"))
+		*ratiop = 1.0;
+	else if (!strncmp(pattern, "compressible", 12) &&
+		 (pattern[12] == '\0' || pattern[12] == ':')) {
+		*ratiop = 2.0;
+		if (pattern[12] == ':') {
+			*ratiop = strtod(pattern + 13, &end);
+			if (end == pattern + 13 || *end != '\0' ||
+			    *ratiop < 1.0) {
+				fprintf(stderr, "%s:  compressible:<ratio> "
+					"needs a ratio >= 1\n",
+					gcp->program_name);
+				return CMD_ERROR;
+			}
+		}
+	} else {
+		fprintf(stderr, "%s:  unrecognized pattern:  %s\n",
+			gcp->program_name, pattern);
+		return CMD_ERROR;
+	}
+	return CMD_SUCCESS;
+}
+
+static double
+ts_diff_nsec(struct timespec *stp, struct timespec *etp)
+{
+	return (etp->tv_sec - stp->tv_sec) * 1e9 +
+		(etp->tv_nsec - stp->tv_nsec);
+}
+
+/*
+ * command:  swapbench <seg-name> [<offset> <length>]
+ *               [pattern=zero|compressible[:<ratio>]|random]
+ */
+static int
+swapbench(char *args)
+{
+	glctx_t          *gcp = &glctx;
+	char             *segname, *arg, *nextarg, *start, *scratch = NULL;
+	char             *pattern = "random";
+	range_t           range = { 0L, 0L };
+	seg_extent_t      extent;
+	struct swap_stats ss_before, ss_after;
+	struct timeval    t_start, t_end;
+	struct timespec   ts_start, ts_end;
+	unsigned long    *lat = NULL, nr_pages, i, nr_bad = 0;
+	unsigned long     fill_usecs, out_usecs, in_usecs;
+	size_t            pagesize = gcp->pagesize;
+	long              nr_before, nr_out, nr_cached;
+	double            ratio, mb;
+	int               prot, private_anon;
+	int               ret = CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+	if (get_range(args, &range, &nextarg) == CMD_ERROR)
+		return CMD_ERROR;
+
+	for (arg = strtok_r(nextarg, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (strncmp(arg, "pattern=", 8)) {
+			fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+		pattern = arg + 8;
+	}
+	if (swap_pattern(pattern, &ratio) != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	if (!segment_extent(segname, &extent) ||
+	    !segment_extent_range(&extent, &range, segname))
+		return CMD_ERROR;
+	if (extent.se_pagesize != pagesize) {
+		fprintf(stderr, "%s:  huge page segment %s can't be paged "
+			"out\n", gcp->program_name, segname);
+		return CMD_ERROR;
+	}
+	if (!segment_prot(segname, &prot, &private_anon))
+		return CMD_ERROR;
+	if (!private_anon ||
+	    (prot & (PROT_READ|PROT_WRITE)) != (PROT_READ|PROT_WRITE)) {
+		fprintf(stderr, "%s:  swapbench fills only private anon "
+			"segments mapped read/write\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+	start    = (char *)extent.se_start;
+	nr_pages = extent.se_length / pagesize;
+
+	lat     = calloc(nr_pages, sizeof(*lat));
+	scratch = malloc(pagesize);
+	if (!lat || !scratch) {
+		fprintf(stderr, "%s:  can't allocate %lu page latencies\n",
+			gcp->program_name, nr_pages);
+		goto out_free;
+	}
+
+	/*
+	 * fill -- each page different, so none are shared or same-filled
+	 * unless the pattern is "zero"
+	 */
+	gettimeofday(&t_start, NULL);
+	for (i = 0; i < nr_pages && !signalled(gcp); ++i)
+		fill_page(start + i * pagesize, pagesize, ratio, i + 1);
+	gettimeofday(&t_end, NULL);
+	fill_usecs = tv_diff_usec(&t_start, &t_end);
+	if (signalled(gcp))
+		goto out_intr;
+
+	swap_stats_read(&ss_before);
+	nr_before = resident_pages(start, nr_pages, pagesize);
+	if (nr_before < 0)
+		goto out_free;
+
+	gettimeofday(&t_start, NULL);
+	if (madvise(start, nr_pages * pagesize, MADV_PAGEOUT) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  madvise(MADV_PAGEOUT) failed - %s\n",
+			gcp->program_name, strerror(err));
+		if (err == EINVAL)
+			fprintf(stderr, "\tNote:  needs Linux 5.4 or later\n");
+		goto out_free;
+	}
+	gettimeofday(&t_end, NULL);
+	out_usecs = tv_diff_usec(&t_start, &t_end);
+
+	nr_out    = swapped_pages(start, nr_pages, pagesize);
+	nr_cached = resident_pages(start, nr_pages, pagesize);
+	if (nr_out < 0 || nr_cached < 0)
+		goto out_free;
+
+	/*
+	 * fault each page back in, timing each
+	 */
+	gettimeofday(&t_start, NULL);
+	for (i = 0; i < nr_pages && !signalled(gcp); ++i) {
+		volatile char *pp = start + i * pagesize;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		(void)*pp;
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		lat[i] = ts_diff_nsec(&ts_start, &ts_end);
+	}
+	gettimeofday(&t_end, NULL);
+	in_usecs = tv_diff_usec(&t_start, &t_end);
+	if (signalled(gcp))
+		goto out_intr;
+	swap_stats_read(&ss_after);
+
+	for (i = 0; i < nr_pages; ++i) {
+		fill_page(scratch, pagesize, ratio, i + 1);
+		if (memcmp(scratch, start + i * pagesize, pagesize))
+			++nr_bad;
+	}
+
+	result_record("swapin", in_usecs, nr_pages, pagesize,
+			nr_pages - nr_out);
+
+	ret = CMD_SUCCESS;
+	if (is_option(QUIET))
+		goto out_free;
+
+	qsort(lat, nr_pages, sizeof(*lat), ulong_cmp);
+	mb = (double)nr_pages * pagesize / 1000000.0;
+	printf("%s:  swapbench %s - %lu %ldk pages, pattern %s\n",
+		gcp->program_name, segname, nr_pages, pagesize / 1024, pattern);
+	printf("    fill:     %8.3f secs\n", (double)fill_usecs / 1000000.0);
+	printf("    pageout:  %8.3f secs, %ld of %ld resident pages out, "
+		"%.1f MB/s\n", (double)out_usecs / 1000000.0,
+		nr_out, nr_before, (double)nr_out * pagesize / 1000000.0 /
+		((double)(out_usecs ? out_usecs : 1) / 1000000.0));
+	if (nr_out && nr_cached)
+		printf("              %ld still in the swap cache -- minor "
+			"faults to swap in\n", nr_cached);
+	printf("    swapin:   %8.3f secs, %.1f MB/s\n",
+		(double)in_usecs / 1000000.0,
+		mb / ((double)(in_usecs ? in_usecs : 1) / 1000000.0));
+	printf("    per page [usecs]:  p50 %.2f  p90 %.2f  p99 %.2f  "
+		"p99.9 %.2f  max %.2f\n",
+		percentile(lat, nr_pages, 50) / 1000.0,
+		percentile(lat, nr_pages, 90) / 1000.0,
+		percentile(lat, nr_pages, 99) / 1000.0,
+		lat[((nr_pages - 1) * 999 + 500) / 1000] / 1000.0,
+		lat[nr_pages - 1] / 1000.0);
+	swap_stats_show(&ss_before, &ss_after);
+	if (!nr_out)
+		printf("    Note:  no pages paged out -- no swap space?\n");
+	if (nr_bad)
+		printf("    %lu pages changed across swap!\n", nr_bad);
+	goto out_free;
+
+out_intr:
+	reset_signal();		/* like touch, not an error */
+	if (!is_option(QUIET))
+		printf("%s:  swapbench %s interrupted\n", gcp->program_name,
+			segname);
+	ret = CMD_SUCCESS;
+out_free:
+	free(scratch);
+	free(lat);
+	return ret;
+}
+
+/*
+ * =========================================================================
+ * ksm:  KSM merging of a segment, and what it costs to undo
+ */
+#define KSM_SYSFS "/sys/kernel/mm/ksm"
+#define KSM_POLL  20000		/* usecs between counter reads */
+#define KSM_WAIT  60		/* default 'wait' timeout [secs] */
+
+static char *ksm_names[] = {
+	"full_scans", "pages_shared", "pages_sharing", "pages_unshared",
+	"pages_volatile", NULL
+};
+#define KSM_FULL_SCANS    0
+#define KSM_PAGES_SHARING 2
+
+static int
+ksm_read(unsigned long *values)
+{
+	glctx_t *gcp = &glctx;
+	char     path[PATH_MAX];
+	bool     ok;
+	int      i;
+
+	for (i = 0; ksm_names[i]; ++i) {
+		snprintf(path, sizeof(path), KSM_SYSFS "/%s", ksm_names[i]);
+		values[i] = read_ulong(path, &ok);
+		if (!ok) {
+			fprintf(stderr, "%s:  can't read %s\n",
+				gcp->program_name, path);
+			return CMD_ERROR;
+		}
+	}
+	return CMD_SUCCESS;
+}
+
+static unsigned long
+ksm_setting(char *name)
+{
+	char path[PATH_MAX];
+	bool ok;
+
+	snprintf(path, sizeof(path), KSM_SYSFS "/%s", name);
+	return read_ulong(path, &ok);
+}
+
+/*
+ * ksm_merged() - our merged pages or, before Linux 5.19, everyone's
+ */
+static long
+ksm_merged(unsigned long *values)
+{
+	long merged = ksm_merging_pages();
+
+	return merged >= 0 ? merged : values[KSM_PAGES_SHARING];
+}
+
+/*
+ * ksm_fill() - fill a range with unique pages and a 'dup' fraction of
+ * copies of one page, spread evenly.
+ */
+static int
+ksm_fill(char *segname, range_t *range, double dup)
+{
+	glctx_t      *gcp = &glctx;
+	seg_extent_t  extent;
+	unsigned long nr_pages, i;
+
+	if (!segment_extent(segname, &extent) ||
+	    !segment_extent_range(&extent, range, segname))
+		return CMD_ERROR;
+	nr_pages = extent.se_length / extent.se_pagesize;
+
+	for (i = 0; i < nr_pages && !signalled(gcp); ++i) {
+		bool copy = (unsigned long)((i + 1) * dup) !=
+			    (unsigned long)(i * dup);
+
+		fill_page((char *)extent.se_start + i * extent.se_pagesize,
+			extent.se_pagesize, 1.0, copy ? 0 : i + 1);
+	}
+	if (signalled(gcp)) {
+		reset_signal();
+		return CMD_ERROR;
+	}
+	return CMD_SUCCESS;
+}
+
+/*
+ * ksm_wait() - wait for ksmd to stop merging:  until our merged page
+ * count holds across a full scan.
+ */
+static int
+ksm_wait(unsigned long timeout)
+{
+	glctx_t       *gcp = &glctx;
+	unsigned long  before[5], now[5];
+	unsigned long  scan_mark, usecs = 0, changed_usecs = 0;
+	struct timeval t_start, t_now;
+	long           merged, scan_merged;
+	bool           converged = false;
+	int            i;
+
+	if (ksm_setting("run") != 1) {
+		fprintf(stderr, "%s:  ksmd is not running\n"
+			"\tNote:  echo 1 >" KSM_SYSFS "/run\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	if (ksm_read(before) != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	merged = scan_merged = ksm_merged(before);
+	scan_mark = before[KSM_FULL_SCANS];
+	gettimeofday(&t_start, NULL);
+	while (usecs < timeout * 1000000UL && !signalled(gcp)) {
+		usleep(KSM_POLL);
+		if (ksm_read(now) != CMD_SUCCESS)
+			return CMD_ERROR;
+		gettimeofday(&t_now, NULL);
+		usecs = tv_diff_usec(&t_start, &t_now);
+
+		if (ksm_merged(now) != merged) {
+			merged = ksm_merged(now);
+			changed_usecs = usecs;
+		}
+		if (now[KSM_FULL_SCANS] == scan_mark)
+			continue;
+
+		/*
+		 * a full scan ended.  The first may have started before
+		 * we looked, and a page must hold still for a scan before
+		 * it's merged in the next.
+		 */
+		if (now[KSM_FULL_SCANS] >= before[KSM_FULL_SCANS] + 3 &&
+		    merged == scan_merged) {
+			converged = true;
+			break;
+		}
+		scan_mark   = now[KSM_FULL_SCANS];
+		scan_merged = merged;
+	}
+	if (signalled(gcp)) {
+		reset_signal();
+		return CMD_ERROR;
+	}
+
+	result_record("ksm_wait", changed_usecs, merged, gcp->pagesize,
+			0);
+	if (!converged)
+		fprintf(stderr, "%s:  KSM didn't converge in %lu secs\n",
+			gcp->program_name, timeout);
+	if (is_option(QUIET))
+		return converged ? CMD_SUCCESS : CMD_ERROR;
+
+	printf("%s:  ksm %s in %6.3f secs, %lu full scans "
+		"[pages_to_scan %lu, sleep %lu msecs]\n", gcp->program_name,
+		converged ? "converged" : "still merging",
+		(double)usecs / 1000000.0,
+		now[KSM_FULL_SCANS] - before[KSM_FULL_SCANS],
+		ksm_setting("pages_to_scan"), ksm_setting("sleep_millisecs"));
+	printf("    merged:  %ld %spages, the last at %6.3f secs\n", merged,
+		ksm_merging_pages() < 0 ? "[system] " : "",
+		(double)changed_usecs / 1000000.0);
+	printf("   ");
+	for (i = 1; ksm_names[i]; ++i)
+		printf(" %s %+ld", ksm_names[i], (long)(now[i] - before[i]));
+	printf("\n    merge_across_nodes %lu\n",
+		ksm_setting("merge_across_nodes"));
+
+	return converged ? CMD_SUCCESS : CMD_ERROR;
+}
+
+/*
+ * command:  ksm <seg-name> [<offset> <length>] on [dup=<fraction>]
+ *           ksm <seg-name> [<offset> <length>] off
+ *           ksm [<seg-name>] wait [<secs>]
+ */
+static int
+ksm(char *args)
+{
+	glctx_t *gcp = &glctx;
+	char    *segname, *subcmd, *arg, *nextarg, *end;
+	range_t  range = { 0L, 0L };
+	double   dup = -1.0;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	if (!strcmp(segname, "wait")) {
+		subcmd  = segname;
+		segname = NULL;
+	} else {
+		args = nextarg + strspn(nextarg, whitespace);
+		if (get_range(args, &range, &nextarg) == CMD_ERROR)
+			return CMD_ERROR;
+		subcmd = strtok_r(nextarg, whitespace, &nextarg);
+		if (!subcmd) {
+			fprintf(stderr, "%s:  ksm %s needs on|off|wait\n",
+				gcp->program_name, segname);
+			return CMD_ERROR;
+		}
+	}
+	arg = strtok_r(NULL, whitespace, &nextarg);
+
+	if (!strcmp(subcmd, "wait")) {
+		unsigned long timeout = KSM_WAIT;
+
+		if (arg) {
+			timeout = strtoul(arg, &end, 0);
+			if (end == arg || *end != '\0' || !timeout) {
+				fprintf(stderr, "%s:  bad ksm wait time:  %s\n",
+					gcp->program_name, arg);
+				return CMD_ERROR;
+			}
+		}
+		return ksm_wait(timeout);
+	}
+
+	if (!strcmp(subcmd, "off"))
+		return segment_merge(segname, &range, 0) ? CMD_SUCCESS :
+			CMD_ERROR;
+
+	if (strcmp(subcmd, "on")) {
+		fprintf(stderr, "%s:  unrecognized ksm command:  %s\n",
+			gcp->program_name, subcmd);
+		return CMD_ERROR;
+	}
+
+	if (arg) {
+		if (strncmp(arg, "dup=", 4) ||
+		    (dup = strtod(arg + 4, &end), end == arg + 4) ||
+		    *end != '\0' || dup < 0.0 || dup > 1.0) {
+			fprintf(stderr, "%s:  expected dup=<fraction 0..1>, "
+				"not %s\n", gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+	}
+
+	/*
+	 * merge first:  the fill runs to completion before ksmd can see
+	 * the pages anyway.
+	 */
+	if (!segment_merge(segname, &range, 1))
+		return CMD_ERROR;
+	if (dup >= 0.0 && ksm_fill(segname, &range, dup) != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	if (ksm_setting("run") != 1)
+		fprintf(stderr, "%s:  Note:  ksmd is not running -- echo 1 >"
+			KSM_SYSFS "/run\n", gcp->program_name);
+	return CMD_SUCCESS;
+}
+
+/*
+ * =========================================================================
+ * forkbench:  what fork() and copy-on-write cost with a populated segment
+ */
+#ifndef MADV_WIPEONFORK
+#define MADV_WIPEONFORK 18
+#define MADV_KEEPONFORK 19
+#endif
+
+/*
+ * what the forked child reports through its pipe
+ */
+struct fork_cow {
+	double        fc_start_ns;	/* CLOCK_MONOTONIC at child start */
+	double        fc_end_ns;	/*   "    "    "  after its writes */
+	unsigned long fc_nr;		/* pages written */
+	unsigned long fc_ns;		/* total */
+	unsigned long fc_pct[4];	/* p50, p90, p99, max [nsecs] */
+};
+
+static double
+ts_nsec(struct timespec *tsp)
+{
+	return tsp->tv_sec * 1e9 + tsp->tv_nsec;
+}
+
+/*
+ * fork_child_write() - in the child:  write 'fraction' of the pages,
+ * spread evenly, timing each; report to 'fd' and exit.
+ */
+static void
+fork_child_write(int fd, char *start, unsigned long nr_pages,
+		size_t pagesize, double fraction)
+{
+	struct fork_cow fc;
+	struct timespec ts_start, ts_end;
+	unsigned long  *lat, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	memset(&fc, 0, sizeof(fc));
+	fc.fc_start_ns = ts_nsec(&ts_start);
+
+	lat = calloc(nr_pages ? nr_pages : 1, sizeof(*lat));
+	for (i = 0; lat && i < nr_pages; ++i) {
+		volatile char *pp = start + i * pagesize;
+
+		if ((unsigned long)((i + 1) * fraction) ==
+		    (unsigned long)(i * fraction))
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		*pp = 1;
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		lat[fc.fc_nr] = ts_diff_nsec(&ts_start, &ts_end);
+		fc.fc_ns += lat[fc.fc_nr++];
+	}
+	if (fc.fc_nr) {
+		qsort(lat, fc.fc_nr, sizeof(*lat), ulong_cmp);
+		fc.fc_pct[0] = percentile(lat, fc.fc_nr, 50);
+		fc.fc_pct[1] = percentile(lat, fc.fc_nr, 90);
+		fc.fc_pct[2] = percentile(lat, fc.fc_nr, 99);
+		fc.fc_pct[3] = lat[fc.fc_nr - 1];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	fc.fc_end_ns = ts_nsec(&ts_end);
+	if (write(fd, &fc, sizeof(fc)) != sizeof(fc))
+		_exit(1);
+	_exit(0);
+}
+
+/*
+ * fork_timed() - fork a child that runs fork_child_write() [or just
+ * exits, for 'fraction' < 0]; time the fork in the parent and the
+ * child's exit and reaping.  Waits for only its own child:  the child
+ * event loop reaps only memtoy's named children.
+ */
+static int
+fork_timed(char *start, unsigned long nr_pages, size_t pagesize,
+		double fraction, double *fork_nsp, double *exit_nsp,
+		struct fork_cow *fcp)
+{
+	glctx_t        *gcp = &glctx;
+	struct timespec ts_start, ts_forked, ts_end;
+	int             pipefd[2], status;
+	ssize_t         len;
+	pid_t           pid;
+
+	if (pipe(pipefd) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  pipe() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return CMD_ERROR;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	pid = fork();
+	if (pid == 0) {
+		close(pipefd[0]);
+		if (fraction < 0.0)
+			_exit(0);
+		fork_child_write(pipefd[1], start, nr_pages, pagesize,
+				fraction);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_forked);
+	close(pipefd[1]);
+	if (pid < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  fork() failed - %s\n",
+			gcp->program_name, strerror(err));
+		close(pipefd[0]);
+		return CMD_ERROR;
+	}
+
+	memset(fcp, 0, sizeof(*fcp));
+	len = read(pipefd[0], fcp, sizeof(*fcp));
+	close(pipefd[0]);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  waitpid(%d) failed - %s\n",
+			gcp->program_name, pid, strerror(err));
+		return CMD_ERROR;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) ||
+	    (fraction >= 0.0 && len != sizeof(*fcp))) {
+		fprintf(stderr, "%s:  forkbench child failed", gcp->program_name);
+		if (WIFSIGNALED(status))
+			fprintf(stderr, " - %s", sig_name(WTERMSIG(status)));
+		fprintf(stderr, "\n");
+		return CMD_ERROR;
+	}
+
+	*fork_nsp = ts_diff_nsec(&ts_start, &ts_forked);
+	*exit_nsp = fcp->fc_end_ns ? ts_nsec(&ts_end) - fcp->fc_end_ns : 0.0;
+	if (fcp->fc_start_ns)
+		fcp->fc_start_ns -= ts_nsec(&ts_start);
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  forkbench <seg-name> [write=<fraction>] [advice=dontfork|wipeonfork]
+ */
+static int
+forkbench(char *args)
+{
+	glctx_t        *gcp = &glctx;
+	char           *segname, *arg, *nextarg, *end, *start;
+	char           *advice_name = NULL;
+	range_t         range = { 0L, 0L };
+	seg_extent_t    extent;
+	struct timeval  t_start, t_end;
+	struct fork_cow fc, fc_base;
+	unsigned long   nr_pages, populate_usecs;
+	size_t          pagesize, length;
+	double          fraction = 1.0, fork_ns, exit_ns, base_ns, unused_ns;
+	int             advice = 0, undo = 0, ret = CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+
+	for (arg = strtok_r(NULL, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (!strncmp(arg, "write=", 6)) {
+			fraction = strtod(arg + 6, &end);
+			if (end == arg + 6 || *end != '\0' ||
+			    fraction < 0.0 || fraction > 1.0) {
+				fprintf(stderr, "%s:  expected write=<fraction "
+					"0..1>, not %s\n", gcp->program_name,
+					arg);
+				return CMD_ERROR;
+			}
+		} else if (!strcmp(arg, "advice=dontfork")) {
+			advice = MADV_DONTFORK;
+			undo   = MADV_DOFORK;
+			advice_name = arg + 7;
+		} else if (!strcmp(arg, "advice=wipeonfork")) {
+			advice = MADV_WIPEONFORK;
+			undo   = MADV_KEEPONFORK;
+			advice_name = arg + 7;
+		} else {
+			fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+	}
+
+	if (!segment_extent(segname, &extent) ||
+	    !segment_extent_range(&extent, &range, segname))
+		return CMD_ERROR;
+	start    = (char *)extent.se_start;
+	length   = extent.se_length;
+	pagesize = extent.se_pagesize;
+	nr_pages = length / pagesize;
+
+	/*
+	 * populate:  the parent's pages are what the child shares
+	 */
+	gettimeofday(&t_start, NULL);
+	if (touch_memory(true, (unsigned long *)start, length, pagesize))
+		return CMD_ERROR;
+	gettimeofday(&t_end, NULL);
+	populate_usecs = tv_diff_usec(&t_start, &t_end);
+
+	/*
+	 * baseline:  fork with the segment excluded, to separate its page
+	 * table copy from the rest of fork()
+	 */
+	if (madvise(start, length, MADV_DONTFORK) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  madvise(MADV_DONTFORK) failed - %s\n",
+			gcp->program_name, strerror(err));
+		return CMD_ERROR;
+	}
+	ret = fork_timed(start, nr_pages, pagesize, -1.0, &base_ns,
+			&unused_ns, &fc_base);
+	(void)madvise(start, length, MADV_DOFORK);
+	if (ret != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	if (advice && madvise(start, length, advice) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  madvise(%s) failed - %s\n",
+			gcp->program_name, advice_name, strerror(err));
+		return CMD_ERROR;
+	}
+
+	/*
+	 * the DONTFORK child has no segment to write
+	 */
+	ret = fork_timed(start, nr_pages, pagesize,
+			advice == MADV_DONTFORK ? 0.0 : fraction,
+			&fork_ns, &exit_ns, &fc);
+	if (advice)
+		(void)madvise(start, length, undo);
+	if (ret != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	result_record("fork", (unsigned long)(fork_ns / 1000.0), nr_pages,
+			pagesize, 0);
+	if (is_option(QUIET))
+		return CMD_SUCCESS;
+
+	printf("%s:  forkbench %s - %lu %ldk pages, write %g%s%s\n",
+		gcp->program_name, segname, nr_pages, pagesize / 1024,
+		fraction, advice ? ", advice " : "",
+		advice ? advice_name : "");
+	printf("    populate:    %8.3f msecs\n", populate_usecs / 1000.0);
+	printf("    fork:        %8.3f msecs [%.3f without the segment]\n",
+		fork_ns / 1e6, base_ns / 1e6);
+	if (fork_ns > base_ns)
+		printf("    page tables: %8.3f msecs, %.3f usecs per MB\n",
+			(fork_ns - base_ns) / 1e6,
+			(fork_ns - base_ns) / 1e3 /
+				((double)length / (1024 * 1024)));
+	printf("    child ran:   %8.3f msecs after fork() was called\n",
+		fc.fc_start_ns / 1e6);
+	if (fc.fc_nr) {
+		printf("    %s:  %8.3f msecs for %lu pages\n",
+			advice == MADV_WIPEONFORK ? "zero fill" : "cow writes",
+			fc.fc_ns / 1e6, fc.fc_nr);
+		printf("    per page [usecs]:  p50 %.2f  p90 %.2f  p99 %.2f  "
+			"max %.2f\n", fc.fc_pct[0] / 1000.0,
+			fc.fc_pct[1] / 1000.0, fc.fc_pct[2] / 1000.0,
+			fc.fc_pct[3] / 1000.0);
+	}
+	printf("    exit+reap:   %8.3f msecs\n", exit_ns / 1e6);
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * =========================================================================
+ * faultscale:  concurrent first touch faults vs number of threads
+ */
+#define FAULT_SHARED      0	/* layouts */
+#define FAULT_PER_THREAD  1
+#define FAULT_INTERLEAVED 2
+
+static char *fault_layouts[] = {
+	"shared-vma", "per-thread-vma", "interleaved-pages", NULL
+};
+
+struct fault_work {
+	char          *fw_start;
+	unsigned long  fw_nr_pages;
+	size_t         fw_stride;	/* bytes from one page to the next */
+};
+
+static int
+fault_worker(worker_t *wp)
+{
+	struct fault_work *fwp = wp->w_arg;
+	unsigned long      i;
+
+	for (i = 0; i < fwp->fw_nr_pages; ++i)
+		*(volatile char *)(fwp->fw_start + i * fwp->fw_stride) = 1;
+	return 0;
+}
+
+/*
+ * fault_map() - fresh anon memory, not yet touched and without THP, so
+ * each page touched is a fault.  'guard' adds a PROT_NONE page at the
+ * end so neighboring mappings can't merge into one vma.
+ */
+static char *
+fault_map(size_t length, bool guard)
+{
+	glctx_t *gcp = &glctx;
+	size_t   maplen = length + (guard ? gcp->pagesize : 0);
+	char    *addr;
+
+	addr = mmap(NULL, maplen, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "%s:  mmap() of %lu bytes failed - %s\n",
+			gcp->program_name, maplen, strerror(err));
+		return NULL;
+	}
+	(void)madvise(addr, length, MADV_NOHUGEPAGE);
+	if (guard)
+		(void)mprotect(addr + length, gcp->pagesize, PROT_NONE);
+	return addr;
+}
+
+/*
+ * fault_run() - map 'nr_pages' for 'nr_threads' per the layout, fault
+ * them in concurrently, unmap.  Returns usecs, -1 on error.
+ */
+static long
+fault_run(unsigned long nr_pages, int nr_threads, int layout,
+		long *faultsp)
+{
+	glctx_t           *gcp = &glctx;
+	size_t             pagesize = gcp->pagesize;
+	worker_t          *workers;
+	struct fault_work *work;
+	struct rusage      ru_start, ru_end;
+	unsigned long      per_thread = nr_pages / nr_threads, first = 0;
+	char              *base = NULL;
+	long               usecs = -1;
+	int                i, nr_mapped = 0;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	work    = calloc(nr_threads, sizeof(*work));
+	if (!workers || !work) {
+		fprintf(stderr, "%s:  can't allocate %d workers\n",
+			gcp->program_name, nr_threads);
+		goto out_free;
+	}
+
+	if (layout != FAULT_PER_THREAD &&
+	    !(base = fault_map(nr_pages * pagesize, false)))
+		goto out_free;
+
+	for (i = 0; i < nr_threads; ++i) {
+		struct fault_work *fwp = &work[i];
+
+		/*
+		 * first nr_pages % nr_threads threads get an extra page
+		 */
+		fwp->fw_nr_pages = per_thread + (i < nr_pages % nr_threads);
+		fwp->fw_stride   = pagesize;
+		switch (layout) {
+		case FAULT_SHARED:
+			fwp->fw_start = base + first * pagesize;
+			break;
+		case FAULT_PER_THREAD:
+			fwp->fw_start = fault_map(fwp->fw_nr_pages * pagesize,
+						true);
+			if (!fwp->fw_start)
+				goto out_unmap;
+			++nr_mapped;
+			break;
+		case FAULT_INTERLEAVED:
+			fwp->fw_start  = base + i * pagesize;
+			fwp->fw_stride = nr_threads * pagesize;
+			break;
+		}
+		first += fwp->fw_nr_pages;
+		workers[i].w_arg = fwp;
+	}
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	usecs = workers_run(workers, nr_threads, fault_worker);
+	getrusage(RUSAGE_SELF, &ru_end);
+	*faultsp = ru_end.ru_minflt - ru_start.ru_minflt;
+
+out_unmap:
+	if (base)
+		munmap(base, nr_pages * pagesize);
+	for (i = 0; i < nr_mapped; ++i)
+		munmap(work[i].fw_start, (work[i].fw_nr_pages + 1) * pagesize);
+out_free:
+	free(work);
+	free(workers);
+	return usecs;
+}
+
+/*
+ * command:  faultscale <size> [threads=[<min>..]<max>] [layout=<layout>]
+ */
+static int
+faultscale(char *args)
+{
+	glctx_t      *gcp = &glctx;
+	char         *arg, *nextarg;
+	size_t        size;
+	unsigned long nr_pages;
+	long          usecs, faults;
+	double        rate, base_rate = 0.0;
+	int           min_threads = 1, max_threads = 0, nr_threads;
+	int           layout = FAULT_SHARED, i;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<size>"))
+		return CMD_ERROR;
+	arg  = strtok_r(args, whitespace, &nextarg);
+	size = get_scaled_value(arg, "size");
+	if (size == BOGUS_SIZE)
+		return CMD_ERROR;
+	nr_pages = size / gcp->pagesize;
+
+	for (arg = strtok_r(NULL, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (!strncmp(arg, "threads=", 8)) {
+			if (get_doubling_range(arg, 8, &min_threads,
+					&max_threads) != CMD_SUCCESS)
+				return CMD_ERROR;
+		} else if (!strncmp(arg, "layout=", 7)) {
+			for (i = 0; fault_layouts[i]; ++i)
+				if (!strcmp(arg + 7, fault_layouts[i]))
+					break;
+			if (!fault_layouts[i]) {
+				fprintf(stderr, "%s:  unrecognized layout:  %s\n",
+					gcp->program_name, arg + 7);
+				return CMD_ERROR;
+			}
+			layout = i;
+		} else {
+			fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+	}
+
+	if (!max_threads)
+		max_threads = nr_cpus_allowed();
+	if (nr_pages < max_threads) {
+		fprintf(stderr, "%s:  %lu pages is too few for %d threads\n",
+			gcp->program_name, nr_pages, max_threads);
+		return CMD_ERROR;
+	}
+
+	if (!is_option(QUIET)) {
+		printf("%s:  faultscale %lu %ldk pages, layout %s\n",
+			gcp->program_name, nr_pages, gcp->pagesize / 1024,
+			fault_layouts[layout]);
+		printf("    %7s %10s %12s %12s %8s %10s\n", "threads", "secs",
+			"faults/sec", "per thread", "scaling", "minflt");
+	}
+
+	/*
+	 * double the thread count each pass, ending at max_threads
+	 */
+	for (nr_threads = min_threads; !signalled(gcp);
+	     nr_threads = doubling_next(nr_threads, max_threads)) {
+		usecs = fault_run(nr_pages, nr_threads, layout, &faults);
+		if (usecs < 0)
+			return CMD_ERROR;
+
+		rate = (double)nr_pages / ((double)(usecs ? usecs : 1) /
+					   1000000.0);
+		if (!base_rate)
+			base_rate = rate / min_threads;
+		result_record("faultscale", usecs, nr_pages, gcp->pagesize, 0);
+
+		if (!is_option(QUIET))
+			printf("    %7d %10.6f %12.0f %12.0f %8.2f %10ld\n",
+				nr_threads, (double)usecs / 1000000.0, rate,
+				rate / nr_threads, rate / base_rate, faults);
+		if (nr_threads == max_threads)
+			break;
+	}
+	if (signalled(gcp)) {
+		reset_signal();
+		return CMD_ERROR;
+	}
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * =========================================================================
+ * shootdown:  what TLB flushing mm changes cost the process's other cpus
+ */
+#define SHOOT_MPROTECT 0	/* ops */
+#define SHOOT_MUNMAP   1
+#define SHOOT_DONTNEED 2
+#define SHOOT_MIGRATE  3
+
+#define SHOOT_MAX_LAT  (1UL << 20)	/* op latencies kept per run */
+
+static char *shoot_ops[] = {
+	"mprotect", "munmap", "madvise-dontneed", "migrate", NULL
+};
+
+struct shoot_run {
+	char          *sr_start;	/* segment, for the readers */
+	unsigned long  sr_nr_pages;
+	char          *sr_op_start;	/* range operated on */
+	size_t         sr_op_len;
+	size_t         sr_pagesize;
+	int            sr_prot;		/* segment's, for mprotect */
+	int            sr_op;		/* -1 => idle, for the baseline */
+	void         **sr_pages;	/* migrate:  op range pages */
+	int           *sr_nodes;	/*   target nodes */
+	int           *sr_status;
+	int            sr_node[2];	/*   alternated between */
+	unsigned long  sr_usecs;	/* run time */
+	volatile int   sr_stop;
+	unsigned long *sr_lat;		/* op latencies [nsecs] */
+	unsigned long  sr_nr_ops;
+	int            sr_err;		/* op errno */
+};
+
+struct shoot_worker {
+	struct shoot_run *sw_run;
+	unsigned long     sw_reads;	/* pages read */
+};
+
+/*
+ * shoot_op() - one timed operation on the op range.  Untimed setup
+ * populates what the op is to tear down.
+ */
+static int
+shoot_op(struct shoot_run *srp, bool odd)
+{
+	struct timespec ts_start, ts_end;
+	unsigned long   nr_pages = srp->sr_op_len / srp->sr_pagesize, i;
+	char           *scratch = NULL;
+	int             ret = 0;
+
+	switch (srp->sr_op) {
+	case SHOOT_MUNMAP:
+		scratch = mmap(NULL, srp->sr_op_len, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (scratch == MAP_FAILED)
+			return errno;
+		for (i = 0; i < nr_pages; ++i)
+			scratch[i * srp->sr_pagesize] = 1;
+		break;
+	case SHOOT_DONTNEED:
+		for (i = 0; i < nr_pages; ++i)
+			srp->sr_op_start[i * srp->sr_pagesize] = 1;
+		break;
+	case SHOOT_MIGRATE:
+		for (i = 0; i < nr_pages; ++i)
+			srp->sr_nodes[i] = srp->sr_node[odd];
+		break;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	switch (srp->sr_op) {
+	case SHOOT_MPROTECT:
+		ret = mprotect(srp->sr_op_start, srp->sr_op_len, odd ?
+				srp->sr_prot : srp->sr_prot & ~PROT_WRITE);
+		break;
+	case SHOOT_MUNMAP:
+		ret = munmap(scratch, srp->sr_op_len);
+		break;
+	case SHOOT_DONTNEED:
+		ret = madvise(srp->sr_op_start, srp->sr_op_len,
+				MADV_DONTNEED);
+		break;
+	case SHOOT_MIGRATE:
+		ret = move_pages(0, nr_pages, srp->sr_pages, srp->sr_nodes,
+				srp->sr_status, MPOL_MF_MOVE) < 0 ? -1 : 0;
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	if (ret < 0)
+		return errno;
+
+	if (srp->sr_nr_ops < SHOOT_MAX_LAT)
+		srp->sr_lat[srp->sr_nr_ops] = ts_diff_nsec(&ts_start, &ts_end);
+	++srp->sr_nr_ops;
+	return 0;
+}
+
+/*
+ * shoot_worker() - worker 0 issues ops [or idles] for the run's time,
+ * then stops the others:  they read a word of each page of the
+ * segment, over and over.
+ */
+static int
+shoot_worker(worker_t *wp)
+{
+	struct shoot_worker *swp = wp->w_arg;
+	struct shoot_run    *srp = swp->sw_run;
+	struct timeval       t_start, t_now;
+	unsigned long        i, sink = 0;
+
+	if (wp->w_id == 0) {
+		gettimeofday(&t_start, NULL);
+		do {
+			if (srp->sr_op < 0)
+				usleep(1000);
+			else if ((srp->sr_err = shoot_op(srp,
+						srp->sr_nr_ops & 1)))
+				break;
+			gettimeofday(&t_now, NULL);
+		} while (tv_diff_usec(&t_start, &t_now) < srp->sr_usecs);
+
+		/*
+		 * leave the op range with the segment's protection
+		 */
+		if (srp->sr_op == SHOOT_MPROTECT && (srp->sr_nr_ops & 1))
+			(void)shoot_op(srp, true);
+		srp->sr_stop = 1;
+		return 0;
+	}
+
+	while (!srp->sr_stop) {
+		for (i = 0; i < srp->sr_nr_pages && !srp->sr_stop; ++i)
+			sink += *(volatile unsigned long *)(srp->sr_start +
+						i * srp->sr_pagesize);
+		swp->sw_reads += i;
+	}
+	return sink == 1;	/* keep the reads */
+}
+
+/*
+ * shoot_run() - one run with 'nr_readers' readers; returns the readers'
+ * pages read per second per reader, or -1.0.
+ */
+static double
+shoot_run(struct shoot_run *srp, int nr_readers)
+{
+	glctx_t             *gcp = &glctx;
+	worker_t            *workers;
+	struct shoot_worker *sw;
+	unsigned long        reads = 0, usecs = 0;
+	int                  i;
+
+	workers = calloc(nr_readers + 1, sizeof(*workers));
+	sw      = calloc(nr_readers + 1, sizeof(*sw));
+	if (!workers || !sw) {
+		fprintf(stderr, "%s:  can't allocate %d workers\n",
+			gcp->program_name, nr_readers + 1);
+		free(workers);
+		free(sw);
+		return -1.0;
+	}
+	for (i = 0; i <= nr_readers; ++i) {
+		sw[i].sw_run     = srp;
+		workers[i].w_arg = &sw[i];
+	}
+	srp->sr_stop   = 0;
+	srp->sr_nr_ops = 0;
+	srp->sr_err    = 0;
+
+	if (workers_run(workers, nr_readers + 1, shoot_worker) < 0) {
+		free(workers);
+		free(sw);
+		return -1.0;
+	}
+	for (i = 1; i <= nr_readers; ++i) {
+		reads += sw[i].sw_reads;
+		usecs += workers[i].w_usecs;
+	}
+	free(workers);
+	free(sw);
+
+	if (srp->sr_err) {
+		fprintf(stderr, "%s:  %s failed - %s\n", gcp->program_name,
+			shoot_ops[srp->sr_op], strerror(srp->sr_err));
+		return -1.0;
+	}
+	return usecs ? (double)reads / ((double)usecs / 1000000.0) : 0.0;
+}
+
+/*
+ * shoot_nodes() - the first two nodes we may allocate on
+ */
+static int
+shoot_nodes(int *node)
+{
+	glctx_t *gcp = &glctx;
+	int      n, nr = 0;
+
+	refresh_mems_allowed(gcp);
+	for (n = 0; n <= gcp->numa_max_node && nr < 2; ++n)
+		if (nodemask_isset(gcp->mems_allowed, n))
+			node[nr++] = n;
+	if (nr < 2) {
+		fprintf(stderr, "%s:  op=migrate needs two allowed nodes\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+	return CMD_SUCCESS;
+}
+
+/*
+ * command:  shootdown <seg-name> [<offset> <length>] [threads=<n>]
+ *               [op=mprotect|munmap|madvise-dontneed|migrate] [secs=<n>]
+ */
+static int
+shootdown(char *args)
+{
+	glctx_t         *gcp = &glctx;
+	char            *segname, *arg, *nextarg, *end;
+	range_t          range = { 0L, 0L };
+	seg_extent_t     extent, op_extent;
+	struct shoot_run sr;
+	unsigned long    i, secs = 1;
+	double           rate, idle_rate;
+	int              max_readers = -1, nr_readers, nr_cpus;
+	int              private_anon;
+	int              ret = CMD_ERROR;
+
+	memset(&sr, 0, sizeof(sr));
+	sr.sr_op = SHOOT_MPROTECT;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+	if (get_range(args, &range, &nextarg) == CMD_ERROR)
+		return CMD_ERROR;
+
+	for (arg = strtok_r(nextarg, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (!strncmp(arg, "threads=", 8)) {
+			max_readers = strtol(arg + 8, &end, 0);
+			if (end == arg + 8 || *end != '\0' || max_readers < 0)
+				goto bad_arg;
+		} else if (!strncmp(arg, "secs=", 5)) {
+			secs = strtoul(arg + 5, &end, 0);
+			if (end == arg + 5 || *end != '\0' || !secs)
+				goto bad_arg;
+		} else if (!strncmp(arg, "op=", 3)) {
+			for (i = 0; shoot_ops[i]; ++i)
+				if (!strcmp(arg + 3, shoot_ops[i]))
+					break;
+			if (!shoot_ops[i])
+				goto bad_arg;
+			sr.sr_op = i;
+		} else
+			goto bad_arg;
+	}
+
+	nr_cpus = nr_cpus_allowed();
+	if (max_readers < 0)
+		max_readers = nr_cpus > 1 ? nr_cpus - 1 : 1;
+	if (sr.sr_op == SHOOT_MIGRATE && shoot_nodes(sr.sr_node) != CMD_SUCCESS)
+		return CMD_ERROR;
+
+	if (!segment_extent(segname, &extent))
+		return CMD_ERROR;
+	if (!segment_prot(segname, &sr.sr_prot, &private_anon))
+		return CMD_ERROR;
+	if (!private_anon ||
+	    (sr.sr_prot & (PROT_READ|PROT_WRITE)) != (PROT_READ|PROT_WRITE)) {
+		fprintf(stderr, "%s:  shootdown writes only private anon "
+			"segments mapped read/write\n", gcp->program_name);
+		return CMD_ERROR;
+	}
+	op_extent = extent;
+	if (!segment_extent_range(&op_extent, &range, segname))
+		return CMD_ERROR;
+
+	sr.sr_start     = (char *)extent.se_start;
+	sr.sr_pagesize  = extent.se_pagesize;
+	sr.sr_nr_pages  = extent.se_length / extent.se_pagesize;
+	sr.sr_op_start  = (char *)op_extent.se_start;
+	sr.sr_op_len    = op_extent.se_length;
+	sr.sr_usecs     = secs * 1000000UL;
+
+	sr.sr_lat = calloc(SHOOT_MAX_LAT, sizeof(*sr.sr_lat));
+	if (sr.sr_op == SHOOT_MIGRATE) {
+		unsigned long nr_pages = sr.sr_op_len / sr.sr_pagesize;
+
+		sr.sr_pages  = calloc(nr_pages, sizeof(*sr.sr_pages));
+		sr.sr_nodes  = calloc(nr_pages, sizeof(*sr.sr_nodes));
+		sr.sr_status = calloc(nr_pages, sizeof(*sr.sr_status));
+		if (!sr.sr_pages || !sr.sr_nodes || !sr.sr_status)
+			sr.sr_lat = (free(sr.sr_lat), NULL);
+		else for (i = 0; i < nr_pages; ++i)
+			sr.sr_pages[i] = sr.sr_op_start + i * sr.sr_pagesize;
+	}
+	if (!sr.sr_lat) {
+		fprintf(stderr, "%s:  can't allocate op latencies\n",
+			gcp->program_name);
+		goto out_free;
+	}
+
+	/*
+	 * populate:  readers should hit in the TLB, not fault
+	 */
+	if (touch_memory(true, (unsigned long *)sr.sr_start,
+			extent.se_length, sr.sr_pagesize))
+		goto out_free;
+
+	if (!is_option(QUIET)) {
+		printf("%s:  shootdown %s - %s of %lu %ldk pages, %lu secs "
+			"per run\n", gcp->program_name, segname,
+			shoot_ops[sr.sr_op], sr.sr_op_len / sr.sr_pagesize,
+			sr.sr_pagesize / 1024, secs);
+		if (max_readers >= nr_cpus)
+			printf("    Note:  %d cpus for %d threads -- some "
+				"share a cpu\n", nr_cpus, max_readers + 1);
+		printf("    %4s %9s %10s %10s %16s %16s %6s\n", "cpus", "ops",
+			"p50 usecs", "p99 usecs", "reads/sec/cpu", "[no ops]",
+			"drop");
+	}
+
+	/*
+	 * the op issuer is worker 0, on the first cpu.  Double the readers
+	 * on the other cpus each pass.
+	 */
+	for (nr_readers = 0; !signalled(gcp);
+	     nr_readers = doubling_next(nr_readers, max_readers)) {
+		int op = sr.sr_op;
+
+		idle_rate = 0.0;
+		if (nr_readers) {
+			sr.sr_op  = -1;
+			idle_rate = shoot_run(&sr, nr_readers);
+			sr.sr_op  = op;
+			if (idle_rate < 0.0)
+				goto out_free;
+		}
+		rate = shoot_run(&sr, nr_readers);
+		if (rate < 0.0)
+			goto out_free;
+
+		result_record(shoot_ops[op], sr.sr_usecs, sr.sr_nr_ops, 0, 0);
+		if (!is_option(QUIET)) {
+			unsigned long nr_lat = sr.sr_nr_ops < SHOOT_MAX_LAT ?
+					sr.sr_nr_ops : SHOOT_MAX_LAT;
+
+			qsort(sr.sr_lat, nr_lat, sizeof(*sr.sr_lat), ulong_cmp);
+			printf("    %4d %9lu %10.2f %10.2f", nr_readers + 1,
+				sr.sr_nr_ops,
+				nr_lat ? percentile(sr.sr_lat, nr_lat, 50) /
+					1000.0 : 0.0,
+				nr_lat ? percentile(sr.sr_lat, nr_lat, 99) /
+					1000.0 : 0.0);
+			if (nr_readers)
+				printf(" %16.0f %16.0f %5.1f%%", rate, idle_rate,
+					idle_rate > 0.0 ?
+					100.0 * (idle_rate - rate) / idle_rate :
+					0.0);
+			printf("\n");
+		}
+		if (nr_readers >= max_readers)
+			break;
+	}
+	if (signalled(gcp))
+		reset_signal();
+	else
+		ret = CMD_SUCCESS;
+
+out_free:
+	free(sr.sr_status);
+	free(sr.sr_nodes);
+	free(sr.sr_pages);
+	free(sr.sr_lat);
+	return ret;
+
+bad_arg:
+	fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+		gcp->program_name, arg);
+	return CMD_ERROR;
+}
+
+/*
+ * =========================================================================
+ * split:  fragment a segment into vmas, and what it costs
+ */
+#define SPLIT_MPROTECT 0
+#define SPLIT_MBIND    1
+
+/*
+ * vma_count() - how many vmas of /proc/self/maps overlap [start, end)
+ */
+static int
+vma_count(unsigned long start, unsigned long end)
+{
+	glctx_t      *gcp = &glctx;
+	FILE         *fp;
+	char          line[PATH_MAX + 128];
+	unsigned long vm_start, vm_end;
+	int           nr_vmas = 0;
+
+	fp = fopen("/proc/self/maps", "r");
+	if (!fp) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't open /proc/self/maps - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "%lx-%lx", &vm_start, &vm_end) == 2 &&
+		    vm_start < end && vm_end > start)
+			++nr_vmas;
+	fclose(fp);
+	return nr_vmas;
+}
+
+/*
+ * split_pieces() - apply 'by' to every other one of 'nr_pieces' page
+ * aligned pieces of the extent:  toggling PROT_EXEC in the segment's
+ * protection, 'prot', splits vmas without changing the mempolicy or
+ * read/write access; a preferred node policy splits them without
+ * changing where pages go, on one node.
+ */
+static int
+split_pieces(seg_extent_t *extent, int nr_pieces, int by, int node, int prot)
+{
+	glctx_t      *gcp = &glctx;
+	unsigned long nr_pages = extent->se_length / extent->se_pagesize;
+	unsigned long nodebits = 1UL << node, first, next;
+	int           i;
+
+	prot ^= PROT_EXEC;
+
+	for (i = 1; i < nr_pieces; i += 2) {
+		char  *start;
+		size_t length;
+		int    ret;
+
+		first  = nr_pages * i / nr_pieces;
+		next   = nr_pages * (i + 1) / nr_pieces;
+		start  = (char *)extent->se_start + first * extent->se_pagesize;
+		length = (next - first) * extent->se_pagesize;
+
+		if (by == SPLIT_MPROTECT)
+			ret = mprotect(start, length, prot);
+		else
+			ret = mbind(start, length, MPOL_PREFERRED, &nodebits,
+				sizeof(nodebits) * 8, 0);
+		if (ret < 0) {
+			int err = errno;
+			fprintf(stderr, "%s:  %s of piece %d failed - %s\n",
+				gcp->program_name, by == SPLIT_MPROTECT ?
+				"mprotect" : "mbind", i, strerror(err));
+			return CMD_ERROR;
+		}
+	}
+	return CMD_SUCCESS;
+}
+
+/*
+ * split_where() - time a move_pages() query of the extent's nodes
+ */
+static long
+split_where(seg_extent_t *extent)
+{
+	glctx_t       *gcp = &glctx;
+	unsigned long  nr_pages = extent->se_length / extent->se_pagesize, i;
+	struct timeval t_start, t_end;
+	void         **pages;
+	int           *status;
+	long           usecs = -1;
+
+	pages  = calloc(nr_pages, sizeof(*pages));
+	status = calloc(nr_pages, sizeof(*status));
+	if (!pages || !status) {
+		fprintf(stderr, "%s:  can't allocate %lu page addresses\n",
+			gcp->program_name, nr_pages);
+		goto out_free;
+	}
+	for (i = 0; i < nr_pages; ++i)
+		pages[i] = (char *)extent->se_start + i * extent->se_pagesize;
+
+	gettimeofday(&t_start, NULL);
+	if (move_pages(0, nr_pages, pages, NULL, status, 0) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  move_pages() query failed - %s\n",
+			gcp->program_name, strerror(err));
+		goto out_free;
+	}
+	gettimeofday(&t_end, NULL);
+	usecs = tv_diff_usec(&t_start, &t_end);
+
+out_free:
+	free(status);
+	free(pages);
+	return usecs;
+}
+
+/*
+ * command:  split <seg-name> pieces=[<min>..]<max> [by=mprotect|mbind]
+ */
+static int
+split(char *args)
+{
+	glctx_t       *gcp = &glctx;
+	char          *segname, *arg, *nextarg;
+	seg_extent_t   extent;
+	struct timeval t_start, t_end;
+	unsigned long  nr_pages, split_usecs, touch_usecs, unmap_usecs;
+	long           where_usecs;
+	int            min_pieces = 1, max_pieces = 0, nr_pieces, nr_vmas;
+	int            by = SPLIT_MPROTECT, node = 0;
+	int            prot, private_anon;
+	int            ret = CMD_ERROR;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+
+	for (arg = strtok_r(NULL, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (!strncmp(arg, "pieces=", 7)) {
+			if (get_doubling_range(arg, 7, &min_pieces,
+					&max_pieces) != CMD_SUCCESS)
+				return CMD_ERROR;
+		} else if (!strcmp(arg, "by=mprotect"))
+			by = SPLIT_MPROTECT;
+		else if (!strcmp(arg, "by=mbind"))
+			by = SPLIT_MBIND;
+		else {
+			fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+				gcp->program_name, arg);
+			return CMD_ERROR;
+		}
+	}
+	if (!max_pieces) {
+		fprintf(stderr, "%s:  split needs pieces=[<min>..]<max>\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	if (!segment_extent(segname, &extent) ||
+	    !segment_prot(segname, &prot, &private_anon))
+		return CMD_ERROR;
+	nr_pages = extent.se_length / extent.se_pagesize;
+	if (max_pieces > nr_pages) {
+		fprintf(stderr, "%s:  segment %s has only %lu pages\n",
+			gcp->program_name, segname, nr_pages);
+		return CMD_ERROR;
+	}
+	if (by == SPLIT_MBIND) {
+		refresh_mems_allowed(gcp);
+		while (node < gcp->numa_max_node &&
+		       !nodemask_isset(gcp->mems_allowed, node))
+			++node;
+	}
+
+	if (!is_option(QUIET)) {
+		printf("%s:  split %s - %lu %ldk pages, by %s\n",
+			gcp->program_name, segname, nr_pages,
+			extent.se_pagesize / 1024,
+			by == SPLIT_MPROTECT ? "mprotect" : "mbind");
+		printf("    %7s %7s %10s %10s %10s %10s %14s\n", "pieces",
+			"vmas", "split ms", "touch ms", "where ms", "munmap ms",
+			"touch us/page");
+	}
+
+	/*
+	 * each pass splits a freshly mapped segment into twice as many
+	 * pieces, touches it -- faulting it in --, finds it and unmaps it
+	 */
+	for (nr_pieces = min_pieces; !signalled(gcp);
+	     nr_pieces = doubling_next(nr_pieces, max_pieces)) {
+		if (!segment_unmap(segname) ||
+		    !segment_map(segname, NULL, 0) ||
+		    !segment_extent(segname, &extent))
+			goto out_remap;
+
+		gettimeofday(&t_start, NULL);
+		if (split_pieces(&extent, nr_pieces, by, node,
+				prot) != CMD_SUCCESS)
+			goto out_remap;
+		gettimeofday(&t_end, NULL);
+		split_usecs = tv_diff_usec(&t_start, &t_end);
+
+		nr_vmas = vma_count(extent.se_start,
+					extent.se_start + extent.se_length);
+
+		gettimeofday(&t_start, NULL);
+		if (touch_memory(true, (unsigned long *)extent.se_start,
+				extent.se_length, extent.se_pagesize))
+			goto out_remap;
+		gettimeofday(&t_end, NULL);
+		touch_usecs = tv_diff_usec(&t_start, &t_end);
+
+		where_usecs = split_where(&extent);
+		if (where_usecs < 0)
+			goto out_remap;
+
+		gettimeofday(&t_start, NULL);
+		if (!segment_unmap(segname))
+			goto out_remap;
+		gettimeofday(&t_end, NULL);
+		unmap_usecs = tv_diff_usec(&t_start, &t_end);
+
+		result_record("split", touch_usecs, nr_pages,
+				extent.se_pagesize, 0);
+		if (!is_option(QUIET))
+			printf("    %7d %7d %10.3f %10.3f %10.3f %10.3f "
+				"%14.3f\n", nr_pieces, nr_vmas,
+				split_usecs / 1000.0, touch_usecs / 1000.0,
+				where_usecs / 1000.0, unmap_usecs / 1000.0,
+				(double)touch_usecs / nr_pages);
+		if (nr_pieces == max_pieces)
+			break;
+	}
+
+	if (!signalled(gcp))
+		ret = CMD_SUCCESS;
+
+out_remap:
+	/*
+	 * leave the segment mapped, in one piece, with its own protection
+	 * -- however far we got
+	 */
+	if (!segment_unmap(segname) || !segment_map(segname, NULL, 0))
+		ret = CMD_ERROR;
+	if (signalled(gcp))
+		reset_signal();
+	return ret;
+}
+
+/*
+ * =========================================================================
+ * readbench:  reading a file segment through its mapping vs read calls
+ */
+#define READ_MMAP      0	/* modes */
+#define READ_PREAD     1
+#define READ_PREADV    2
+#define READ_READAHEAD 3
+
+#define READ_AHEAD     8	/* readahead() window, in blocks */
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static char *read_modes[] = {
+	"mmap", "pread", "preadv", "readahead", NULL
+};
+
+struct read_work {
+	int           rw_mode;
+	int           rw_fd;
+	char         *rw_start;		/* mapping of the part */
+	off_t         rw_offset;	/* file offset of the part */
+	size_t        rw_length;
+	size_t        rw_bs;
+	char         *rw_buf;		/* read() target */
+	size_t        rw_pagesize;
+	size_t        rw_bytes;		/* read */
+	unsigned long rw_sum;
+};
+
+/*
+ * read_sum() - use each word read, as a reader of the data would
+ */
+static unsigned long
+read_sum(char *p, size_t len)
+{
+	unsigned long *wp = (unsigned long *)p, sum = 0;
+	size_t         i;
+
+	for (i = 0; i < len / sizeof(*wp); ++i)
+		sum += wp[i];
+	return sum;
+}
+
+static int
+read_worker(worker_t *wp)
+{
+	struct read_work *rwp = wp->w_arg;
+	struct iovec      iov[IOV_MAX];
+	size_t            done, len;
+	ssize_t           got;
+	int               i, nr_iov;
+
+	for (done = 0; done < rwp->rw_length; done += len) {
+		off_t offset = rwp->rw_offset + done;
+
+		len = rwp->rw_length - done;
+		if (len > rwp->rw_bs)
+			len = rwp->rw_bs;
+
+		switch (rwp->rw_mode) {
+		case READ_MMAP:
+			rwp->rw_sum += read_sum(rwp->rw_start + done, len);
+			rwp->rw_bytes += len;
+			continue;
+
+		case READ_READAHEAD:
+			/*
+			 * keep the next window on its way
+			 */
+			if (!done && readahead(rwp->rw_fd, offset,
+					READ_AHEAD * rwp->rw_bs) < 0)
+				return errno;
+			if (!((done / rwp->rw_bs) % READ_AHEAD) &&
+			    readahead(rwp->rw_fd, offset + READ_AHEAD *
+					rwp->rw_bs, READ_AHEAD * rwp->rw_bs) < 0)
+				return errno;
+			/* fall through */
+		case READ_PREAD:
+			got = pread(rwp->rw_fd, rwp->rw_buf, len, offset);
+			break;
+
+		case READ_PREADV:
+			/*
+			 * a page per iovec:  a block of more than IOV_MAX
+			 * pages takes more than one preadv()
+			 */
+			if (len > IOV_MAX * rwp->rw_pagesize)
+				len = IOV_MAX * rwp->rw_pagesize;
+			nr_iov = (len + rwp->rw_pagesize - 1) / rwp->rw_pagesize;
+			for (i = 0; i < nr_iov; ++i) {
+				iov[i].iov_base = rwp->rw_buf +
+						i * rwp->rw_pagesize;
+				iov[i].iov_len  = rwp->rw_pagesize;
+			}
+			iov[nr_iov - 1].iov_len = len -
+					(nr_iov - 1) * rwp->rw_pagesize;
+			got = preadv(rwp->rw_fd, iov, nr_iov, offset);
+			break;
+
+		default:
+			return EINVAL;
+		}
+		if (got < 0)
+			return errno;
+		if (got == 0)
+			break;		/* EOF */
+		rwp->rw_sum   += read_sum(rwp->rw_buf, got);
+		rwp->rw_bytes += got;
+		len = got;
+	}
+	return 0;
+}
+
+/*
+ * read_buffer() - a 'bs' read() target, bound to 'node' if >= 0
+ */
+static char *
+read_buffer(size_t bs, int node)
+{
+	glctx_t      *gcp = &glctx;
+	unsigned long nodebits[NUMA_NUM_NODES / (8 * sizeof(long)) + 1];
+	char         *buf;
+
+	buf = mmap(NULL, bs, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't map a %lu byte buffer - %s\n",
+			gcp->program_name, bs, strerror(err));
+		return NULL;
+	}
+	if (node >= 0) {
+		memset(nodebits, 0, sizeof(nodebits));
+		nodebits[node / (8 * sizeof(long))] |=
+			1UL << (node % (8 * sizeof(long)));
+		if (mbind(buf, bs, MPOL_BIND, nodebits, NUMA_NUM_NODES,
+				0) < 0) {
+			int err = errno;
+			fprintf(stderr, "%s:  can't bind buffer to node %d - "
+				"%s\n", gcp->program_name, node, strerror(err));
+			munmap(buf, bs);
+			return NULL;
+		}
+	}
+	memset(buf, 0, bs);	/* fault it in, where it belongs */
+	return buf;
+}
+
+/*
+ * read_cache() - set up the page cache for a run:  drop the range's
+ * pages, for cold, or read them in, for warm.  Either way, zap the
+ * mapping's ptes so mmap mode faults as it would on first use.
+ * Returns the number of pages cached, or -1.
+ */
+static long
+read_cache(seg_extent_t *extent, int fd, off_t offset, bool warm,
+		char *buf, size_t bs)
+{
+	glctx_t *gcp = &glctx;
+	size_t   done;
+	ssize_t  got;
+
+	if (madvise((void *)extent->se_start, extent->se_length,
+			MADV_DONTNEED) < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  madvise(MADV_DONTNEED) failed - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+
+	if (warm) {
+		for (done = 0; done < extent->se_length; done += got) {
+			got = pread(fd, buf, bs, offset + done);
+			if (got <= 0)
+				break;
+		}
+	} else {
+		(void)fdatasync(fd);
+		(void)posix_fadvise(fd, offset, extent->se_length,
+				POSIX_FADV_DONTNEED);
+	}
+	return resident_pages((char *)extent->se_start,
+			extent->se_length / extent->se_pagesize,
+			extent->se_pagesize);
+}
+
+/*
+ * command:  readbench <seg-name> [<offset> <length>]
+ *               [mode=mmap|pread|preadv|readahead] [bs=<size>]
+ *               [threads=<n>] [cache=cold|warm] [node=<node>]
+ */
+static int
+readbench(char *args)
+{
+	glctx_t          *gcp = &glctx;
+	char             *segname, *arg, *nextarg, *end;
+	range_t           range = { 0L, 0L };
+	seg_extent_t      extent;
+	struct read_work *work = NULL;
+	worker_t         *workers = NULL;
+	struct rusage     ru_start, ru_end;
+	size_t            bs = 64 * 1024, part, bytes = 0;
+	off_t             offset;
+	long              usecs, nr_cached;
+	double            user, sys, gb;
+	int               mode = READ_PREAD, nr_threads = 1, node = -1;
+	int               fd, i, ret = CMD_ERROR;
+	bool              warm = false;
+
+	args += strspn(args, whitespace);
+	if(!required_arg(args, "<seg-name>"))
+		return CMD_ERROR;
+	segname = strtok_r(args, whitespace, &nextarg);
+	args = nextarg + strspn(nextarg, whitespace);
+	if (get_range(args, &range, &nextarg) == CMD_ERROR)
+		return CMD_ERROR;
+
+	for (arg = strtok_r(nextarg, whitespace, &nextarg); arg;
+	     arg = strtok_r(NULL, whitespace, &nextarg)) {
+		if (!strncmp(arg, "mode=", 5)) {
+			for (i = 0; read_modes[i]; ++i)
+				if (!strcmp(arg + 5, read_modes[i]))
+					break;
+			if (!read_modes[i])
+				goto bad_arg;
+			mode = i;
+		} else if (!strncmp(arg, "bs=", 3)) {
+			bs = get_scaled_value(arg + 3, "bs");
+			if (bs == BOGUS_SIZE)
+				return CMD_ERROR;
+			if (!bs || bs % gcp->pagesize) {
+				fprintf(stderr, "%s:  bs must be a multiple of "
+					"the page size\n", gcp->program_name);
+				return CMD_ERROR;
+			}
+		} else if (!strncmp(arg, "threads=", 8)) {
+			nr_threads = strtol(arg + 8, &end, 0);
+			if (end == arg + 8 || *end != '\0' || nr_threads < 1)
+				goto bad_arg;
+		} else if (!strcmp(arg, "cache=cold"))
+			warm = false;
+		else if (!strcmp(arg, "cache=warm"))
+			warm = true;
+		else if (!strncmp(arg, "node=", 5)) {
+			node = strtol(arg + 5, &end, 0);
+			if (end == arg + 5 || *end != '\0' || node < 0 ||
+			    node > gcp->numa_max_node) {
+				fprintf(stderr, "%s:  node must be 0..%d\n",
+					gcp->program_name, gcp->numa_max_node);
+				return CMD_ERROR;
+			}
+		} else
+			goto bad_arg;
+	}
 
-		if (!strncasecmp(args, "none", strlen(args))) {
-			prot = PROT_NONE;
-			break;
-		}
-		if (!strncasecmp(args, "read", strlen(args))) {
-			prot |= PROT_READ;
-			goto next;
-		}
-		if (!strncasecmp(args, "write", strlen(args))) {
-			prot |= PROT_WRITE;
-			goto next;
-		}
-		if (!strncasecmp(args, "exec", strlen(args))) {
-			prot |= PROT_EXEC;
-			goto next;
+	if (!segment_file(segname, &fd, &offset) ||
+	    !segment_extent(segname, &extent))
+		return CMD_ERROR;
+	offset += range.offset & ~(gcp->pagesize - 1);
+	if (!segment_extent_range(&extent, &range, segname))
+		return CMD_ERROR;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	work    = calloc(nr_threads, sizeof(*work));
+	if (!workers || !work) {
+		fprintf(stderr, "%s:  can't allocate %d workers\n",
+			gcp->program_name, nr_threads);
+		goto out_free;
+	}
+
+	/*
+	 * a bs aligned part of the range per thread
+	 */
+	part = (extent.se_length / nr_threads + bs - 1) / bs * bs;
+	for (i = 0; i < nr_threads; ++i) {
+		struct read_work *rwp = &work[i];
+		size_t            first = i * part;
+
+		rwp->rw_mode     = mode;
+		rwp->rw_fd       = fd;
+		rwp->rw_bs       = bs;
+		rwp->rw_pagesize = gcp->pagesize;
+		rwp->rw_start    = (char *)extent.se_start + first;
+		rwp->rw_offset   = offset + first;
+		rwp->rw_length   = first >= extent.se_length ? 0 :
+				   extent.se_length - first < part ?
+				   extent.se_length - first : part;
+		rwp->rw_buf      = read_buffer(bs, node);
+		if (!rwp->rw_buf)
+			goto out_free;
+		workers[i].w_arg = rwp;
+	}
+
+	nr_cached = read_cache(&extent, fd, offset, warm, work[0].rw_buf, bs);
+	if (nr_cached < 0)
+		goto out_free;
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	usecs = workers_run(workers, nr_threads, read_worker);
+	getrusage(RUSAGE_SELF, &ru_end);
+	if (usecs < 0)
+		goto out_free;
+	for (i = 0; i < nr_threads; ++i) {
+		if (workers[i].w_ret) {
+			fprintf(stderr, "%s:  %s failed - %s\n",
+				gcp->program_name, read_modes[mode],
+				strerror(workers[i].w_ret));
+			goto out_free;
 		}
-	next:
-		args = nextarg + strspn(nextarg, whitespace);
+		bytes += work[i].rw_bytes;
 	}
 
-	segment_mprotect(segname, prot);
+	result_record("readbench", usecs, bytes / gcp->pagesize,
+			gcp->pagesize, 0);
+	ret = CMD_SUCCESS;
+	if (is_option(QUIET))
+		goto out_free;
 
-	return CMD_SUCCESS;
+	user = tv_diff_usec(&ru_start.ru_utime, &ru_end.ru_utime) / 1e6;
+	sys  = tv_diff_usec(&ru_start.ru_stime, &ru_end.ru_stime) / 1e6;
+	gb   = bytes / 1e9;
+	printf("%s:  readbench %s - %s of %lu MB, bs %luk, %d threads, "
+		"cache %s", gcp->program_name, segname, read_modes[mode],
+		bytes / (1024 * 1024), bs / 1024, nr_threads,
+		warm ? "warm" : "cold");
+	if (node >= 0 && mode != READ_MMAP)
+		printf(", buffers on node %d", node);
+	printf("\n");
+	printf("    %8.3f secs, %.3f GB/s, cpu %.3f user + %.3f sys secs, "
+		"%.3f cpu secs/GB\n", usecs / 1e6,
+		gb / ((double)(usecs ? usecs : 1) / 1e6), user, sys,
+		gb > 0.0 ? (user + sys) / gb : 0.0);
+	printf("    %ld of %lu pages cached at the start\n", nr_cached,
+		extent.se_length / extent.se_pagesize);
+
+out_free:
+	for (i = 0; work && i < nr_threads; ++i)
+		if (work[i].rw_buf)
+			munmap(work[i].rw_buf, bs);
+	free(work);
+	free(workers);
+	return ret;
+
+bad_arg:
+	fprintf(stderr, "%s:  unrecognized argument:  %s\n",
+		gcp->program_name, arg);
+	return CMD_ERROR;
 }
 
 #if 0 /* new command function template */
@@ -2190,22 +7558,31 @@ struct command {
 		.cmd_name="numa",
 		.cmd_func=numa_info,
 		.cmd_help=
-			"numa          - display numa info as seen by this program.",
+			"numa [matrix [<size>[k|m|g|p]]] - display numa info as seen by this program.",
 		.cmd_longhelp=
 			"\tshows nodes from which program may allocate memory\n"
-			"\twith total and free memory.\n",
+			"\twith total and free memory.\n"
+			"\t'matrix' measures, from each node with allowed cpus to\n"
+			"\teach allowed memory node, pointer chase latency and\n"
+			"\tsequential read bandwidth over a <size> [default 64m]\n"
+			"\tscratch segment bound to the memory node.  Shows them\n"
+			"\tbeside numa_distance() and the measured latency scaled\n"
+			"\tto a local distance of 10, for checking SLIT tables.\n",
 	},
 	{
 		.cmd_name="migrate",
 		.cmd_func=migrate_process,
 		.cmd_help=
-			"migrate <to-node-id[s]> [<from-node-id[s]>] - \n"
+			"migrate <to-node-id[s]> [<from-node-id[s]>] [pid=<pid>|/<child>] - \n"
 			"\tmigrate this process' memory from <from-node-id[s]>\n"
 			"\tto <to-node-id[s]>.",
 		.cmd_longhelp=
 			"\tSpecify multiple node ids as a comma-separated list.\n"
 			"\tIf <from-node-id[s]> is omitted, it defaults to memtoy's\n"
-			"\tcurrent set of allowed nodes.\n" ,
+			"\tcurrent set of allowed nodes.\n"
+			"\t'pid=' migrates the memory of another process instead:\n"
+			"\ta process id or '/<child>' for one of memtoy's children.\n"
+			"\tThe child may be busy with a command sent with '&'.\n" ,
 	},
 
 	{
@@ -2292,7 +7669,7 @@ struct command {
 		.cmd_name="lock",
 		.cmd_func=lock_seg,
 		.cmd_help=
-			"lock <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] - \n"
+			"lock <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] [onfault] - \n"
 			"\tmlock() a [range of a] previously mapped segment.",
 		.cmd_longhelp=
 			"\tLock the named segment from <offset> through <offset>+<length>\n"
@@ -2300,7 +7677,21 @@ struct command {
 			"\tof mapped segment.  Locking a range of a segment causes the pages\n"
 			"\tbacking the specified/implied range to be faulted into memory.\n"
 			"\tNOTE:  locking is restricted by resource limits for non-privileged\n"
-			"\tusers.  See 'ulimit -l' -- results in Kbytes.\n",
+			"\tusers.  See 'ulimit -l' -- results in Kbytes.\n"
+			"\t'onfault' locks with mlock2(MLOCK_ONFAULT):  pages are locked\n"
+			"\tas they're faulted in, rather than up front.\n"
+			"\t'show' reports each segment's locked bytes, and the total\n"
+			"\tagainst the lock memory rlimit.\n",
+	},
+	{
+		.cmd_name="lockall",
+		.cmd_func=lockall,
+		.cmd_help=
+			"lockall current|future|onfault ... - mlockall() the address space.",
+		.cmd_longhelp=
+			"\t'current' locks all current mappings; 'future' locks mappings\n"
+			"\tmade from now on; 'onfault' with either locks pages as they're\n"
+			"\tfaulted in.  Each lockall replaces a previous 'future'.\n",
 	},
 	{
 		.cmd_name="unlock",
@@ -2312,6 +7703,13 @@ struct command {
 			"\tUnlock the named segment from <offset> through <offset>+<length>.\n"
 			"\tIf <offset> and <length> omitted, unlocks all pages of the segment.\n",
 	},
+	{
+		.cmd_name="unlockall",
+		.cmd_func=unlockall,
+		.cmd_help=
+			"unlockall - munlockall() the address space.",
+		.cmd_longhelp= "",
+	},
 	{
 		.cmd_name="slock",
 		.cmd_func=shm_lock_seg,
@@ -2337,19 +7735,23 @@ struct command {
 		.cmd_name="touch",
 		.cmd_func=touch_seg,
 		.cmd_help=
-			"touch <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] [read|write]",
+			"touch <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] [read|write]\n"
+			"      [for=<seconds>]",
 		.cmd_longhelp=
 			"\tread [default] or write the named segment from <offset> through\n"
 			"\t<offset>+<length>.  If <offset> and <length> omitted, touches all\n"
 			"\t of mapped segment.\n"
-			"\tYou can't write to segments from the task's /proc/<pid>/maps.\n",
+			"\tYou can't write to segments from the task's /proc/<pid>/maps.\n"
+			"\t'for=<seconds>' repeats the touch for <seconds> and reports\n"
+			"\tthe min/avg/max time per pass -- e.g., as a child's workload\n"
+			"\twhile its memory is migrated.\n",
 	},
 	{
 		.cmd_name="mbind",
 		.cmd_func=mbind_seg,
 		.cmd_help=
 			"mbind <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]]\n"
-			"      <policy>[+move[+all]] [<node/list>] - \n"
+			"      <policy>[+move[+all]] [<node/list>] [threads=<n>] - \n"
 			"\tset the numa policy for the specified range of the named segment",
 		.cmd_longhelp=
 			"\tto policy --  one of {default, bind, preferred, interleaved, noop}.\n"
@@ -2365,7 +7767,59 @@ struct command {
 			"\t        privilege.\n"
 			"\tFor policies preferred and interleaved, <node/list> may be specified\n"
 			"\tas '*' meaning local allocation for preferred policy and \"all allowed\n"
-			"\tnodes\" for interleave policy.\n" ,
+			"\tnodes\" for interleave policy.\n"
+			"\t'threads=<n>' splits the range into <n> disjoint pieces and\n"
+			"\t        mbind()s them concurrently from threads pinned to\n"
+			"\t        memtoy's allowed cpus.  With '+move', reports the\n"
+			"\t        min/avg/max per thread migration time.\n" ,
+	},
+	{
+		.cmd_name="movepages",
+		.cmd_func=movepages_seg,
+		.cmd_help=
+			"movepages [/<child>:]<seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]]\n"
+			"      <node/list> [batch=<n>|sweep] [all] [threads=<n>] - \n"
+			"\tmove_pages() the specified range of the named segment",
+		.cmd_longhelp=
+			"\tto the node[s] in <node/list>.  With more than one node,\n"
+			"\tpages are distributed round-robin over the listed nodes.\n"
+			"\t'batch=<n>' passes <n> pages to each move_pages() call.\n"
+			"\t        Default is the entire range in one call.\n"
+			"\t'sweep' [or batch=sweep] times batch sizes 1, 2, 4, ... up\n"
+			"\t        to the entire range, moving the pages back to their\n"
+			"\t        original nodes before each run, and reports the\n"
+			"\t        most efficient batch size.\n"
+			"\t'all'   use MPOL_MF_MOVE_ALL to move pages mapped by more\n"
+			"\t        than one process.  Requires appropriate privilege.\n"
+			"\t'threads=<n>' splits the range into <n> disjoint pieces\n"
+			"\t        moved concurrently from pinned threads.\n"
+			"\tReports pages/sec and a histogram of the per page status\n"
+			"\treturned by move_pages():  pages per node and per error\n"
+			"\t[-EBUSY, -EACCES, -ENOMEM, -ENOENT, ...].\n"
+			"\t'/<child>:<seg-name>' moves pages of a child's segment.\n"
+			"\tThe child may be busy with a command sent with '&', if\n"
+			"\tthe segment was looked up while it was idle.\n",
+	},
+	{
+		.cmd_name="migbench",
+		.cmd_func=migbench,
+		.cmd_help=
+			"migbench <size>[k|m|g|p] [<seg-type/list>] [<node/list>] - \n"
+			"	compare migration methods for each segment type and",
+		.cmd_longhelp=
+			"	each ordered pair of nodes in <node/list>.  For each\n"
+			"	combination, a temporary segment of <size> is populated\n"
+			"	on the source node, migrated to the destination using\n"
+			"	migrate_pages(), mbind() with MPOL_MF_MOVE and move_pages(),\n"
+			"	and its placement verified.  <seg-type/list> is a comma\n"
+			"	separated list of 'anon', 'file', 'shm' and 'huge'.  Default\n"
+			"	is all types over all allowed nodes.  'file' segments are\n"
+			"	created in $TMPDIR [default /var/tmp].  Reports a table of\n"
+			"	throughput in GB/s; '*' marks results where some pages were\n"
+			"	not found on the destination node, '-' where the measurement\n"
+			"	could not be made [e.g., no huge pages available].\n"
+			"	Note that migrate_pages() moves all of memtoy's pages on the\n"
+			"	source node, not just the segment's.\n",
 	},
 	{
 		.cmd_name="where",
@@ -2408,15 +7862,48 @@ struct command {
 		.cmd_name="child",
 		.cmd_func=child_spawn ,
 		.cmd_help=
-			"child <child-name> - "
-			"\tcreate a child process named <child-name>.",
+			"child <child-name> [cpus=<list>] [mems=<list>] "
+			"[mpol=<policy>[:<nodes>]]\n"
+			"\t- create a child process named <child-name>.",
 		.cmd_longhelp=
+			"\t<prefix>[<first>-<last>]<suffix>, e.g. w[0-255], creates\n"
+			"\ta child for each name in the range, all at once.\n"
+			"\tcpus=, mems= and mpol= set the child's cpu affinity,\n"
+			"\tallowed memories or task policy -- as the 'cpus', 'mems'\n"
+			"\tand 'mpol' commands would -- before the child is ready\n"
+			"\tfor its first command.  Use mems= or mpol=, not both.\n"
 			"\tChild enters command loop, reading from pipe.\n"
 			"\tCommands prefixed with '/<child-name>' will be sent to the\n"
 			"\tchild process.  Use '/' by itself, or '/?' to list existing\n"
 			"\tchildren.  Note that children may also have children of\n"
 			"\ttheir own and commands may be sent to 'grandchildren'\n"
-			"\tvia '/<child>/<grandchild>[/...] <command> ...\n",
+			"\tvia '/<child>/<grandchild>[/...] <command> ...\n"
+			"\tEnd a child command with '&' to continue without waiting\n"
+			"\tfor the child to finish it.  See 'wait'.\n"
+			"\t'/* <command>' broadcasts <command> to all children and\n"
+			"\tthreads.  They meet at a barrier and start together;\n"
+			"\tmemtoy summarizes their results.  '/' shows each\n"
+			"\tchild's last result.\n",
+	},
+	{
+		.cmd_name="thread",
+		.cmd_func=thread_spawn,
+		.cmd_help=
+			"thread <thread-name> [cpus=<list>] [mems=<list>] "
+			"[mpol=<policy>[:<nodes>]]\n"
+			"\t- create a command thread named <thread-name>.",
+		.cmd_longhelp=
+			"\tLike 'child', but the thread runs in memtoy's own address\n"
+			"\tspace:  segments are shared with memtoy and its other\n"
+			"\tthreads.  Send commands with '/<thread-name> ...', with\n"
+			"\tan optional trailing '&'.  'mpol' and 'cpus' sent to a\n"
+			"\tthread set that thread's task policy and affinity.\n"
+			"\t'migrate pid=/<thread-name>' and 'movepages\n"
+			"\t/<thread-name>:<seg>' operate on memtoy's own memory.\n"
+			"\tThreads can't create children or threads of their own,\n"
+			"\tor run 'cgroup'.\n"
+			"\t'/<thread-name> quit' ends the thread.  cpus=, mems=\n"
+			"\tand mpol= are as for 'child'.\n",
 	},
 	{
 		.cmd_name="kick",
@@ -2429,6 +7916,27 @@ struct command {
 			"\tUse 'kick ?' to see the list of signal names\n"
 			"\tthat memtoy recognizes\n",
 	},
+	{
+		.cmd_name="wait",
+		.cmd_func=child_wait_cmd,
+		.cmd_help=
+			"wait [<child>] - "
+			"wait for <child>, or all children, to finish\n"
+			"\tcommands sent with a trailing '&'.",
+		.cmd_longhelp="",
+	},
+	{
+		.cmd_name="_extent",
+		.cmd_func=extent_seg,
+		.cmd_help=NULL,		/* parent -> child query */
+		.cmd_longhelp=NULL,
+	},
+	{
+		.cmd_name="_bcast",
+		.cmd_func=bcast_run,
+		.cmd_help=NULL,		/* parent -> child broadcast */
+		.cmd_longhelp=NULL,
+	},
 
 	{
 		.cmd_name="snooze",
@@ -2457,6 +7965,229 @@ struct command {
 		.cmd_help= "mprotect <seg-name> <prot-list>",
 		.cmd_longhelp="",
 	},
+	{
+		.cmd_name="vmstat",
+		.cmd_func=vmstat,
+		.cmd_help=
+			"vmstat [on|off] - report /proc/vmstat deltas around each command.\n",
+		.cmd_longhelp=
+			"\tWhen on, memtoy snapshots /proc/vmstat before and after\n"
+			"\teach command and displays the counters that changed --\n"
+			"\te.g., pgmigrate_success/fail, numa_pages_migrated, pgfault,\n"
+			"\tthp_fault_alloc, compact_stall.  The nr_* gauges are shown\n"
+			"\tonly in verbose mode [-v].  Also enabled by the -s command\n"
+			"\tline option.  With no argument, shows the current setting.\n",
+	},
+	{
+		.cmd_name="psi",
+		.cmd_func=psi,
+		.cmd_help=
+			"psi [on|off|trigger ...] - report memory pressure stall time\n"
+			"\taround each command; log PSI trigger events.",
+		.cmd_longhelp=
+			"\tWhen on, memtoy reports the change in /proc/pressure/memory\n"
+			"\t'some' and 'full' stall totals around each command, in usecs\n"
+			"\tand as a percentage of the command's elapsed time -- and\n"
+			"\tlikewise for the cgroup memtoy moved itself into, if any.\n"
+			"\tpsi trigger some|full <stall-msecs> <window-msecs> [<cgroup>]\n"
+			"\t    arms a PSI trigger on /proc/pressure/memory, or on the\n"
+			"\t    cgroup's memory.pressure.  A monitor thread logs each\n"
+			"\t    stall event, with the time and the running command.\n"
+			"\tpsi trigger off - disarm the trigger.\n"
+			"\tWith no argument, shows the current settings.\n",
+	},
+	{
+		.cmd_name="set",
+		.cmd_func=set_var,
+		.cmd_help=
+			"set [<name>=[<value>]] - set script variable <name>.",
+		.cmd_longhelp=
+			"\t${<name>} in any later command line is replaced by\n"
+			"\t<value>.  A <value> that is an arithmetic expression --\n"
+			"\tintegers with optional k, m, g or p [pages] scale,\n"
+			"\t+ - * / % and parentheses -- is stored as its value;\n"
+			"\tothers are stored as is.  $((<expr>)) in a command\n"
+			"\tline is replaced by the value of <expr>, e.g.:\n"
+			"\t    set off=$((${off} + 4m))\n"
+			"\t'set <name>=' removes <name>.  With no argument, lists\n"
+			"\tthe variables.  Lines sent to children are expanded\n"
+			"\tbefore they're sent.\n",
+	},
+	{
+		.cmd_name="repeat",
+		.cmd_func=repeat_cmd,
+		.cmd_help=
+			"repeat <count> [<var>] { - run the following commands, up\n"
+			"\tto a line containing only '}', <count> times.",
+		.cmd_longhelp=
+			"\tThe block is read once, then run from memory:  each\n"
+			"\tpass only expands variables and dispatches the commands.\n"
+			"\tIf given, <var> is set to the pass number, from 0.\n"
+			"\t<count> may be an expression.  Blocks may be nested and\n"
+			"\tmay contain '/<child> ...' commands.  The loop stops\n"
+			"\tat the first command error, or on SIGINT.\n",
+	},
+	{
+		.cmd_name="bench",
+		.cmd_func=bench,
+		.cmd_help=
+			"bench <count> [warmup=<n>] <command> - run <command>\n"
+			"\t<count> times and summarize its timings.",
+		.cmd_longhelp=
+			"\tRuns <n> untimed warmup passes first.  Reports min, mean,\n"
+			"\tmedian, p95, max and standard deviation -- also as a\n"
+			"\tpercentage of the mean -- of the command's own timing,\n"
+			"\tas 'touch', 'mbind', 'movepages', 'migrate' and\n"
+			"\tbroadcasts record it; of a child's result for\n"
+			"\t'/<child> <command>'; else of the command's elapsed\n"
+			"\ttime.  Timing reports of the individual runs are\n"
+			"\tsuppressed; -v lists each run's time.  E.g.:\n"
+			"\t    bench 20 warmup=2 mbind foo bind+move 1\n",
+	},
+	{
+		.cmd_name="swapbench",
+		.cmd_func=swapbench,
+		.cmd_help=
+			"swapbench <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]]\n"
+			"\t[pattern=zero|compressible[:<ratio>]|random] - page out\n"
+			"\tand back in.",
+		.cmd_longhelp=
+			"\tFills the segment [range] with the pattern, pages it out\n"
+			"\twith madvise(MADV_PAGEOUT), then faults it back in a page at\n"
+			"\ta time.  Reports page-out throughput, swap-in throughput and\n"
+			"\tper page latency percentiles, and the compression achieved\n"
+			"\tby zswap [/proc/meminfo or debugfs] and zram [mm_stat].\n"
+			"\t'compressible:<ratio>' fills 1/<ratio> of each page with\n"
+			"\trandom bytes, the rest with zeros [default ratio 2].\n"
+			"\tPattern defaults to random.  Swapped in pages are checked\n"
+			"\tagainst the pattern.  The segment must be private anon,\n"
+			"\tmapped read/write.\n",
+	},
+	{
+		.cmd_name="ksm",
+		.cmd_func=ksm,
+		.cmd_help=
+			"ksm <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] on [dup=<fraction>]|off\n"
+			"ksm [<seg-name>] wait [<secs>] - KSM merging and unmerging.",
+		.cmd_longhelp=
+			"\t'on' marks the segment [range] MADV_MERGEABLE.  With dup=,\n"
+			"\tfirst fills it with unique pages and <fraction> copies of\n"
+			"\tone page.  'wait' waits -- 60 secs by default -- for ksmd to\n"
+			"\tconverge:  until memtoy's merged page count holds for a full\n"
+			"\tscan.  Reports the time to converge and the ksm counters.\n"
+			"\t'off' is MADV_UNMERGEABLE, timed:  it unmerges the range's\n"
+			"\tpages.  'touch ... w' of a mergeable segment reports the\n"
+			"\tpages it unmerged by COW.  Needs ksmd running:\n"
+			"\techo 1 >/sys/kernel/mm/ksm/run\n",
+	},
+	{
+		.cmd_name="forkbench",
+		.cmd_func=forkbench,
+		.cmd_help=
+			"forkbench <seg-name> [write=<fraction>] [advice=dontfork|wipeonfork]\n"
+			"\t- fork() and copy-on-write cost of a populated segment.",
+		.cmd_longhelp=
+			"\tPopulates the segment, then forks a child that writes\n"
+			"\t<fraction> of its pages [default all], timing each.  Reports\n"
+			"\tthe fork() latency, its page table copy -- against a fork\n"
+			"\twith the segment MADV_DONTFORK --, when the child ran, per\n"
+			"\tpage copy-on-write fault latency and the child's exit and\n"
+			"\treaping.  advice= applies MADV_DONTFORK or MADV_WIPEONFORK\n"
+			"\tfor the fork.  Lock the segment first, or use a huge page\n"
+			"\tsegment, for those variants.\n",
+	},
+	{
+		.cmd_name="faultscale",
+		.cmd_func=faultscale,
+		.cmd_help=
+			"faultscale <size>[k|m|g|p] [threads=[<min>..]<max>]\n"
+			"\t[layout=shared-vma|per-thread-vma|interleaved-pages] -\n"
+			"\tconcurrent page fault rate vs number of threads.",
+		.cmd_longhelp=
+			"\tMaps <size> of fresh anonymous memory, without THP, and has\n"
+			"\tthreads -- pinned workers -- first touch it concurrently.\n"
+			"\tThread counts double from <min> [default 1] to <max>\n"
+			"\t[default memtoy's cpus].  shared-vma:  one mapping, a\n"
+			"\tcontiguous piece per thread.  per-thread-vma:  a mapping\n"
+			"\tper thread.  interleaved-pages:  one mapping, threads\n"
+			"\ttaking alternate pages.  Reports faults/sec overall and\n"
+			"\tper thread, scaling against one thread, and minor faults\n"
+			"\tcounted by getrusage().\n",
+	},
+	{
+		.cmd_name="shootdown",
+		.cmd_func=shootdown,
+		.cmd_help=
+			"shootdown <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]] [threads=<n>]\n"
+			"\t[op=mprotect|munmap|madvise-dontneed|migrate] [secs=<n>] -\n"
+			"\tTLB shootdown cost to the process's other cpus.",
+		.cmd_longhelp=
+			"\tOne pinned worker issues the op on the segment [range]\n"
+			"\tin a loop, for <secs> [default 1] per run, while up to\n"
+			"\t<n> others -- pinned to the other cpus, doubling each run --\n"
+			"\tread the whole segment.  Reports op latency percentiles\n"
+			"\tand the readers' throughput with and without the ops.\n"
+			"\tThe segment must be private anon, mapped read/write:\n"
+			"\tshootdown populates it by writing.  mprotect toggles\n"
+			"\twrite access; munmap unmaps a populated scratch mapping\n"
+			"\tof the range's size; madvise-dontneed discards the range\n"
+			"\t-- its data is lost; migrate moves it between the first\n"
+			"\ttwo allowed nodes.\n",
+	},
+	{
+		.cmd_name="split",
+		.cmd_func=split,
+		.cmd_help=
+			"split <seg-name> pieces=[<min>..]<max> [by=mprotect|mbind] -\n"
+			"\tvma fragmentation cost.",
+		.cmd_longhelp=
+			"\tRemaps the segment and splits it into <pieces> vmas by\n"
+			"\ttoggling PROT_EXEC, or setting a preferred node policy, on\n"
+			"\tevery other piece.  Then times touching [faulting in] the\n"
+			"\tsegment, a move_pages() query of its nodes and unmapping\n"
+			"\tit.  <pieces> doubles from <min> [default 1] to <max>.\n"
+			"\tReports the vmas counted in /proc/self/maps.  Segment data\n"
+			"\tis lost; the segment is left mapped, unsplit.\n",
+	},
+	{
+		.cmd_name="readbench",
+		.cmd_func=readbench,
+		.cmd_help=
+			"readbench <seg-name> [<offset>[k|m|g|p] <length>[k|m|g|p]]\n"
+			"\t[mode=mmap|pread|preadv|readahead] [bs=<size>] [threads=<n>]\n"
+			"\t[cache=cold|warm] [node=<node>] - read a file segment.",
+		.cmd_longhelp=
+			"\tReads the file segment [range] through its mapping, or\n"
+			"\twith pread(), preadv() [a page per iovec] or readahead()\n"
+			"\tahead of pread(), in <bs> blocks [default 64k], split among\n"
+			"\t<n> threads.  Each mode reads every word of the data once.\n"
+			"\tcache=cold [default] drops the range from the page cache\n"
+			"\tfirst; warm reads it in.  node= binds the read buffers.\n"
+			"\tReports GB/s and cpu secs per GB.\n",
+	},
+	{
+		.cmd_name="cgroup",
+		.cmd_func=cgroup,
+		.cmd_help=
+			"cgroup [create|set|move|show|watch|remove <cgroup-name> ...] -\n"
+			"\tcgroup v2 sandboxes.  With no argument, lists memtoy's cgroups.",
+		.cmd_longhelp=
+			"\tcgroup create <name> [<file>=<value> ...] - create a cgroup,\n"
+			"\t    with the memory controller, and set its files -- e.g.,\n"
+			"\t    memory.max=256m memory.high=128m cpuset.mems=0-1.\n"
+			"\t    memory.* sizes take k|m|g|p.  Enables the files'\n"
+			"\t    controllers in the parents as needed.\n"
+			"\tcgroup set <name> <file>=<value> ... - set files of a cgroup.\n"
+			"\tcgroup move <name> [<child>|<pid>] - move memtoy, a child\n"
+			"\t    or a process into the cgroup.  '-' names memtoy's own.\n"
+			"\tcgroup show <name> - show limits, usage, events, pressure.\n"
+			"\tcgroup watch <name>|off - report changes in the cgroup's\n"
+			"\t    memory.current, memory.events, memory.stat and\n"
+			"\t    memory.pressure stall totals [usecs] around each command.\n"
+			"\tcgroup remove <name> - remove an empty cgroup.\n"
+			"\tNames are paths under the cgroup2 mount.  Cgroups that memtoy\n"
+			"\tcreates are removed when it exits.\n",
+	},
 
 #if 0 /* template for new commands */
 	{
@@ -2526,7 +8257,6 @@ help_me(char *args)
 /*
  * =========================================================================
  */
-#define CMDBUFSZ 256
 
 static bool
 unique_abbrev(char *cmd, size_t clen, struct command *cmdp)
@@ -2555,13 +8285,20 @@ parse_command(char *cmdline)
 
 		if (strncmp(cmd, cmdp->cmd_name, clen))
 			continue;
-		if (!unique_abbrev(cmd, clen, cmdp+1)) {
+		/*
+		 * a full command name -- e.g., 'lock' vs 'lockall' -- is
+		 * never ambiguous
+		 */
+		if (cmdp->cmd_name[clen] != '\0' &&
+		    !unique_abbrev(cmd, clen, cmdp+1)) {
 			fprintf(stderr, "%s:  ambiguous command:  %s\n",
 				gcp->program_name, cmd);
 			return CMD_ERROR;
 		}
-		gcp->cmd_name = cmdp->cmd_name;
+		gcp->cmd_name = last_cmd_name = cmdp->cmd_name;
+		stats_begin();
 		ret = cmdp->cmd_func(args);
+		stats_end();
 		gcp->cmd_name = NULL;
 		return ret;
 	}
@@ -2571,6 +8308,49 @@ parse_command(char *cmdline)
 	return CMD_ERROR;
 }
 
+/*
+ * parse_command_result() - parse and execute a child's command, filling
+ * in its result for the parent.  A nested command -- e.g., a broadcast
+ * command run by '_bcast' -- fills in the result first; keep that one.
+ */
+static int
+parse_command_result(char *cmdline, child_result_t *rp)
+{
+	glctx_t *gcp = &glctx;
+	struct rusage  ru_start, ru_end;
+	struct timeval t_start, t_end;
+	int who = gcp->cmd_thread ? RUSAGE_THREAD : RUSAGE_SELF;
+	int ret;
+
+	if (!rp)
+		return parse_command(cmdline);
+
+	last_cmd_name = NULL;
+	gcp->result.r_op = NULL;
+	getrusage(who, &ru_start);
+	gettimeofday(&t_start, NULL);
+
+	ret = parse_command(cmdline);
+
+	gettimeofday(&t_end, NULL);
+	getrusage(who, &ru_end);
+	if (rp->cr_filled)
+		return ret;
+
+	if (last_cmd_name)
+		snprintf(rp->cr_cmd, sizeof(rp->cr_cmd), "%s", last_cmd_name);
+	rp->cr_status    = ret;
+	rp->cr_usecs     = tv_diff_usec(&t_start, &t_end);
+	rp->cr_cpu_usecs = tv_diff_usec(&ru_start.ru_utime, &ru_end.ru_utime) +
+			   tv_diff_usec(&ru_start.ru_stime, &ru_end.ru_stime);
+	rp->cr_pages     = gcp->result.r_op ? gcp->result.r_pages : 0;
+	rp->cr_majflt    = ru_end.ru_majflt - ru_start.ru_majflt;
+	rp->cr_faults    = ru_end.ru_minflt - ru_start.ru_minflt +
+			   rp->cr_majflt;
+	rp->cr_filled    = true;
+	return ret;
+}
+
 /*
  * For non-interactive input, including children reading from command pipes,
  * emulate readline(3) without prompting
@@ -2579,6 +8359,7 @@ static char *
 readline_ni(void)
 {
 	glctx_t *gcp = &glctx;
+	FILE  *input = gcp->cmd_input ? gcp->cmd_input : stdin;
 	char  *cmdbuf, *cmdline;
 	size_t cmdlen;
 
@@ -2587,12 +8368,21 @@ readline_ni(void)
 //TODO:  check return
 
 	while(true) {
-		cmdline = fgets(cmdbuf, CMDBUFSZ-1, stdin);
+		cmdline = fgets(cmdbuf, CMDBUFSZ-1, input);
 		if (cmdline != NULL)
 			break;
 
-		if (!feof(stdin))
+		if (!feof(input))
 			continue;	/* skip empty lines */
+		if (gcp->cmd_thread) {
+			free(cmdbuf);
+			thread_exit(0);	/* creator went away */
+		}
+		if (script_depth) {
+			fprintf(stderr, "%s:  EOF in repeat block\n",
+				gcp->program_name);
+			exit(4);
+		}
 		printf("%s EOF on stdin\n", gcp->program_name);
 		exit(0);		/* EOF */
 	}
@@ -2618,18 +8408,169 @@ cmd_free(char *cmdline)
 		free(cmdline);
 }
 
+/*
+ * read_command_line() - read the next command line:  via readline(3),
+ * with 'prompt', when interactive; else from our command input.
+ * EOF exits.
+ */
+static char *
+read_command_line(char *prompt)
+{
+	glctx_t *gcp = &glctx;
+	char *cmdline;
+
+	if (!is_option(INTERACTIVE) || gcp->child_name)
+		return readline_ni();
+
+	cmdline = readline(prompt);
+	if (cmdline == NULL) {
+		printf("\n");	/* flush prompt */
+		if (script_depth) {
+			fprintf(stderr, "%s:  EOF in repeat block\n",
+				gcp->program_name);
+			exit(4);
+		}
+		exit(0);	/* EOF */
+	}
+	if (*cmdline)
+		add_history(cmdline);
+
+	return cmdline;
+}
+
+/*
+ * cmd_trim() - skip leading and trim trailing whitespace for ease of
+ * parsing.  Returns NULL for blank lines and comments.
+ */
+static char *
+cmd_trim(char *cmdline)
+{
+	size_t cmdlen;
+
+	cmdline += strspn(cmdline, whitespace);
+	cmdlen = strlen(cmdline);
+
+	if (cmdlen == 0) {
+		//TODO:  interactive help?
+		return NULL;	/* ignore blank lines */
+	}
+
+	if (*cmdline == '#')
+		return NULL;	/* comments */
+
+	while(strchr(whitespace, cmdline[cmdlen-1]))
+		cmdline[--cmdlen] = '\0';
+
+	return cmdline;
+}
+
+/*
+ * run_command_line() - expand variables in a trimmed command line and
+ * execute it, or forward it to a child.  'line' is not modified.
+ */
+static int
+run_command_line(char *line)
+{
+	glctx_t *gcp = &glctx;
+	char  cmdbuf[CMDBUFSZ];
+	char *cmdline;
+	int   ret;
+
+	/*
+	 * reset signals just before parsing a command.
+	 * non-interactive:  exit on SIGQUIT
+	 */
+	if(signalled(gcp)) {
+		if(!is_option(INTERACTIVE) &&
+		   gcp->siginfo->si_signo == SIGQUIT)
+			exit(0);
+		reset_signal();
+	}
+
+	cmdline = script_expand(line, cmdbuf, sizeof(cmdbuf));
+	if (!cmdline)
+		ret = CMD_ERROR;
+	else if (*cmdline == '/') {
+		/*
+		 * forward child-directed commands
+		 */
+		ret = child_send(++cmdline, NULL);
+	} else {
+		if(!is_option(INTERACTIVE))
+			vprint("%s>%s\n", gcp->program_name, cmdline);
+		ret = parse_command_result(cmdline, gcp->child_result);
+	}
+
+	/*
+	 * non-interactive:  errors are fatal
+	 */
+	if(!is_option(INTERACTIVE)) {
+		if (ret == CMD_ERROR) {
+			fprintf(stderr, "%s:  command error\n",
+				gcp->program_name);
+			if (gcp->cmd_thread)
+				thread_exit(4);
+			exit(4);
+		}
+		fflush(stdout);
+	}
+
+	return ret;
+}
+
+/*
+ * command_run() - run a command line for a control socket client [see
+ * server.c]:  as run_command_line(), but errors aren't fatal and the
+ * result is returned in 'rp'.
+ */
+int
+command_run(char *line, child_result_t *rp)
+{
+	glctx_t *gcp = &glctx;
+	char  cmdbuf[CMDBUFSZ];
+	char *cmdline;
+
+	cmd_from_socket = true;
+	children_reap();
+	if (signalled(gcp))
+		reset_signal();
+	gcp->interrupted = false;
+	gcp->result.r_op = NULL;
+
+	if (strlen(line) >= CMDBUFSZ) {
+		fprintf(stderr, "%s:  command line too long\n",
+			gcp->program_name);
+		return CMD_ERROR;
+	}
+
+	cmdline = script_expand(line, cmdbuf, sizeof(cmdbuf));
+	if (!cmdline)
+		return CMD_ERROR;
+	if (*cmdline == '/')
+		return child_send(++cmdline, rp);
+
+	return parse_command_result(cmdline, rp);
+}
+
 static char _cmdbuf[CMDBUFSZ*2];
 void
 process_commands()
 {
 	glctx_t *gcp = &glctx;
-	char  *prompt_buf;
+	char  *prompt_buf = NULL;
 	char  *saved_cmdline = NULL;	/* for freeing */
+	child_result_t result;		/* children:  for parent */
+
+	memset(&result, 0, sizeof(result));
+	if (gcp->child_name)
+		gcp->child_result = &result;
 
 	/*
-	 * primarily to reset children's input buffer
+	 * primarily to reset children's input buffer.
+	 * threads have their own fresh command stream.
 	 */
-	if (setvbuf(stdin, _cmdbuf, _IOLBF, sizeof(_cmdbuf))) {
+	if (!gcp->cmd_input &&
+	    setvbuf(stdin, _cmdbuf, _IOLBF, sizeof(_cmdbuf))) {
 		int err = errno;
 		fprintf(stderr, "%s - setvbuf failed - %s\n",
 			gcp->program_name, strerror(err));
@@ -2649,80 +8590,17 @@ process_commands()
 	 */
 	for (;; cmd_free(saved_cmdline), child_respond()) {
 		char  *cmdline;
-		size_t cmdlen;
-
-		if (is_option(INTERACTIVE) && !gcp->child_name) {
-			saved_cmdline = cmdline =
-				 readline(prompt_buf);
-			if (cmdline == NULL) {
-				printf("\n");	/* flush prompt */
-				exit(0);	/* EOF */
-			}
-			if (*cmdline)
-				add_history(cmdline);
-		} else
-			saved_cmdline = cmdline = readline_ni();
-
-		if (cmdline[0] == '\0')
-			continue;
-
-		/*
-		 * skip leading whitespace
-		 */
-		cmdline += strspn(cmdline, whitespace);
-		cmdlen = strlen(cmdline);
-
-		if (cmdlen == 0) {
-			//TODO:  interactive help?
-			continue;	/* ignore blank lines */
-		}
-
-		if (*cmdline == '#')
-			continue;	/* comments */
-
-		/*
-		 * trim trailing whitespace for ease of parsing
-		 */
-		while(strchr(whitespace, cmdline[cmdlen-1]))
-			cmdline[--cmdlen] = '\0';
-
-		if (cmdlen == 0)
-			continue;
 
-		/*
-		 * reset signals just before parsing a command.
-		 * non-interactive:  exit on SIGQUIT
-		 */
-		if(signalled(gcp)) {
-			if(!is_option(INTERACTIVE) &&
-			   gcp->siginfo->si_signo == SIGQUIT)
-				exit(0);
-			reset_signal();
-		}
+		children_reap();
+		memset(&result, 0, sizeof(result));
 
-		/*
-		 * forward child-directed commands
-		 */
-		if (*cmdline == '/') {
-			child_send(++cmdline);
-			//TODO:  check error?
+		saved_cmdline = read_command_line(prompt_buf);
+		cmdline = cmd_trim(saved_cmdline);
+		if (!cmdline)
 			continue;
-		}
-
-		/*
-		 * non-interactive:  errors are fatal
-		 */
-		if(!is_option(INTERACTIVE)) {
-			vprint("%s>%s\n", gcp->program_name, cmdline);
-			if(parse_command(cmdline) == CMD_ERROR) {
-				fprintf(stderr, "%s:  command error\n",
-					gcp->program_name);
-				exit(4);
-			}
-			fflush(stdout);
-		} else
-			parse_command(cmdline);
 
+		gcp->interrupted = false;	/* new top level command */
+		run_command_line(cmdline);
 	}
 }
 
@@ -0,0 +1,718 @@
+/*
+ * memtoy:  engine.c - context, signals and memory access engines
+ *
+ * what the memtoy command line tool and libmemtoy share:  the per thread
+ * context, messages, fault and interrupt handling, timed operation
+ * results and the touch/latency/bandwidth loops that segment.c and the
+ * commands drive.
+ */
+/*
+ *  Copyright (c) 2005,2006,2007 Hewlett-Packard, Inc
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <numa.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memtoy.h"
+
+/*
+ * global context
+ */
+__thread glctx_t glctx;	/* global [per thread] context */
+
+char *whitespace = " \t";
+
+/*
+ * die() - emit error message and exit w/ specified return code.
+ *	   if exit_code < 0, save current errno, and fetch associated
+ *	   error string.  Print error string after app error message.
+ *	   Then exit with abs(exit_code).
+ */
+void
+die(int exit_code, char *format, ... )
+{
+	va_list ap;
+	char *errstr;
+	int saverrno;
+
+	va_start(ap, format);
+
+	if (exit_code < 0) {
+		saverrno = errno;
+		errstr = strerror(errno);
+	}
+
+	(void) vfprintf(stderr, format, ap);
+	va_end(ap);
+
+	if (exit_code < 0)
+		fprintf(stderr,"Error = (%d) %s\n", saverrno, errstr);
+
+	exit(abs(exit_code));
+}
+
+#ifdef _DEBUG
+/*
+ * This function is a wrapper around "fprintf(stderr, ...)" so that we
+ * can use the DPRINTF(<flag>, (<[f]printf arguments>)) macro for debug
+ * prints.  See the definition of DPRINTF in XXX.h
+ */
+int
+_dvprintf(char *format, ...)
+{
+	va_list ap;
+	int retval;
+
+	va_start(ap, format);
+
+	retval = vfprintf(stderr, format, ap);
+
+	va_end(ap);
+
+	fflush(stderr);
+	return(retval);
+}
+#endif
+
+void
+vprint(char *format, ...)
+{
+	va_list ap;
+	glctx_t *gcp = &glctx;
+
+	va_start(ap, format);
+
+	if (!is_option(VERBOSE))
+		goto out;
+
+	(void)vfprintf(stdout, format, ap);
+	fflush(stdout);
+
+out:
+	va_end(ap);
+	return;
+
+}
+
+/*
+ * =========================================================================
+ */
+static int signals_to_handle[] =
+{
+	SIGINT,  SIGQUIT, SIGSEGV, SIGBUS,
+	SIGUSR1, SIGUSR2, 0
+};
+
+static char *sig_names[] =
+{
+	"INT",  "QUIT", "SEGV", "BUS",
+	"USR1", "USR2", "unknown", 0
+};
+
+char *
+sig_name(int signum)
+{
+	int isig=0, *sigp = signals_to_handle;
+
+	while(*sigp) {
+		if (*sigp == signum)
+			break;
+		++isig; ++sigp;
+	}
+
+	return sig_names[isig];
+}
+
+int
+signum_from_name(const char *sig_name)
+{
+	int isig=0;
+	char **signp = sig_names;
+
+	if (!strncasecmp(sig_name, "sig", 3))
+		sig_name += 3;
+
+	while(strcmp(*signp, "unknown")) {
+		if(!strcasecmp(sig_name, *signp))
+			return signals_to_handle[isig];
+		++isig; ++signp;
+	}
+
+	return -1;	/* no match */
+	
+}
+
+void
+signal_list(void)
+{
+	char **signp = sig_names;
+	int  icol = 0;
+
+	printf("Signals available to 'kick':");
+	while(strcmp(*signp, "unknown")) {
+		if (!icol) {
+			printf("\n    ");
+			icol += 4;
+		}
+		printf("SIG%-5s", *signp);
+		++signp; icol += 8;
+		if (icol > MAXCOL - 8)
+			icol = 0;
+	}
+
+	printf("\n");
+}
+
+/*
+ * signal_handler()
+ *
+ * save siginfo and name in global context
+ */
+void
+signal_handler(int sig, siginfo_t *info, void *vcontext)
+{
+	glctx_t *gcp = &glctx;
+	static siginfo_t infocopy;
+
+	/*
+	 * static copy of signal info.
+	 * Note, additional signals, before use, can overwrite
+	 */
+	infocopy = *info;
+	gcp->siginfo   = &infocopy;
+
+	gcp->signame   = sig_name(sig);
+
+	vprint("signal hander entered for sig SIG%s\n", gcp->signame);
+
+	switch (sig) {
+	case SIGSEGV:
+	case SIGBUS:
+		if (gcp->sigjmp) {
+			gcp->sigjmp = false;
+			siglongjmp(gcp->sigjmp_env, 1);
+		}
+
+		die(8, "\n%s:  signal SIG%s, but handler not armed\n",
+		       gcp->program_name, gcp->signame);
+		break;
+
+	case SIGINT:
+		gcp->interrupted = true;
+		break;
+
+	case SIGQUIT:
+		break;
+
+	default:
+		die(8, "\n%s:  Unexpected signal:  %d\n",
+		        gcp->program_name, sig);
+		break;
+	}
+}
+/*
+ * set_signals()
+ *
+ * Setup signal dispositions to catch selected signals
+ */
+void
+set_signals()
+{
+	glctx_t *gcp = &glctx;
+	int *sigp = signals_to_handle;
+	char **namep = sig_names;
+	sigset_t sigcld;
+	
+	struct sigaction act = {
+		.sa_sigaction = signal_handler,
+		.sa_flags	 = SA_SIGINFO
+	};
+
+	(void)sigfillset(&(act.sa_mask));
+
+	while (*sigp) {
+		char *sig_name = *(namep++);
+		int sig = *(sigp++);
+
+
+		if (0 != sigaction(sig, &act, NULL)) {
+			die(-1, "%s: Failed to set sigaction for %s\n",
+			        gcp->program_name, sig_name);
+		} else
+#if 0
+			vprint("%s: established handler for %s\n",
+			        gcp->program_name, sig_name)
+#endif
+			;
+	}
+
+	/*
+	 * deceased children are reaped via a signalfd.  Block SIGCLD
+	 * before creating any threads, so that all inherit the mask.
+	 */
+	sigemptyset(&sigcld);
+	sigaddset(&sigcld, SIGCLD);
+	sigprocmask(SIG_BLOCK, &sigcld, NULL);
+
+		return;
+}
+
+void
+reset_signal(void)
+{
+//TODO:  free siginfo if/when malloc'd
+	glctx.siginfo = NULL;
+	glctx.sigjmp  = false;
+}
+
+void
+wait_for_signal(const char *mesg)
+{
+	printf("%s ... ", mesg); fflush(stdout);
+	pause();
+	vprint("%s: wakened by signal SIG%s\n", __FUNCTION__, glctx.signame);
+	reset_signal();
+	printf("\n"); fflush(stdout);
+}
+
+void
+show_siginfo()
+{
+	glctx_t *gcp = &glctx;
+	siginfo_t *info = gcp->siginfo;
+	void *badaddr = info->si_addr;
+	char *sigcode;
+
+	switch (info->si_signo) {
+	case SIGSEGV:
+		switch (info->si_code) {
+		case SEGV_MAPERR:
+			sigcode = "address not mapped";
+			break;
+
+		case SEGV_ACCERR:
+			sigcode = "invalid access error";
+			break;
+
+		default:
+			sigcode = "unknown";
+			break;
+		}
+		break;
+
+	case SIGBUS:
+		switch (info->si_code) {
+		case BUS_ADRALN:
+			sigcode = "invalid address alignment";
+			break;
+
+		case BUS_ADRERR:
+			sigcode = "non-existent physical address";
+			break;
+
+		default:
+			sigcode = "unknown";
+			break;
+		}
+		break;
+
+	default:
+		/*
+		 * ignore SIGINT/SIGQUIT
+		 */
+		return;
+	}
+
+	printf("Signal SIG%s @ 0x%lx - %s\n", gcp->signame, badaddr, sigcode);
+
+}
+
+/*
+ * =========================================================================
+ */
+
+/*
+ * result_record() - save result of a timed operation in global context
+ */
+void
+result_record(char *op, unsigned long usecs, unsigned long pages,
+		size_t pagesize, unsigned long failed)
+{
+	op_result_t *rp = &glctx.result;
+
+	rp->r_op       = op;
+	rp->r_usecs    = usecs;
+	rp->r_pages    = pages;
+	rp->r_pagesize = pagesize;
+	rp->r_failed   = failed;
+}
+
+/*
+ * touch_memory() - read or write one word in each page of a range.
+ * Returns 0 when the whole range was touched; -1 if a signal cut it short.
+ */
+int
+touch_memory(bool rw, unsigned long *memp, size_t memlen, size_t pagesize)
+{
+	glctx_t *gcp = &glctx;
+
+	unsigned long  *memend, *pp, sink;
+	unsigned long longs_in_page = pagesize / sizeof (unsigned long);
+
+	memend = memp + memlen/sizeof(unsigned long);
+	vprint("!!!%s from 0x%lx thru 0x%lx\n",
+		rw ? "Writing" : "Reading", memp, memend);
+
+	for(pp = memp; pp < memend;  pp += longs_in_page) {
+		// vprint("%s:  touching 0x%lx\n", __FUNCTION__, pp);
+		if (!sigsetjmp(gcp->sigjmp_env, true)) {
+			gcp->sigjmp = true;
+
+			/*
+			 *  Mah-ahm!  He's touching me!
+			 */
+			if (rw)
+				*pp = (unsigned long)pp;
+			else
+				sink = *pp;
+
+			gcp->sigjmp = false;
+		} else {
+			show_siginfo();
+			reset_signal();
+			return -1;
+		}
+
+		/*
+		 * Any [handled] signal breaks the loop
+		 */
+		if(gcp->siginfo != NULL) {
+			reset_signal();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * chase_latency() - average latency, in nanoseconds, of dependent loads
+ * through a random cyclic chain of cache lines spanning 'memlen' bytes.
+ * Random order defeats the hardware prefetchers; a working set larger
+ * than the caches measures memory latency.
+ */
+#define CHASE_LINE 64
+#define CHASE_MIN_STEPS (1UL << 20)
+double
+chase_latency(char *memp, size_t memlen)
+{
+	unsigned long  nr_lines = memlen / CHASE_LINE, steps, i;
+	unsigned long *order;
+	struct timeval t_start, t_end;
+	void         **pp;
+	void * volatile sink;
+
+	if (nr_lines < 2)
+		return 0.0;
+
+	order = calloc(nr_lines, sizeof(*order));
+	if (!order)
+		return -1.0;
+
+	for (i = 0; i < nr_lines; ++i)
+		order[i] = i;
+	for (i = nr_lines - 1; i > 0; --i) {	/* shuffle */
+		unsigned long j = random() % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < nr_lines; ++i)
+		*(void **)(memp + order[i] * CHASE_LINE) =
+			memp + order[(i + 1) % nr_lines] * CHASE_LINE;
+	free(order);
+
+	steps = nr_lines < CHASE_MIN_STEPS ? CHASE_MIN_STEPS : nr_lines;
+
+	pp = (void **)memp;
+	gettimeofday(&t_start, NULL);
+	for (i = 0; i < steps; ++i)
+		pp = *pp;
+	gettimeofday(&t_end, NULL);
+
+	sink = pp;	/* keep the compiler from discarding the chase */
+	(void)sink;
+
+	return (double)tv_diff_usec(&t_start, &t_end) * 1000.0 / steps;
+}
+
+/*
+ * stream_bandwidth() - read bandwidth, in GB/s, of sequential passes
+ * over 'memlen' bytes.  Reports the best of a few passes.
+ */
+#define STREAM_PASSES 3
+double
+stream_bandwidth(unsigned long *memp, size_t memlen)
+{
+	unsigned long *memend = memp + memlen/sizeof(unsigned long);
+	unsigned long  best_usecs = 0;
+	volatile unsigned long sink;
+	int            pass;
+
+	for (pass = 0; pass < STREAM_PASSES; ++pass) {
+		struct timeval t_start, t_end;
+		unsigned long *pp, sum = 0, usecs;
+
+		gettimeofday(&t_start, NULL);
+		for (pp = memp; pp < memend; pp += 4)
+			sum += pp[0] + pp[1] + pp[2] + pp[3];
+		gettimeofday(&t_end, NULL);
+		sink = sum;
+		(void)sink;
+
+		usecs = tv_diff_usec(&t_start, &t_end);
+		if (!pass || usecs < best_usecs)
+			best_usecs = usecs;
+	}
+
+	/*
+	 * bytes/usec => MB/s; /1000 => GB/s
+	 */
+	return (double)memlen / (best_usecs ? best_usecs : 1) / 1000.0;
+}
+
+/*
+ * fill_page() - fill one page with content that compresses by about
+ * 'ratio':  the first 1/ratio of it pseudo-random, the rest zero.
+ * ratio 0 => all zero.  The random bytes depend only on 'seed', so
+ * pages filled with the same seed are identical.
+ */
+void
+fill_page(char *pagep, size_t pagesize, double ratio, unsigned long seed)
+{
+	unsigned long *wp = (unsigned long *)pagep;
+	size_t         nr_words = pagesize / sizeof(*wp), nr_random, i;
+	unsigned long  x = seed * 0x9e3779b97f4a7c15UL + 1;
+
+	nr_random = ratio >= 1.0 ? (size_t)(nr_words / ratio) : 0;
+	for (i = 0; i < nr_random; ++i) {
+		x ^= x << 13;		/* xorshift64 */
+		x ^= x >> 7;
+		x ^= x << 17;
+		wp[i] = x;
+	}
+	memset(wp + nr_random, 0, (nr_words - nr_random) * sizeof(*wp));
+}
+
+/*
+ * pagemap_walk() - call 'func' with the /proc/self/pagemap entry of each
+ * of 'nr_pages' pages at 'start'.  'func' returns 1 to count the page, 0
+ * not to, or -1 to give up.  Returns the count, or -1 -- with errno set,
+ * if we couldn't read the pagemap.
+ */
+long
+pagemap_walk(char *start, unsigned long nr_pages, size_t pagesize,
+		int (*func)(unsigned long long, void *), void *arg)
+{
+	uint64_t     *pm;
+	ssize_t       len = nr_pages * sizeof(*pm);
+	unsigned long i;
+	long          count = 0;
+	int           fd, err;
+
+	pm = malloc(len ? len : 1);
+	if (!pm) {
+		errno = ENOMEM;
+		return -1;
+	}
+	fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0 || pread(fd, pm, len,
+			(unsigned long)start / pagesize * sizeof(*pm)) != len) {
+		err = errno;
+		if (fd >= 0)
+			close(fd);
+		free(pm);
+		errno = err;
+		return -1;
+	}
+	close(fd);
+
+	for (i = 0; i < nr_pages; ++i) {
+		int ret = func(pm[i], arg);
+
+		if (ret < 0) {
+			count = -1;
+			break;
+		}
+		count += ret;
+	}
+	free(pm);
+	return count;
+}
+
+#define KPF_KSM     21			/* /proc/kpageflags */
+
+/*
+ * is_ksm_page() - pagemap_walk() func:  is a present page's pfn flagged
+ * KSM in /proc/kpageflags ['arg' is its fd]?
+ */
+static int
+is_ksm_page(unsigned long long entry, void *arg)
+{
+	uint64_t pfn = entry & PM_PFN_MASK, flags;
+
+	if (!(entry & PM_PRESENT))
+		return 0;
+	if (!pfn)
+		return -1;	/* pfns hidden */
+	if (pread(*(int *)arg, &flags, sizeof(flags),
+			pfn * sizeof(flags)) != sizeof(flags))
+		return -1;
+	return !!(flags & (1ULL << KPF_KSM));
+}
+
+/*
+ * ksm_pages() - how many of 'nr_pages' pages at 'start' are KSM pages,
+ * from their pagemap pfns' /proc/kpageflags.  -1 if we can't tell:
+ * reading pfns takes CAP_SYS_ADMIN.
+ */
+long
+ksm_pages(char *start, unsigned long nr_pages, size_t pagesize)
+{
+	long nr_ksm;
+	int  kpffd;
+
+	kpffd = open("/proc/kpageflags", O_RDONLY);
+	if (kpffd < 0)
+		return -1;
+	nr_ksm = pagemap_walk(start, nr_pages, pagesize, is_ksm_page, &kpffd);
+	close(kpffd);
+	return nr_ksm;
+}
+
+/*
+ * ksm_merging_pages() - how many of our pages KSM has merged, from
+ * /proc/self/ksm_merging_pages [Linux 5.19], else -1
+ */
+long
+ksm_merging_pages(void)
+{
+	FILE *fp;
+	long  nr_pages = -1;
+
+	fp = fopen("/proc/self/ksm_merging_pages", "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%ld", &nr_pages) != 1)
+		nr_pages = -1;
+	fclose(fp);
+	return nr_pages;
+}
+
+/*
+ * =========================================================================
+ */
+
+/*
+ * TODO:  a better way?
+ */
+#define MIBUFSIZE 64
+void
+get_huge_pagesize(glctx_t *gcp)
+{
+	FILE *mi;
+
+	mi = fopen("/proc/meminfo", "r");
+	if (!mi) {
+		die(-1, "%s:  failed to open /proc/meminfo\n",
+			gcp->program_name);
+	}
+
+	do {
+		char buf[MIBUFSIZE], *input;
+		char *next;
+		size_t huge_pagesize;
+
+		input = fgets(buf, MIBUFSIZE, mi);
+		if (!input)
+			continue;	/* probably EOF */
+
+		if (strncmp(input, "Hugepagesize:", strlen("Hugepagesize:")))
+			continue;
+
+		input += strlen("Hugepagesize:");
+		input += strspn(input, whitespace);
+
+		huge_pagesize = strtoul(input, &next, 0);
+		if (*next != ' ') {
+			die(-1, "%s:  bogus huge pagesize %s\n", 
+				gcp->program_name, input);
+		}
+
+		input = next + strspn(next, whitespace);
+		if (!strncmp(input, "kB", strlen("kB")))
+			huge_pagesize <<= KILO_SHIFT;
+
+		gcp->huge_pagesize = huge_pagesize;
+
+	} while (!feof(mi));
+
+}
+
+/*
+ * engine_init() - initialize the calling thread's context:  page sizes,
+ * NUMA topology, locked memory limit and the segment table.
+ */
+void
+engine_init(glctx_t *gcp, char *name)
+{
+	struct rlimit locked_limits;
+	int           ret;
+	
+	bzero(gcp, sizeof(glctx_t));
+
+	gcp->program_name = basename(name);
+
+	gcp->pagesize = (size_t)sysconf(_SC_PAGESIZE);
+	get_huge_pagesize(gcp);
+
+	if (numa_available() >= 0) {
+		gcp->numa_max_node = numa_max_node();
+	} else
+		gcp->numa_max_node = -1;
+
+	ret = getrlimit(RLIMIT_MEMLOCK, &locked_limits);
+	if (ret < 0) {
+		die(-1, "%s:  failed to fetch locked memory rlimit\n",
+			gcp->program_name);
+	}
+	gcp->locked_limit = locked_limits.rlim_cur;
+
+	segment_init(gcp);
+}
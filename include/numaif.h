@@ -17,6 +17,8 @@ extern long set_mempolicy(int mode, const unsigned long *nmask,
 			  unsigned long maxnode);
 extern long migratepages(int pid, unsigned long maxnode, unsigned long *fromnode,
 			unsigned long *tonode);
+extern long move_pages(int pid, unsigned long count,
+		void **pages, const int *nodes, int *status, int flags);
 
 /* Policies */
 #define MPOL_DEFAULT     0
@@ -0,0 +1,383 @@
+/*
+ * memtoy:  libmemtoy.c - C API to memtoy's segment and workload engine
+ *
+ * thin wrappers around segment.c that take plain arguments in place of
+ * command lines and return the timed operation record in place of a
+ * printed report.  See libmemtoy.h.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define migratepages migrate_pages	/* fix RHEL5 header snafu */
+#include <numaif.h>
+#include <numa.h>
+
+#include "memtoy.h"
+#include "migrate_pages.h"
+#include "libmemtoy.h"
+
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+static glctx_t lib_ctx;		/* memtoy_init()'s, for other threads */
+static bool    lib_ready;
+
+/*
+ * lib_enter() - set up the calling thread's context on its first call,
+ * and clear the last operation's result.  Returns NULL if the library
+ * hasn't been initialized.
+ */
+static glctx_t *
+lib_enter(memtoy_result_t *mrp)
+{
+	glctx_t *gcp = &glctx;
+
+	if (mrp)
+		memset(mrp, 0, sizeof(*mrp));
+
+	if (!gcp->pagesize) {
+		if (!lib_ready) {
+			fprintf(stderr, "libmemtoy:  memtoy_init() not called\n");
+			if (mrp)
+				mrp->mr_status = -1;
+			return NULL;
+		}
+		*gcp = lib_ctx;		/* shares the segment table */
+	}
+
+	gcp->result.r_op = NULL;
+	return gcp;
+}
+
+/*
+ * lib_result() - return 0 for a successful segment operation, else -1,
+ * and fill in 'mrp' from the operation's result record.
+ */
+static int
+lib_result(int ok, memtoy_result_t *mrp)
+{
+	op_result_t *rp = &glctx.result;
+	int status = ok ? 0 : -1;
+
+	if (!mrp)
+		return status;
+
+	mrp->mr_status = status;
+	if (rp->r_op) {
+		mrp->mr_op       = rp->r_op;
+		mrp->mr_usecs    = rp->r_usecs;
+		mrp->mr_pages    = rp->r_pages;
+		mrp->mr_pagesize = rp->r_pagesize;
+		mrp->mr_failed   = rp->r_failed;
+	}
+	return status;
+}
+
+/*
+ * lib_nodemask() - copy a caller's node bitmask, of 'maxnode' bits, into
+ * a nodemask_t.  Returns false if it names nodes beyond NUMA_NUM_NODES.
+ */
+static bool
+lib_nodemask(nodemask_t *nodemask, const unsigned long *bits,
+		unsigned long maxnode)
+{
+	int node;
+
+	nodemask_zero(nodemask);
+	for (node = 0; node < maxnode; ++node) {
+		if (!(bits[node / LONG_BITS] & (1UL << (node % LONG_BITS))))
+			continue;
+		if (node >= NUMA_NUM_NODES) {
+			fprintf(stderr, "%s:  node %d out of range\n",
+				glctx.program_name, node);
+			return false;
+		}
+		nodemask_set(nodemask, node);
+	}
+	return true;
+}
+
+int
+memtoy_init(const char *name, unsigned int flags)
+{
+	glctx_t *gcp = &glctx;
+
+	if (lib_ready)
+		return 0;
+
+	engine_init(gcp, (char *)(name ? name : "libmemtoy"));
+	if (!(flags & MEMTOY_REPORT))
+		set_option(QUIET);
+	if (flags & MEMTOY_VERBOSE)
+		set_option(VERBOSE);
+
+	lib_ctx   = *gcp;
+	lib_ready = true;
+	return 0;
+}
+
+int
+memtoy_anon(const char *seg, size_t length, unsigned int flags)
+{
+	range_t range = { 0L, 0L };
+
+	if (!lib_enter(NULL))
+		return -1;
+
+	range.length = length;
+	return lib_result(segment_register(SEGT_ANON, (char *)seg, &range,
+			(flags & MEMTOY_SHARED) ? MAP_SHARED : MAP_PRIVATE), NULL);
+}
+
+/*
+ * memtoy_file() - the segment is named by the last component of 'path'
+ */
+int
+memtoy_file(const char *path, off_t offset, size_t length, unsigned int flags)
+{
+	range_t range = { 0L, 0L };
+
+	if (!lib_enter(NULL))
+		return -1;
+
+	range.offset = offset;
+	range.length = length;
+	return lib_result(segment_register(SEGT_FILE, (char *)path, &range,
+			(flags & MEMTOY_SHARED) ? MAP_SHARED : MAP_PRIVATE), NULL);
+}
+
+int
+memtoy_map(const char *seg)
+{
+	if (!lib_enter(NULL))
+		return -1;
+	return lib_result(segment_map((char *)seg, NULL, 0), NULL);
+}
+
+int
+memtoy_unmap(const char *seg)
+{
+	if (!lib_enter(NULL))
+		return -1;
+	return lib_result(segment_unmap((char *)seg), NULL);
+}
+
+int
+memtoy_remove(const char *seg)
+{
+	if (!lib_enter(NULL))
+		return -1;
+	return lib_result(segment_remove((char *)seg), NULL);
+}
+
+/*
+ * memtoy_address() - start address of a mapped segment, or NULL
+ */
+void *
+memtoy_address(const char *seg, size_t *lengthp, size_t *pagesizep)
+{
+	seg_extent_t extent;
+
+	if (!lib_enter(NULL) || !segment_extent((char *)seg, &extent))
+		return NULL;
+
+	if (lengthp)
+		*lengthp = extent.se_length;
+	if (pagesizep)
+		*pagesizep = extent.se_pagesize;
+	return (void *)extent.se_start;
+}
+
+int
+memtoy_touch(const char *seg, off_t offset, size_t length, int write,
+		memtoy_result_t *mrp)
+{
+	range_t range = { 0L, 0L };
+
+	if (!lib_enter(mrp))
+		return -1;
+
+	range.offset = offset;
+	range.length = length;
+	return lib_result(segment_touch((char *)seg, &range, write != 0, 0),
+			mrp);
+}
+
+/*
+ * memtoy_mbind() - 'policy' and 'flags' as for mbind(2); with
+ * MPOL_MF_MOVE, the result times the migration.  'nr_threads' > 1
+ * splits the range and mbind()s the pieces concurrently.
+ */
+int
+memtoy_mbind(const char *seg, off_t offset, size_t length, int policy,
+		const unsigned long *nodemask, unsigned long maxnode,
+		unsigned int flags, int nr_threads, memtoy_result_t *mrp)
+{
+	range_t    range = { 0L, 0L };
+	nodemask_t nodes;
+
+	if (!lib_enter(mrp))
+		return -1;
+
+	if (nodemask && !lib_nodemask(&nodes, nodemask, maxnode))
+		return lib_result(false, mrp);
+
+	range.offset = offset;
+	range.length = length;
+	return lib_result(segment_mbind((char *)seg, &range, policy,
+			nodemask ? &nodes : NULL, flags,
+			nr_threads > 0 ? nr_threads : 1), mrp);
+}
+
+/*
+ * memtoy_where() - fill 'nodes' with the node of each page of the range,
+ * or a negative errno -- e.g., -ENOENT for pages not yet faulted in --
+ * as move_pages(2) reports it.  Returns the number of pages reported,
+ * at most 'max_pages'; -1 on error.
+ */
+long
+memtoy_where(const char *seg, off_t offset, size_t length, int *nodes,
+		unsigned long max_pages, memtoy_result_t *mrp)
+{
+	glctx_t       *gcp;
+	seg_extent_t   extent;
+	struct timeval t_start, t_end;
+	void         **pages;
+	unsigned long  nr_pages, i;
+	size_t         pagesize;
+	char          *start;
+	long           ret;
+
+	if (!(gcp = lib_enter(mrp)))
+		return -1;
+
+	if (!segment_extent((char *)seg, &extent))
+		return lib_result(false, mrp);
+	pagesize = extent.se_pagesize;
+
+	offset &= ~(off_t)(pagesize - 1);
+	if (offset >= extent.se_length) {
+		fprintf(stderr, "%s:  offset %ld is past end of segment %s\n",
+			gcp->program_name, (long)offset, seg);
+		return lib_result(false, mrp);
+	}
+	if (!length || length > extent.se_length - offset)
+		length = extent.se_length - offset;
+
+	start    = (char *)extent.se_start + offset;
+	nr_pages = (length + pagesize - 1) / pagesize;
+	if (nr_pages > max_pages)
+		nr_pages = max_pages;
+
+	pages = calloc(nr_pages ? nr_pages : 1, sizeof(*pages));
+	if (!pages) {
+		fprintf(stderr, "%s:  can't allocate %lu page addresses\n",
+			gcp->program_name, nr_pages);
+		return lib_result(false, mrp);
+	}
+	for (i = 0; i < nr_pages; ++i)
+		pages[i] = start + i * pagesize;
+
+	gettimeofday(&t_start, NULL);
+	ret = move_pages(0, nr_pages, pages, NULL, nodes, 0);
+	gettimeofday(&t_end, NULL);
+	free(pages);
+
+	if (ret < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  move_pages() query of segment %s failed "
+			"- %s\n", gcp->program_name, seg, strerror(err));
+		return lib_result(false, mrp);
+	}
+
+	result_record("where", tv_diff_usec(&t_start, &t_end), nr_pages,
+			pagesize, 0);
+	(void)lib_result(true, mrp);
+	return nr_pages;
+}
+
+/*
+ * memtoy_move_pages() - move_pages(2) the range to 'node'
+ */
+int
+memtoy_move_pages(const char *seg, off_t offset, size_t length, int node,
+		int nr_threads, memtoy_result_t *mrp)
+{
+	range_t    range = { 0L, 0L };
+	nodemask_t nodes;
+
+	if (!lib_enter(mrp))
+		return -1;
+
+	if (node < 0 || node >= NUMA_NUM_NODES) {
+		fprintf(stderr, "%s:  node %d out of range\n",
+			glctx.program_name, node);
+		return lib_result(false, mrp);
+	}
+	nodemask_zero(&nodes);
+	nodemask_set(&nodes, node);
+
+	range.offset = offset;
+	range.length = length;
+	return lib_result(segment_move_pages((char *)seg, &range, &nodes, 0,
+			MPOL_MF_MOVE, nr_threads > 0 ? nr_threads : 1), mrp);
+}
+
+/*
+ * memtoy_migrate() - migrate_pages(2) task 'pid' [0 => self] from
+ * 'from_nodes' to 'to_nodes'.  The result's mr_failed counts pages that
+ * couldn't be migrated.
+ */
+int
+memtoy_migrate(pid_t pid, const unsigned long *from_nodes,
+		const unsigned long *to_nodes, unsigned long maxnode,
+		memtoy_result_t *mrp)
+{
+	glctx_t       *gcp;
+	nodemask_t     from, to;
+	struct timeval t_start, t_end;
+	int            nr_not_migrated;
+
+	if (!(gcp = lib_enter(mrp)))
+		return -1;
+
+	if (!lib_nodemask(&from, from_nodes, maxnode) ||
+	    !lib_nodemask(&to, to_nodes, maxnode))
+		return lib_result(false, mrp);
+
+	gettimeofday(&t_start, NULL);
+	nr_not_migrated = migrate_pages(pid ? pid : getpid(), NUMA_NUM_NODES,
+					 from.n, to.n);
+	gettimeofday(&t_end, NULL);
+	if (nr_not_migrated < 0) {
+		int err = errno;
+		fprintf(stderr, "%s: migrate_pages() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return lib_result(false, mrp);
+	}
+
+	result_record("migrate_pages", tv_diff_usec(&t_start, &t_end), 0,
+			gcp->pagesize, nr_not_migrated);
+	return lib_result(true, mrp);
+}
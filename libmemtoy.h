@@ -0,0 +1,103 @@
+/*
+ * memtoy:  libmemtoy.h - memtoy's segment and workload engine as a library
+ *
+ * Programs link with libmemtoy.a [-lnuma -lpthread -lm] to create, map,
+ * place, touch and migrate memtoy segments directly:  no child process,
+ * no command parsing.  Each operation returns 0 on success or -1 on
+ * error, and fills in an optional memtoy_result_t with its timing --
+ * the same record that memtoy's 'bench' and control socket report.
+ * Errors are explained on stderr, as memtoy would.
+ *
+ * Call memtoy_init() once, before other threads use the library.  The
+ * segment table is shared by all threads and each operation locks it:
+ * operations that only use a segment -- touch, mbind, move pages --
+ * run concurrently, while create, map, unmap and remove wait for them.
+ * An address from memtoy_address() isn't covered by that lock; don't
+ * use it once another thread may unmap the segment.  Like memtoy, the
+ * library doesn't catch faults:  touching a segment with the wrong
+ * protection raises SIGSEGV.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef _LIBMEMTOY_H_
+#define _LIBMEMTOY_H_
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * result of an operation
+ */
+typedef struct memtoy_result {
+	int            mr_status;	/* 0 => success; -1 => error */
+	const char    *mr_op;		/* timed operation; NULL => none */
+	unsigned long  mr_usecs;	/* elapsed time */
+	unsigned long  mr_pages;	/* pages operated on */
+	size_t         mr_pagesize;
+	unsigned long  mr_failed;	/* e.g., pages not migrated */
+} memtoy_result_t;
+
+/*
+ * memtoy_init() flags
+ */
+#define MEMTOY_VERBOSE	0x0001	/* memtoy's -v messages */
+#define MEMTOY_REPORT	0x0002	/* print timing reports, as memtoy does */
+
+/*
+ * segment flags
+ */
+#define MEMTOY_SHARED	0x0001	/* MAP_SHARED; default private */
+
+extern int memtoy_init(const char *name, unsigned int flags);
+
+extern int memtoy_anon(const char *seg, size_t length, unsigned int flags);
+extern int memtoy_file(const char *path, off_t offset, size_t length,
+			unsigned int flags);
+extern int memtoy_map(const char *seg);
+extern int memtoy_unmap(const char *seg);
+extern int memtoy_remove(const char *seg);
+extern void *memtoy_address(const char *seg, size_t *lengthp,
+			size_t *pagesizep);
+
+/*
+ * 'offset' and 'length' select a range of the segment, as for memtoy's
+ * commands:  offset is rounded down, and length up, to the segment's page
+ * size; length 0 means to the end of the segment.
+ */
+extern int memtoy_touch(const char *seg, off_t offset, size_t length,
+			int write, memtoy_result_t *mrp);
+extern int memtoy_mbind(const char *seg, off_t offset, size_t length,
+			int policy, const unsigned long *nodemask,
+			unsigned long maxnode, unsigned int flags,
+			int nr_threads, memtoy_result_t *mrp);
+extern long memtoy_where(const char *seg, off_t offset, size_t length,
+			int *nodes, unsigned long max_pages,
+			memtoy_result_t *mrp);
+extern int memtoy_move_pages(const char *seg, off_t offset, size_t length,
+			int node, int nr_threads, memtoy_result_t *mrp);
+extern int memtoy_migrate(pid_t pid, const unsigned long *from_nodes,
+			const unsigned long *to_nodes, unsigned long maxnode,
+			memtoy_result_t *mrp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
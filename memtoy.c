@@ -36,27 +36,28 @@
 
 #include "memtoy.h"
 
-/*
- * global context
- */
-glctx_t glctx;	/* global context */
-
 /*
  * command line options:
  *
  *  -v          = verbose
+ *  -s          = report /proc/vmstat deltas around each command
+ *  -S <socket> = serve commands on Unix socket <socket>
  *  -V          = display version
  *  -h|x	= display help.
  */
-#define OPTIONS	"Vhvx"
+#define OPTIONS	"S:Vhsvx"
+
+static char *server_socket;	/* -S:  serve commands on this socket */
 
 /*
  * usage/help message
  */
 char *USAGE =
-"\nUsage:  %s [-v] [-V] [-{h|x}] [<script-file>]\n\n\
+"\nUsage:  %s [-v] [-s] [-V] [-{h|x}] [-S <socket>] [<script-file>]\n\n\
 Where:\n\
 \t-v            enable verbosity\n\
+\t-s            report /proc/vmstat deltas around each command\n\
+\t-S <socket>   serve commands to clients of Unix socket <socket>\n\
 \t-V            display version info\n\
 \t-h|x          show this usage/help message\n\
 \n\
@@ -65,39 +66,11 @@ is specified on the command line, or standard input is NOT a 'tty',\n\
 memtoy runs in batch mode.  Otherwise, it will run in interactive mode.\n\
 In batch mode, any error will cause memtoy to exit with non-zero status.\n\
 In interactive mode, use 'help' for a list of commands, and 'help <command>'\n\
-for more info about a specific command.\n\
+for more info about a specific command.  With -S, memtoy runs commands\n\
+from clients of <socket> instead; see the README.\n\
 ";
 
 
-/*
- * die() - emit error message and exit w/ specified return code.
- *	   if exit_code < 0, save current errno, and fetch associated
- *	   error string.  Print error string after app error message.
- *	   Then exit with abs(exit_code).
- */
-void
-die(int exit_code, char *format, ... )
-{
-	va_list ap;
-	char *errstr;
-	int saverrno;
-
-	va_start(ap, format);
-
-	if (exit_code < 0) {
-		saverrno = errno;
-		errstr = strerror(errno);
-	}
-
-	(void) vfprintf(stderr, format, ap);
-	va_end(ap);
-
-	if (exit_code < 0)
-		fprintf(stderr,"Error = (%d) %s\n", saverrno, errstr);
-
-	exit(abs(exit_code));
-}
-
 void
 usage(char *mesg){
 	if (mesg != NULL) {
@@ -108,427 +81,11 @@ usage(char *mesg){
 }
 
 
-#ifdef _DEBUG
-/*
- * This function is a wrapper around "fprintf(stderr, ...)" so that we
- * can use the DPRINTF(<flag>, (<[f]printf arguments>)) macro for debug
- * prints.  See the definition of DPRINTF in XXX.h
- */
-int
-_dvprintf(char *format, ...)
-{
-	va_list ap;
-	int retval;
-
-	va_start(ap, format);
-
-	retval = vfprintf(stderr, format, ap);
-
-	va_end(ap);
-
-	fflush(stderr);
-	return(retval);
-}
-#endif
-
-void
-vprint(char *format, ...)
-{
-	va_list ap;
-	glctx_t *gcp = &glctx;
-
-	va_start(ap, format);
-
-	if (!is_option(VERBOSE))
-		goto out;
-
-	(void)vfprintf(stdout, format, ap);
-	fflush(stdout);
-
-out:
-	va_end(ap);
-	return;
-
-}
-
-/*
- * =========================================================================
- */
-static int signals_to_handle[] =
-{
-	SIGINT,  SIGQUIT, SIGSEGV, SIGBUS,
-	SIGUSR1, SIGUSR2, 0
-};
-
-static char *sig_names[] =
-{
-	"INT",  "QUIT", "SEGV", "BUS",
-	"USR1", "USR2", "unknown", 0
-};
-
-char *
-sig_name(int signum)
-{
-	int isig=0, *sigp = signals_to_handle;
-
-	while(*sigp) {
-		if (*sigp == signum)
-			break;
-		++isig; ++sigp;
-	}
-
-	return sig_names[isig];
-}
-
-int
-signum_from_name(const char *sig_name)
-{
-	int isig=0;
-	char **signp = sig_names;
-
-	if (!strncasecmp(sig_name, "sig", 3))
-		sig_name += 3;
-
-	while(strcmp(*signp, "unknown")) {
-		if(!strcasecmp(sig_name, *signp))
-			return signals_to_handle[isig];
-		++isig; ++signp;
-	}
-
-	return -1;	/* no match */
-	
-}
-
-void
-signal_list(void)
-{
-	char **signp = sig_names;
-	int  icol = 0;
-
-	printf("Signals available to 'kick':");
-	while(strcmp(*signp, "unknown")) {
-		if (!icol) {
-			printf("\n    ");
-			icol += 4;
-		}
-		printf("SIG%-5s", *signp);
-		++signp; icol += 8;
-		if (icol > MAXCOL - 8)
-			icol = 0;
-	}
-
-	printf("\n");
-}
-
-/*
- * signal_handler()
- *
- * save siginfo and name in global context
- */
-void
-signal_handler(int sig, siginfo_t *info, void *vcontext)
-{
-	glctx_t *gcp = &glctx;
-	static siginfo_t infocopy;
-
-	/*
-	 * static copy of signal info.
-	 * Note, additional signals, before use, can overwrite
-	 */
-	infocopy = *info;
-	gcp->siginfo   = &infocopy;
-
-	gcp->signame   = sig_name(sig);
-
-	vprint("signal hander entered for sig SIG%s\n", gcp->signame);
-
-	switch (sig) {
-	case SIGSEGV:
-	case SIGBUS:
-		if (gcp->sigjmp) {
-			gcp->sigjmp = false;
-			siglongjmp(gcp->sigjmp_env, 1);
-		}
-
-		die(8, "\n%s:  signal SIG%s, but handler not armed\n",
-		       gcp->program_name, gcp->signame);
-		break;
-
-	case SIGINT:
-	case SIGQUIT:
-		break;
-
-	default:
-		die(8, "\n%s:  Unexpected signal:  %d\n",
-		        gcp->program_name, sig);
-		break;
-	}
-}
-/*
- * sigcld_handler()
- *
- * reap child and free child_t
- */
-void
-sigcld_handler(int sig, siginfo_t *info, void *vcontext)
-{
-	glctx_t *gcp = &glctx;
-	pid_t cpid;
-	int   cstatus, err;
-
-	cpid = wait3(&cstatus, WNOHANG, NULL);
-
-	if (cpid > 0 ) {
-		child_reap(cpid, cstatus);
-		return;
-	}
-	
-	err = errno;
-	vprint("%s:  In %s, wait3() failed - %s\n", 
-		gcp->program_name, __FUNCTION__, strerror(err));
-	
-}
-
-/*
- * set_signals()
- *
- * Setup signal dispositions to catch selected signals
- */
-void
-set_signals()
-{
-	glctx_t *gcp = &glctx;
-	int *sigp = signals_to_handle;
-	char **namep = sig_names;
-	
-	struct sigaction act = {
-		.sa_sigaction = signal_handler,
-		.sa_flags	 = SA_SIGINFO
-	};
-
-	(void)sigfillset(&(act.sa_mask));
-
-	while (*sigp) {
-		char *sig_name = *(namep++);
-		int sig = *(sigp++);
-
-
-		if (0 != sigaction(sig, &act, NULL)) {
-			die(-1, "%s: Failed to set sigaction for %s\n",
-			        gcp->program_name, sig_name);
-		} else
-#if 0
-			vprint("%s: established handler for %s\n",
-			        gcp->program_name, sig_name)
-#endif
-			;
-	}
-
-	/*
-	 * special SIGCLD handler for deceased children
-	 */
-	act.sa_sigaction = sigcld_handler;
-	if (0 != sigaction(SIGCLD, &act, NULL)) {
-		die(-1, "%s: Failed to set sigaction for SIGCLD\n",
-		        gcp->program_name);
-	}
-
-		return;
-}
-
-void
-reset_signal(void)
-{
-//TODO:  free siginfo if/when malloc'd
-	glctx.siginfo = NULL;
-	glctx.sigjmp  = false;
-}
-
-void
-wait_for_signal(const char *mesg)
-{
-	printf("%s ... ", mesg); fflush(stdout);
-	pause();
-	vprint("%s: wakened by signal SIG%s\n", __FUNCTION__, glctx.signame);
-	reset_signal();
-	printf("\n"); fflush(stdout);
-}
-
-void
-show_siginfo()
-{
-	glctx_t *gcp = &glctx;
-	siginfo_t *info = gcp->siginfo;
-	void *badaddr = info->si_addr;
-	char *sigcode;
-
-	switch (info->si_signo) {
-	case SIGSEGV:
-		switch (info->si_code) {
-		case SEGV_MAPERR:
-			sigcode = "address not mapped";
-			break;
-
-		case SEGV_ACCERR:
-			sigcode = "invalid access error";
-			break;
-
-		default:
-			sigcode = "unknown";
-			break;
-		}
-		break;
-
-	case SIGBUS:
-		switch (info->si_code) {
-		case BUS_ADRALN:
-			sigcode = "invalid address alignment";
-			break;
-
-		case BUS_ADRERR:
-			sigcode = "non-existent physical address";
-			break;
-
-		default:
-			sigcode = "unknown";
-			break;
-		}
-		break;
-
-	default:
-		/*
-		 * ignore SIGINT/SIGQUIT
-		 */
-		return;
-	}
-
-	printf("Signal SIG%s @ 0x%lx - %s\n", gcp->signame, badaddr, sigcode);
-
-}
-
-/*
- * =========================================================================
- */
-
-void
-touch_memory(bool rw, unsigned long *memp, size_t memlen, size_t pagesize)
-{
-	glctx_t *gcp = &glctx;
-
-	unsigned long  *memend, *pp, sink;
-	unsigned long longs_in_page = pagesize / sizeof (unsigned long);
-
-	memend = memp + memlen/sizeof(unsigned long);
-	vprint("!!!%s from 0x%lx thru 0x%lx\n",
-		rw ? "Writing" : "Reading", memp, memend);
-
-	for(pp = memp; pp < memend;  pp += longs_in_page) {
-		// vprint("%s:  touching 0x%lx\n", __FUNCTION__, pp);
-		if (!sigsetjmp(gcp->sigjmp_env, true)) {
-			gcp->sigjmp = true;
-
-			/*
-			 *  Mah-ahm!  He's touching me!
-			 */
-			if (rw)
-				*pp = (unsigned long)pp;
-			else
-				sink = *pp;
-
-			gcp->sigjmp = false;
-		} else {
-			show_siginfo();
-			reset_signal();
-			break;
-		}
-
-		/*
-		 * Any [handled] signal breaks the loop
-		 */
-		if(gcp->siginfo != NULL) {
-			reset_signal();
-			break;
-		}
-	}
-}
-
-/*
- * =========================================================================
- */
-
-/*
- * TODO:  a better way?
- */
-#define MIBUFSIZE 64
-void
-get_huge_pagesize(glctx_t *gcp)
-{
-	FILE *mi;
-
-	mi = fopen("/proc/meminfo", "r");
-	if (!mi) {
-		die(-1, "%s:  failed to open /proc/meminfo\n",
-			gcp->program_name);
-	}
-
-	do {
-		char buf[MIBUFSIZE], *input;
-		char *next;
-		size_t huge_pagesize;
-
-		input = fgets(buf, MIBUFSIZE, mi);
-		if (!input)
-			continue;	/* probably EOF */
-
-		if (strncmp(input, "Hugepagesize:", strlen("Hugepagesize:")))
-			continue;
-
-		input += strlen("Hugepagesize:");
-		input += strspn(input, whitespace);
-
-		huge_pagesize = strtoul(input, &next, 0);
-		if (*next != ' ') {
-			die(-1, "%s:  bogus huge pagesize %s\n", 
-				gcp->program_name, input);
-		}
-
-		input = next + strspn(next, whitespace);
-		if (!strncmp(input, "kB", strlen("kB")))
-			huge_pagesize <<= KILO_SHIFT;
-
-		gcp->huge_pagesize = huge_pagesize;
-
-	} while (!feof(mi));
-
-}
-
 void
 init_glctx(glctx_t *gcp, char *arg0)
 {
-	struct rlimit locked_limits;
-	int           ret;
-	
-	bzero(gcp, sizeof(glctx_t));
-
-	gcp->program_name = basename(arg0);
-
-	gcp->pagesize = (size_t)sysconf(_SC_PAGESIZE);
-	get_huge_pagesize(gcp);
-
-	if (numa_available() >= 0) {
-		gcp->numa_max_node = numa_max_node();
-	} else
-		gcp->numa_max_node = -1;
-
-	ret = getrlimit(RLIMIT_MEMLOCK, &locked_limits);
-	if (ret < 0) {
-		die(-1, "%s:  failed to fetch locked memory rlimit\n",
-			gcp->program_name);
-	}
-	gcp->locked_limit = locked_limits.rlim_cur;
-
+	engine_init(gcp, arg0);
 	commands_init(gcp);
-	segment_init(gcp);
 
 	INIT_LIST_HEAD(&gcp->children);
 
@@ -547,6 +104,8 @@ cleanup()
 
 	children_cleanup();
 	segment_cleanup(gcp);
+	server_cleanup();
+	cgroup_cleanup();
 } /* cleanup() */
 
 /*
@@ -600,6 +159,14 @@ parse_command_line_args(int argc, char *argv[])
 			set_option(VERBOSE);
 			break;
 
+		case 's':
+			set_option(VMSTAT);
+			break;
+
+		case 'S':
+			server_socket = optarg;
+			break;
+
 		case 'h':
 		case 'x':
 			usage(NULL);
@@ -631,6 +198,11 @@ parse_command_line_args(int argc, char *argv[])
 	}
 
 	if (!error && optind < argc) {
+		if (server_socket) {
+			fprintf(stderr, "%s:  -S takes commands from clients, "
+				"not a script\n", gcp->program_name);
+			return 1;
+		}
 		error = open_script_file(argv[optind++]);
 		// TODO:  warn about ignoring extraneous args?
 	}
@@ -678,6 +250,8 @@ main(int argc, char *argv[])
 
 	set_signals();
 
+	if (server_socket)
+		serve_commands(server_socket);
 	process_commands();
 
 	exit(0);
@@ -27,6 +27,7 @@
 
 #include <numa.h>
 #include <numaif.h>
+#include <pthread.h>
 #include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
@@ -41,8 +42,35 @@
 #define MAXCOL 80	/* arbitrary display line max */
 #define KILO_SHIFT 10	/* shift count to multiply by 1K */
 
+#define PM_PRESENT  (1ULL << 63)	/* /proc/<pid>/pagemap entry bits */
+#define PM_SWAPPED  (1ULL << 62)
+#define PM_PFN_MASK ((1ULL << 55) - 1)
+
 typedef enum {false=0, true} bool;
 
+/*
+ * command status
+ */
+#define CMD_SUCCESS 0
+#define CMD_ERROR   1
+
+/*
+ * child command result -- sent to the parent in place of a bare "OK"
+ * after each command.  See child_respond().
+ */
+typedef struct child_result {
+	char           cr_cmd[16];      /* command name; "" => none */
+	int            cr_status;       /* CMD_SUCCESS or CMD_ERROR */
+	unsigned long  cr_usecs;        /* wall time */
+	unsigned long  cr_cpu_usecs;    /* user + system time */
+	unsigned long  cr_pages;        /* pages operated on, if recorded */
+	unsigned long  cr_faults;       /* minor + major page faults */
+	unsigned long  cr_majflt;       /*   major faults */
+	unsigned long  cr_start;        /* broadcast:  usecs release -> start */
+	unsigned long  cr_done;         /* broadcast:  usecs release -> done */
+	bool           cr_filled;       /* private to child */
+} child_result_t;
+
 /*
  * memtoy child process
  */
@@ -53,9 +81,54 @@ typedef struct child_toy {
 	int              c_cfd;     /* write commands on this fd */
 	int              c_rfd;     /* read response on this fd */
 	int              c_errs;    /* count of send errors */
-	
+	bool             c_busy;    /* command sent w/ '&' not yet acked */
+	struct list_head c_extents; /* segment extents looked up in child */
+	bool             c_thread;  /* a 'thread' in memtoy's own mm */
+	pthread_t        c_tid;     /*   its pthread id */
+	int              c_tcfd;    /*   its ends of the pipes, which */
+	int              c_trfd;    /*   forked children must close */
+	bool             c_exited;  /*   quit; waiting to be joined */
+	bool             c_bcast;   /* in broadcast not yet summarized */
+	child_result_t   c_result;  /* result of most recent command */
 } child_t;
 
+/*
+ * child segment extent, remembered for use while the child is busy
+ */
+typedef struct child_extent {
+	struct list_head ce_link;
+	char            *ce_seg;
+	seg_extent_t     ce_extent;
+} child_extent_t;
+
+/*
+ * pinned worker thread -- see workers.c
+ */
+struct worker;
+typedef int (*worker_func_t)(struct worker *);
+
+typedef struct worker {
+	int            w_id;        /* 0 .. nr_workers-1 */
+	int            w_cpu;       /* pinned to this cpu; -1 => not pinned */
+	pthread_t      w_thread;
+	void          *w_arg;       /* caller's per worker argument */
+	int            w_ret;       /* worker function return value */
+	unsigned long  w_usecs;     /* worker function elapsed time */
+	void          *w_run;       /* private to workers.c */
+} worker_t;
+
+/*
+ * result of most recent timed operation -- touch, migration, ...
+ * for commands that compare or aggregate timings.  See result_record().
+ */
+typedef struct op_result {
+	char          *r_op;        /* operation name */
+	unsigned long  r_usecs;     /* elapsed time */
+	unsigned long  r_pages;     /* pages operated on */
+	size_t         r_pagesize;
+	unsigned long  r_failed;    /* e.g., pages not migrated */
+} op_result_t;
+
 /*
  * program global data
  */
@@ -68,6 +141,9 @@ typedef struct global_context {
 	char          *signame;          /* name of signal, if any */
 	sigjmp_buf     sigjmp_env;       /* embedded setjmp buffer */
 	bool           sigjmp;           /* sigsetjmp is "armed" */
+	bool           interrupted;      /* SIGINT since the top level command
+					  * started; reset_signal() leaves it
+					  * for loops like 'repeat' to see */
 
 	size_t         pagesize;         /* system page size for mmap, ... */
 	size_t         huge_pagesize;    /* hugetlb page size ... */
@@ -79,25 +155,37 @@ typedef struct global_context {
 	int            numa_max_node;    /* if >0, numa supported */
 
 	unsigned long  locked_limit;     /* rlimit on locked memory */
-	unsigned long  locked_mem;       /* mem locked so far */
+	unsigned long  locked_mem;       /* mem locked, per segments' ranges */
 
 	segment_t    **seglist;          /* list of known segments */
 	segment_t     *seg_avail;        /* an available segment */
 
 	struct list_head children;
 
+	op_result_t    result;           /* last timed operation */
+
 	char          *cmd_name;         /* currently executing command */
 	char          *child_name;
 	int            response_fd;      /* ack parent */
+	child_result_t *child_result;    /* current command's, for parent */
+	FILE          *cmd_input;        /* command stream; NULL => stdin */
+	bool           cmd_thread;       /* a 'thread' [vs child process] */
 
 #ifdef _DEBUG
 	unsigned long  debug;            /* debug enablement flags */
 #endif
 } glctx_t;
 
-extern glctx_t glctx;
+/*
+ * each thread -- 'thread' command threads and workers -- has its own
+ * context, copied from its creator's.  The segment table is shared.
+ */
+extern __thread glctx_t glctx;
 
 #define OPTION_VERBOSE 0x0001
+#define OPTION_QUIET 0x0002		/* suppress timing reports */
+#define OPTION_VMSTAT 0x0004		/* report /proc/vmstat deltas */
+#define OPTION_PSI 0x0008		/* report memory pressure deltas */
 #define OPTION_INTERACTIVE 0x0100
 
 /*
@@ -121,26 +209,77 @@ static unsigned long tv_diff_usec(struct timeval *stp, struct timeval *etp)
 }
 
 /*
- * memtoy.c
+ * engine.c
  */
+extern void engine_init(glctx_t*, char*);
 extern void die(int, char*, ... );
 extern void vprint(char*, ...);
+extern void set_signals(void);
 extern void reset_signal(void);
 extern void wait_for_signal(const char*);
+extern void show_siginfo(void);
 extern char *sig_name(int);
 extern int signum_from_name(const char *);
 extern void signal_list(void);
+extern void result_record(char*, unsigned long, unsigned long, size_t,
+				unsigned long);
+extern int touch_memory(bool, unsigned long*, size_t,  size_t);
+extern double chase_latency(char*, size_t);
+extern double stream_bandwidth(unsigned long*, size_t);
+extern void fill_page(char*, size_t, double, unsigned long);
+extern long ksm_merging_pages(void);
+extern long pagemap_walk(char*, unsigned long, size_t,
+				int (*)(unsigned long long, void*), void*);
+extern long ksm_pages(char*, unsigned long, size_t);
+
+extern char *whitespace;
 
 /*
  * commands.c
  */
 extern void process_commands(void);
-extern void wait_for_signal(const char *);
-extern void touch_memory(bool, unsigned long*, size_t,  size_t);
-extern void child_reap(pid_t, int);
 extern void children_cleanup(void);
 extern void commands_init(glctx_t*);
+extern int command_run(char*, child_result_t*);
 
-extern char *whitespace;
+/*
+ * workers.c
+ */
+extern long workers_run(worker_t*, int, worker_func_t);
+extern void workers_show_times(worker_t*, int);
+
+/*
+ * stats.c
+ */
+extern void stats_begin(void);
+extern void stats_end(void);
+extern int stats_read_values(char*, char**, unsigned long*);
+extern int stats_psi_check(void);
+extern int stats_psi_trigger(char*, char*, unsigned long, unsigned long);
+extern void stats_psi_trigger_off(void);
+extern void stats_psi_show(void);
+extern void stats_fini(void);
+
+/*
+ * cgroup.c
+ */
+extern int cgroup_create(char*);
+extern int cgroup_set(char*, char*, char*);
+extern int cgroup_move(char*, pid_t);
+extern int cgroup_remove(char*);
+extern int cgroup_show(char*);
+extern int cgroup_watch(char*);
+extern char *cgroup_watched(char**);
+extern char *cgroup_current(char**);
+extern int cgroup_file(char*, char*, char*, size_t);
+extern void cgroup_fini(void);
+extern void cgroup_cleanup(void);
+
+/*
+ * server.c
+ */
+extern void serve_commands(char*);
+extern void server_fini(void);
+extern void server_cleanup(void);
 
 #endif
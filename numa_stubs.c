@@ -184,6 +184,12 @@ int numa_node_to_cpus(int node, unsigned long *buffer, int buffer_len)
 	return 1;
 }
 
+/* SLIT distance between nodes; 0 => unknown */
+int numa_distance(int node1, int node2)
+{
+	return 0;
+}
+
 /* Error handling. */
 /* This is an internal function in libnuma that can be overwritten by an user
    program. Default is to print an error to stderr and exit if numa_exit_on_error
@@ -219,3 +225,10 @@ long set_mempolicy(int mode, unsigned long *nmask,
 {
 	return 0;
 }
+
+long move_pages(int pid, unsigned long count,
+		void **pages, const int *nodes, int *status, int flags)
+{
+	errno = ENOSYS;
+	return -1;
+}
@@ -30,12 +30,15 @@
 #include <sys/mman.h>
 #include <sys/shm.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -44,6 +47,7 @@
 
 #include "memtoy.h"
 #include "segment.h"
+#include "migrate_pages.h"
 
 struct segment {
 	char         *seg_name;
@@ -62,8 +66,24 @@ struct segment {
 	int           seg_fd;           /* saved file descriptor */
 	int           seg_shmid;
 
+	struct lock_range *seg_locked;  /* mlock()ed ranges, by offset */
+	bool          seg_mergeable;    /* some range MADV_MERGEABLE */
 };
 
+/*
+ * locked ranges of a segment:  sorted, non-overlapping -- adjacent
+ * ranges differ in 'lr_onfault'.  munlock() succeeds on unlocked pages,
+ * so we track what we've locked to report it.
+ */
+struct lock_range {
+	struct lock_range *lr_next;
+	off_t              lr_start;
+	off_t              lr_end;		/* exclusive */
+	bool               lr_onfault;	/* MLOCK_ONFAULT */
+};
+
+static int lockall_flags;	/* mlockall(MCL_FUTURE[|MCL_ONFAULT]) */
+
 #define MAX_SEGMENTS 63   /* arbitrary max */
 #define SEG_FD_NONE (-1)
 #define SHM_ID_NONE (-1)
@@ -73,6 +93,15 @@ struct segment {
 
 #define SEG_OFFSET(SEGP, ADDR) ((char *)(ADDR) - (char *)(SEGP->seg_start))
 
+/*
+ * 'thread' command threads share the segment table.  The segment_*()
+ * API functions hold segtable_lock while they use the table and the
+ * segments they look up:  for reading to operate on a segment's memory,
+ * for writing to add, remove, map or otherwise change table entries.
+ * The static helpers expect it held.
+ */
+static pthread_rwlock_t segtable_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 
 /*
  * =========================================================================
@@ -99,13 +128,12 @@ get_seg_slot(void)
 	segment_t *segp, **segpp;
 
 	/*
-	 * consume saved slot, if any
+	 * consume saved slot, if any -- and if another thread hasn't
 	 */
 	segp = gcp->seg_avail;
-	if (segp != NULL) {
-		gcp->seg_avail = NULL;
+	gcp->seg_avail = NULL;
+	if (segp != NULL && segp->seg_type == SEGT_NONE)
 		return segp;
-	}
 	
 	/*
 	 * simple linear scan for first available slot
@@ -128,6 +156,148 @@ get_seg_slot(void)
 	return (segment_t *)NULL;
 }
 
+/*
+ * locked_clear() - forget all of a segment's locked ranges
+ */
+static void
+locked_clear(segment_t *segp)
+{
+	struct lock_range *lrp, *next;
+
+	for (lrp = segp->seg_locked; lrp; lrp = next) {
+		next = lrp->lr_next;
+		free(lrp);
+	}
+	segp->seg_locked = NULL;
+}
+
+/*
+ * locked_update() - note that [start, end) of a segment has been locked
+ * [onfault or not] or, for !lock, unlocked.  Locking a range overrides
+ * any previous lock of it, as for the vma flags.
+ * returns SEG_ERR if we can't allocate a range.
+ */
+static int
+locked_update(segment_t *segp, off_t start, off_t end, bool lock,
+		bool onfault)
+{
+	struct lock_range *lrp, *new, **lrpp;
+
+	/*
+	 * carve [start, end) out of the existing ranges
+	 */
+	for (lrpp = &segp->seg_locked; (lrp = *lrpp); ) {
+		if (lrp->lr_end <= start || lrp->lr_start >= end) {
+			lrpp = &lrp->lr_next;
+			continue;
+		}
+		if (lrp->lr_start < start && lrp->lr_end > end) {
+			/*
+			 * split
+			 */
+			new = malloc(sizeof(*new));
+			if (!new)
+				goto nomem;
+			*new = *lrp;
+			new->lr_start = end;
+			lrp->lr_end   = start;
+			lrp->lr_next  = new;
+			break;
+		}
+		if (lrp->lr_start < start) {
+			lrp->lr_end = start;
+			lrpp = &lrp->lr_next;
+		} else if (lrp->lr_end > end) {
+			lrp->lr_start = end;
+			lrpp = &lrp->lr_next;
+		} else {
+			*lrpp = lrp->lr_next;
+			free(lrp);
+		}
+	}
+
+	if (!lock)
+		return SEG_OK;
+
+	new = malloc(sizeof(*new));
+	if (!new)
+		goto nomem;
+	new->lr_start   = start;
+	new->lr_end     = end;
+	new->lr_onfault = onfault;
+
+	for (lrpp = &segp->seg_locked; (lrp = *lrpp); lrpp = &lrp->lr_next)
+		if (lrp->lr_start >= end)
+			break;
+	new->lr_next = lrp;
+	*lrpp = new;
+
+	/*
+	 * coalesce neighbors locked the same way
+	 */
+	for (lrp = segp->seg_locked; lrp && lrp->lr_next; ) {
+		struct lock_range *next = lrp->lr_next;
+
+		if (lrp->lr_end == next->lr_start &&
+		    lrp->lr_onfault == next->lr_onfault) {
+			lrp->lr_end  = next->lr_end;
+			lrp->lr_next = next->lr_next;
+			free(next);
+		} else
+			lrp = next;
+	}
+	return SEG_OK;
+
+nomem:
+	fprintf(stderr, "%s:  can't allocate locked range for segment %s\n",
+		glctx.program_name, segp->seg_name);
+	return SEG_ERR;
+}
+
+/*
+ * locked_bytes() - bytes of a segment we've locked; optionally those
+ * locked on fault.
+ */
+static size_t
+locked_bytes(segment_t *segp, size_t *onfaultp)
+{
+	struct lock_range *lrp;
+	size_t             bytes = 0, onfault = 0;
+
+	for (lrp = segp->seg_locked; lrp; lrp = lrp->lr_next) {
+		bytes += lrp->lr_end - lrp->lr_start;
+		if (lrp->lr_onfault)
+			onfault += lrp->lr_end - lrp->lr_start;
+	}
+	if (onfaultp)
+		*onfaultp = onfault;
+	return bytes;
+}
+
+/*
+ * locked_total() - bytes locked over the user's segments; update context.
+ * Segments from maps are hidden by 'show' and aren't counted.
+ */
+static size_t
+locked_total(size_t *onfaultp)
+{
+	glctx_t   *gcp = &glctx;
+	segment_t *segp, **segpp;
+	size_t     bytes = 0, onfault = 0, seg_onfault;
+
+	for (segpp = gcp->seglist; segpp && (segp = *segpp); ++segpp) {
+		if (segp->seg_type == SEGT_NONE ||
+		    segp->seg_flags & SEGF_MAPS)
+			continue;
+		bytes   += locked_bytes(segp, &seg_onfault);
+		onfault += seg_onfault;
+	}
+	gcp->locked_mem = bytes;
+	if (onfaultp)
+		*onfaultp = onfault;
+	return bytes;
+}
+
 /*
  * common to segment_unmap() and segment_remove()
  */
@@ -163,6 +333,8 @@ unmap_segment(segment_t *segp)
 	}
 
 	segp->seg_start = MAP_FAILED;
+	segp->seg_mergeable = false;
+	locked_clear(segp);
 }
 
 /*
@@ -190,6 +362,7 @@ free_seg_slot(segment_t *segp)
 	    segp->seg_shmid != SHM_ID_NONE)
 		shmctl(segp->seg_shmid, IPC_RMID, NULL);
 
+	locked_clear(segp);
 	(void)memset(segp, 0, sizeof(*segp));
 
 	segp->seg_slot = slot;
@@ -211,12 +384,14 @@ segment_cleanup(struct global_context *gcp)
 	if (segpp == NULL)
 		return;
 
+	pthread_rwlock_wrlock(&segtable_lock);
 	for (; segp = *segpp; ++segpp) {
 		if (segp->seg_type != SEGT_SHM) {
 			continue;
 		}
 		free_seg_slot(segp);	/* to remove shared mem */
 	}
+	pthread_rwlock_unlock(&segtable_lock);
 }
 
 static size_t
@@ -515,10 +690,10 @@ map_shm_segment(segment_t *segp)
  * segment API
  */
 /*
- * segment_get(name) - lookup named segment
-TODO:  move to segment private functions?
+ * segment_get(name) - lookup named segment.  Caller holds segtable_lock;
+ * get_seg_slot() allocates new slots.
  */
-segment_t *
+static segment_t *
 segment_get(char *name)
 {
 	glctx_t   *gcp = &glctx;
@@ -534,30 +709,18 @@ segment_get(char *name)
 			return segp;
 	}
 
-	if (gcp->seg_avail == NULL &&
-		segpp < &gcp->seglist[MAX_SEGMENTS]) {
-		/*
-		 * prealloc an available segment
-		 */
-		*segpp = segp = new_segment();
-		if (segp != NULL) {
-			segp->seg_slot = segpp - gcp->seglist;
-			gcp->seg_avail = segp;
-		}
-	}
-
 	return (segment_t *)NULL;
 }
 
 /*
- * segment_register:  register an anon, file or shm segment based on args.
+ * register_segment:  register an anon, file or shm segment based on args.
  *	for anon and shm, 'name' = segment name.
  *	for file, 'name' = path name; segment name = basename(path)
  *
  * returns: !0 on success; 0 on failure
  */
-int
-segment_register(seg_type_t type, char *name, range_t *range, int flags)
+static int
+register_segment(seg_type_t type, char *name, range_t *range, int flags)
 {
 	glctx_t   *gcp = &glctx;
 	segment_t *segp;
@@ -676,17 +839,76 @@ show_one_segment(segment_t *segp, bool header)
 			segp->seg_offset,
 			protection, share, name );
 	}
+
+	if (segp->seg_locked) {
+		size_t onfault, bytes = locked_bytes(segp, &onfault);
+
+		printf("  %18s 0x%012lx locked", "", bytes);
+		if (onfault)
+			printf(" [0x%lx on fault]", onfault);
+		printf("\n");
+	}
+	if (segp->seg_mergeable)
+		printf("  %18s KSM mergeable\n", "");
 	
 	return SEG_OK;
 }
 
+/*
+ * vmlck_kbytes() - the kernel's count of our locked memory, or -1
+ */
+static long
+vmlck_kbytes(void)
+{
+	FILE *fp;
+	char  line[128];
+	long  kbytes = -1;
+
+	fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "VmLck: %ld", &kbytes) == 1)
+			break;
+	fclose(fp);
+	return kbytes;
+}
+
+/*
+ * show_locked() - summarize locked memory against RLIMIT_MEMLOCK
+ */
+static void
+show_locked(void)
+{
+	glctx_t *gcp = &glctx;
+	size_t   onfault, bytes = locked_total(&onfault);
+	long     vmlck = vmlck_kbytes();
+
+	if (!bytes && vmlck <= 0 && !lockall_flags)
+		return;
+
+	printf("\n  locked:  %lu bytes", bytes);
+	if (onfault)
+		printf(" [%lu on fault]", onfault);
+	if (gcp->locked_limit == RLIM_INFINITY)
+		printf(" of unlimited");
+	else
+		printf(" of %lu", gcp->locked_limit);
+	if (vmlck >= 0)
+		printf(";  VmLck %ld kB", vmlck);
+	if (lockall_flags)
+		printf(";  mlockall(future%s)",
+			(lockall_flags & MCL_ONFAULT) ? "|onfault" : "");
+	printf("\n");
+}
+
 /*
  * segment_show() -- show specifed segment, or all, if none specified.
  *
  * if name == '+', show the segments from task's maps
  */
-int
-segment_show(char *name)
+static int
+show_segments(char *name)
 {
 	glctx_t   *gcp = &glctx;
 	segment_t *segp, **segpp;
@@ -720,16 +942,39 @@ segment_show(char *name)
 		show_one_segment(segp, header);
 		header = false;		/* first time only */
 	}
+	show_locked();
 
 	return SEG_OK;
 
 }
 
+int
+segment_show(char *name)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = show_segments(name);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+int
+segment_register(seg_type_t type, char *name, range_t *range, int flags)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = register_segment(type, name, range, flags);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
 /*
- * segment_remove() - remove the specified segment, if exists.
+ * remove_segment() - remove the specified segment, if exists.
  */
-int
-segment_remove(char *name)
+static int
+remove_segment(char *name)
 {
 	glctx_t   *gcp = &glctx;
 	segment_t *segp;
@@ -754,14 +999,29 @@ segment_remove(char *name)
 	return SEG_OK;
 }
 
+int
+segment_remove(char *name)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = remove_segment(name);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
 /*
  * segment_touch() - "touch" [read or write] each page of specified range 
  *                   -- from offset to offset+length -- to fault in or to
  *                   test protection.
+ *                   If 'seconds' != 0, keep making passes over the range
+ *                   for that long and report per pass times:  a timed
+ *                   workload to run while something else -- e.g., a
+ *                   migration -- happens to the segment.
  * NOTE:  offset is relative to start of mapping, not start of file!
  */
-int
-segment_touch(char *name, range_t *range, int rw)
+static int
+touch_segment(char *name, range_t *range, int rw, unsigned int seconds)
 {
 	glctx_t       *gcp = &glctx;
 	segment_t     *segp;
@@ -769,6 +1029,8 @@ segment_touch(char *name, range_t *range, int rw)
 	size_t         length, maxlength;
 	unsigned long *memp;
 	struct timeval t_start, t_end;
+	unsigned long  pass_usecs, min_usecs = 0, max_usecs = 0, usecs = 0;
+	unsigned long  nr_passes = 0;
 
 	segp = segment_get(name);
 	if (segp == NULL) {
@@ -803,25 +1065,110 @@ segment_touch(char *name, range_t *range, int rw)
 	if(length == 0 || length > maxlength)
 		length = maxlength;
 
-	gettimeofday(&t_start, NULL);
-	touch_memory(rw, memp, length, segp->seg_pagesize);
-	gettimeofday(&t_end, NULL);
-	printf("%s:  touched %d %spages in %6.3f secs\n",
-		gcp->program_name, length/segp->seg_pagesize,
-		segp->seg_pagesize == gcp->huge_pagesize ?
-			"huge " : "",
-		(float)(tv_diff_usec(&t_start, &t_end))/1000000.0);
-	
+	if (!seconds) {
+		long merged = -1;
+
+		if (rw && segp->seg_mergeable)
+			merged = ksm_pages((char *)memp,
+					length/segp->seg_pagesize,
+					segp->seg_pagesize);
+
+		gettimeofday(&t_start, NULL);
+		touch_memory(rw, memp, length, segp->seg_pagesize);
+		gettimeofday(&t_end, NULL);
+		usecs = tv_diff_usec(&t_start, &t_end);
+		result_record("touch", usecs, length/segp->seg_pagesize,
+				segp->seg_pagesize, 0);
+
+		if (merged > 0) {
+			long left = ksm_pages((char *)memp,
+					length/segp->seg_pagesize,
+					segp->seg_pagesize);
+
+			if (left < 0) {
+				int err = errno;
+				fprintf(stderr, "%s:  can't count KSM pages "
+					"left after touch - %s\n",
+					gcp->program_name, strerror(err));
+				merged = -1;
+			} else
+				merged -= left;
+		}
+
+		if (!is_option(QUIET)) {
+			printf("%s:  touched %d %spages in %6.3f secs\n",
+				gcp->program_name, length/segp->seg_pagesize,
+				segp->seg_pagesize == gcp->huge_pagesize ?
+					"huge " : "",
+				(float)usecs/1000000.0);
+			/*
+			 * writes to KSM pages break COW:  charge the whole
+			 * pass to them -- an upper bound.
+			 */
+			if (merged > 0)
+				printf("    %ld KSM pages unmerged by COW, "
+					"<= %.2f usecs each\n", merged,
+					(double)usecs / merged);
+		}
+		return SEG_OK;
+	}
+
+	/*
+	 * timed workload:  repeat passes until time's up or interrupted.
+	 */
+	do {
+		int interrupted;
+
+		gettimeofday(&t_start, NULL);
+		interrupted = touch_memory(rw, memp, length,
+						segp->seg_pagesize);
+		gettimeofday(&t_end, NULL);
+		if (interrupted)
+			break;
+
+		pass_usecs = tv_diff_usec(&t_start, &t_end);
+		if (!nr_passes || pass_usecs < min_usecs)
+			min_usecs = pass_usecs;
+		if (pass_usecs > max_usecs)
+			max_usecs = pass_usecs;
+		usecs += pass_usecs;
+		++nr_passes;
+	} while (usecs < seconds * 1000000UL);
+
+	result_record("touch", usecs, nr_passes * (length/segp->seg_pagesize),
+			segp->seg_pagesize, 0);
+
+	if (!is_option(QUIET) && nr_passes)
+		printf("%s:  touched %lu %spages %lu times in %6.3f secs\n"
+			"    per pass:  min %6.3f  avg %6.3f  max %6.3f secs\n",
+			gcp->program_name, length/segp->seg_pagesize,
+			segp->seg_pagesize == gcp->huge_pagesize ?
+				"huge " : "", nr_passes,
+			(float)usecs/1000000.0, (float)min_usecs/1000000.0,
+			(float)usecs/nr_passes/1000000.0,
+			(float)max_usecs/1000000.0);
+
 	return SEG_OK;
 }
 
+int
+segment_touch(char *name, range_t *range, int rw, unsigned int seconds)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = touch_segment(name, range, rw, seconds);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
 /*
  * segment_unmap() -  unmap the specified segment, if any, from seg_start
  *                    to seg_start+seg_lenth.  Leave the segment in the 
  *                    table;
  */
-int
-segment_unmap(char *name)
+static int
+unmap_named_segment(char *name)
 {
 	glctx_t   *gcp = &glctx;
 	segment_t *segp;
@@ -844,16 +1191,28 @@ segment_unmap(char *name)
 	return SEG_OK;
 }
 
+int
+segment_unmap(char *name)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = unmap_named_segment(name);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
 /*
  * segment_map() -- [re] map() a previously unmapped segment
  *                  no-op if already mapped.
  *                  range only applies to mapped file.
  */
-int
-segment_map(char *name, range_t *range, int flags)
+static int
+map_segment(char *name, range_t *range, int flags)
 {
 	glctx_t       *gcp = &glctx;
 	segment_t     *segp;
+	int            ret = SEG_ERR;
 
 	segp = segment_get(name);
 	if (segp == NULL) {
@@ -872,7 +1231,7 @@ segment_map(char *name, range_t *range, int flags)
 	case SEGT_ANON:
 		if (flags != 0)
 			segp->seg_flags = flags;
-		return map_anon_segment(segp);
+		ret = map_anon_segment(segp);
 		break;
 
 	case SEGT_FILE:
@@ -882,29 +1241,138 @@ segment_map(char *name, range_t *range, int flags)
 			segp->seg_offset = range->offset;
 			segp->seg_length = range->length;
 		}
-		return map_file_segment(segp);
+		ret = map_file_segment(segp);
 		break;
 
 	case SEGT_SHM:
 		/*
 		 * Can't override shmem flags--always "shared"
 		 */
-		return map_shm_segment(segp);
+		ret = map_shm_segment(segp);
 		break;
 	}
 
-	return SEG_ERR;	/* unrecognized segment type -- shouldn't happen */
+	/*
+	 * after mlockall(MCL_FUTURE), the kernel locked the new mapping
+	 */
+	if (ret && (lockall_flags & MCL_FUTURE))
+		(void)locked_update(segp, 0, segp->seg_length, true,
+					!!(lockall_flags & MCL_ONFAULT));
+
+	return ret;
+}
+
+int
+segment_map(char *name, range_t *range, int flags)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = map_segment(name, range, flags);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * partitioned migration:  one piece of a range per worker thread
+ */
+struct mig_piece {
+	char          *mp_start;	/* mbind() */
+	size_t         mp_length;
+	int            mp_policy;
+	unsigned long *mp_nodebits;
+	unsigned long  mp_maxnode;
+
+	pid_t          mp_pid;		/* move_pages() */
+	void         **mp_pages;
+	int           *mp_nodes;
+	int           *mp_status;
+	unsigned long  mp_nr_pages;
+	unsigned long  mp_batch;
+	siginfo_t    **mp_abort;	/* main thread's signal state */
+
+	int            mp_flags;
+};
+
+/*
+ * piece_start() - first of 'nr_items' items in piece 'i' of 'nr_pieces'
+ */
+static unsigned long
+piece_start(unsigned long nr_items, int i, int nr_pieces)
+{
+	return (nr_items * i) / nr_pieces;
+}
+
+static int
+mbind_worker(worker_t *wp)
+{
+	struct mig_piece *mpp = wp->w_arg;
+
+	if (mbind(mpp->mp_start, mpp->mp_length, mpp->mp_policy,
+		  mpp->mp_nodebits, mpp->mp_maxnode, mpp->mp_flags) < 0)
+		return errno;
+	return 0;
+}
+
+/*
+ * mbind_partitioned() - split [start, start+length) into 'nr_threads'
+ * disjoint, page aligned pieces and mbind() them concurrently from
+ * pinned worker threads.  Returns elapsed usecs, or -1 with errno set.
+ */
+static long
+mbind_partitioned(char *start, size_t length, size_t pagesize, int policy,
+		unsigned long *nodebits, unsigned long maxnode, int flags,
+		worker_t *workers, int nr_threads)
+{
+	struct mig_piece *pieces;
+	unsigned long     nr_pages = length / pagesize;
+	long              usecs;
+	int               i;
+
+	pieces = calloc(nr_threads, sizeof(*pieces));
+	if (!pieces) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < nr_threads; ++i) {
+		struct mig_piece *mpp = &pieces[i];
+		unsigned long first = piece_start(nr_pages, i, nr_threads);
+		unsigned long next  = piece_start(nr_pages, i+1, nr_threads);
+
+		mpp->mp_start    = start + first * pagesize;
+		mpp->mp_length   = (next - first) * pagesize;
+		mpp->mp_policy   = policy;
+		mpp->mp_nodebits = nodebits;
+		mpp->mp_maxnode  = maxnode;
+		mpp->mp_flags    = flags;
+		workers[i].w_arg = mpp;
+	}
+
+	usecs = workers_run(workers, nr_threads, mbind_worker);
+	for (i = 0; usecs >= 0 && i < nr_threads; ++i) {
+		if (workers[i].w_ret) {
+			errno = workers[i].w_ret;
+			usecs = -1;
+		}
+	}
 
+	free(pieces);
+	return usecs;
 }
 
 /*
  * segment_mbind() - set memory policy for a range of specified segment
  *
+ * 'nr_threads' > 1 splits the range into that many disjoint pieces and
+ * mbind()s them concurrently.  Useful with '+move' to measure parallel
+ * migration.
+ *
  * NOTE:  offset is relative to start of mapping, not start of file
  */
-int
-segment_mbind(char *name, range_t *range, int policy,
-		nodemask_t *nodemask, int flags)
+static int
+mbind_segment(char *name, range_t *range, int policy,
+		nodemask_t *nodemask, int flags, int nr_threads)
 {
 	glctx_t       *gcp = &glctx;
 	segment_t     *segp;
@@ -914,6 +1382,8 @@ segment_mbind(char *name, range_t *range, int policy,
 	struct timeval t_start, t_end;
 	unsigned long  maxnode = 0;
 	unsigned long *nodebits = NULL;
+	worker_t      *workers = NULL;
+	long           usecs;
 	int            ret;
 
 	segp = segment_get(name);
@@ -955,64 +1425,789 @@ segment_mbind(char *name, range_t *range, int policy,
 		nodebits = nodemask->n;
 	}
 
-	gettimeofday(&t_start, NULL);
-	ret = mbind(start, length, policy, nodebits, maxnode, flags);
-	gettimeofday(&t_end, NULL);
+	if (nr_threads > length / segp->seg_pagesize)
+		nr_threads = length / segp->seg_pagesize;
+
+	if (nr_threads > 1) {
+		workers = calloc(nr_threads, sizeof(*workers));
+		if (!workers) {
+			fprintf(stderr, "%s:  can't allocate %d workers\n",
+				gcp->program_name, nr_threads);
+			return SEG_ERR;
+		}
+		usecs = mbind_partitioned(start, length, segp->seg_pagesize,
+					policy, nodebits, maxnode, flags,
+					workers, nr_threads);
+		ret = (usecs < 0) ? -1 : 0;
+	} else {
+		gettimeofday(&t_start, NULL);
+		ret = mbind(start, length, policy, nodebits, maxnode, flags);
+		gettimeofday(&t_end, NULL);
+		usecs = tv_diff_usec(&t_start, &t_end);
+	}
 
 out:
 	if (ret == -1) {
 		int err = errno;
 		fprintf(stderr, "%s:  mbind() of segment %s failed - %s\n",
 			gcp->program_name, name, strerror(err));
+		free(workers);
 		return SEG_ERR;
 	} else  if (flags & (MPOL_MF_MOVE|MPOL_MF_MOVE_ALL)){
 		char *operation = "migration";
 
-		printf("%s:  %s of %s [%d pages] took %6.3fsecs.\n",
-			gcp->program_name, operation, segp->seg_name,
-			(length/gcp->pagesize),
-			(float)(tv_diff_usec(&t_start, &t_end))/1000000.0);
-		
+		result_record("mbind+move", usecs, length/segp->seg_pagesize,
+				segp->seg_pagesize, 0);
+		if (!is_option(QUIET)) {
+			printf("%s:  %s of %s [%d pages] took %6.3fsecs.\n",
+				gcp->program_name, operation, segp->seg_name,
+				(length/gcp->pagesize),
+				(float)usecs/1000000.0);
+			if (workers)
+				workers_show_times(workers, nr_threads);
+		}
 	}
 
+	free(workers);
 	return SEG_OK;
 }
 
+int
+segment_mbind(char *name, range_t *range, int policy,
+		nodemask_t *nodemask, int flags, int nr_threads)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = mbind_segment(name, range, policy, nodemask, flags, nr_threads);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
 /*
- * segment_location() - report node location of specified range of segment
- *
- * NOTE:  offset is relative to start of mapping, not start of file
+ * get_mapped_segment() - lookup named segment and verify that it's mapped
  */
-#define PG_PER_LINE 8
-#define PPL_MASK (PG_PER_LINE - 1)
-int
-segment_location(char *name, range_t *range)
+static segment_t *
+get_mapped_segment(char *name)
 {
-	glctx_t       *gcp = &glctx;
-	segment_t     *segp;
-	char          *apage, *end;
-	off_t          offset;
-	size_t         length, maxlength;
-	int            pgid, i;
-	bool           need_nl;
+	glctx_t   *gcp = &glctx;
+	segment_t *segp;
 
 	segp = segment_get(name);
 	if (segp == NULL) {
 		fprintf(stderr, "%s:  no such segment:  %s\n",
 			gcp->program_name, name);
-		return SEG_ERR;
+		return NULL;
 	}
 
 	if (segp->seg_start == MAP_FAILED) {
 		fprintf(stderr, "%s:  segment %s not mapped\n",
 			gcp->program_name, name);
-		return SEG_ERR;
+		return NULL;
 	}
 
-	offset    = round_down_to_segment_pagesize(range->offset, segp);
-	if (offset >= segp->seg_length) {
-		fprintf(stderr, "%s:  offset %ld is past end of segment %s\n",
-			gcp->program_name, offset, name);
+	return segp;
+}
+
+/*
+ * segment_extent_range() - narrow 'extent' to the [offset, length] range
+ * arg, page aligned.  'name' is for error messages.
+ *
+ * NOTE:  offset is relative to start of mapping, not start of file.
+ *        we silently truncate to max length [end of segment]
+ */
+int
+segment_extent_range(seg_extent_t *extent, range_t *range, char *name)
+{
+	glctx_t  *gcp = &glctx;
+	size_t    pagemask = extent->se_pagesize - 1;
+	off_t     offset;
+	size_t    length, maxlength;
+
+	offset    = range->offset & ~pagemask;
+	if (offset >= extent->se_length) {
+		fprintf(stderr,
+			"%s:  offset %ld is past end of segment %s\n",
+			gcp->program_name, offset, name);
+		return SEG_ERR;
+	}
+
+	maxlength = extent->se_length - offset;
+
+	length = range->length;
+	if (length)
+		length = (length + pagemask) & ~pagemask;
+
+	if(length == 0 || length > maxlength)
+		length = maxlength;
+
+	extent->se_start += offset;
+	extent->se_length = length;
+	return SEG_OK;
+}
+
+/*
+ * get_segment_range() - convert [offset, length] range arg to start address
+ * and page aligned length within segment.
+ */
+static int
+get_segment_range(segment_t *segp, range_t *range, char **startp,
+			size_t *lengthp)
+{
+	seg_extent_t extent;
+
+	extent.se_start    = (unsigned long)segp->seg_start;
+	extent.se_length   = segp->seg_length;
+	extent.se_pagesize = segp->seg_pagesize;
+
+	if (segment_extent_range(&extent, range, segp->seg_name) == SEG_ERR)
+		return SEG_ERR;
+
+	*startp  = (char *)extent.se_start;
+	*lengthp = extent.se_length;
+	return SEG_OK;
+}
+
+/*
+ * move_pages(2) per page status values that we expect to see.
+ * anything else shows up as "other".
+ */
+static struct move_status {
+	int   ms_errno;
+	char *ms_name;
+} move_status[] = {
+	{ EACCES, "-EACCES" },	/* mapped by multiple processes */
+	{ EBUSY,  "-EBUSY"  },	/* busy, or can't be moved right now */
+	{ EFAULT, "-EFAULT" },	/* zero page or not mapped */
+	{ EIO,    "-EIO"    },	/* writeback or dirty, w/o migratepage */
+	{ EINVAL, "-EINVAL" },	/* dirty page can't be moved */
+	{ ENOENT, "-ENOENT" },	/* page not present */
+	{ ENOMEM, "-ENOMEM" },	/* no memory on target node */
+	{ 0,      "other"   },
+};
+#define NR_MOVE_STATUS (sizeof(move_status)/sizeof(move_status[0]))
+
+/*
+ * show_move_status() - display histogram of move_pages() status array:
+ * pages per resulting node and pages per error code.
+ */
+static void
+show_move_status(int *status, unsigned long nr_pages)
+{
+	glctx_t       *gcp = &glctx;
+	unsigned long *node_count, err_count[NR_MOVE_STATUS];
+	unsigned long  i;
+	int            node, max_node = gcp->numa_max_node;
+
+	node_count = calloc(max_node + 1, sizeof(*node_count));
+	if (!node_count) {
+		fprintf(stderr, "%s:  can't allocate move status histogram\n",
+			gcp->program_name);
+		return;
+	}
+	memset(err_count, 0, sizeof(err_count));
+
+	for (i = 0; i < nr_pages; ++i) {
+		int st = status[i];
+
+		if (st >= 0 && st <= max_node) {
+			++node_count[st];
+		} else {
+			int ims;
+
+			for (ims = 0; ims < NR_MOVE_STATUS - 1; ++ims)
+				if (-st == move_status[ims].ms_errno)
+					break;
+			++err_count[ims];
+		}
+	}
+
+	printf("    status    pages\n");
+	for (node = 0; node <= max_node; ++node) {
+		if (node_count[node])
+			printf("    node %-3d %8lu\n", node, node_count[node]);
+	}
+	for (i = 0; i < NR_MOVE_STATUS; ++i) {
+		if (err_count[i])
+			printf("    %-8s %8lu\n", move_status[i].ms_name,
+				err_count[i]);
+	}
+
+	free(node_count);
+}
+
+/*
+ * move_pages_loop() - move_pages() for 'nr_pages' pages, 'batch' pages
+ * per system call; per page status in 'status'.  Stops early once
+ * '*abortp' -- the main thread's signal state -- is set.  No output and
+ * no signal handling, so worker threads may call it.  Returns elapsed
+ * time in usecs, or -1 with errno set.
+ */
+static long
+move_pages_loop(pid_t pid, void **pages, int *nodes, int *status,
+			unsigned long nr_pages, unsigned long batch, int flags,
+			siginfo_t **abortp)
+{
+	struct timeval t_start, t_end;
+	unsigned long  done;
+
+	if (batch == 0 || batch > nr_pages)
+		batch = nr_pages;
+
+	gettimeofday(&t_start, NULL);
+	for (done = 0; done < nr_pages; done += batch) {
+		unsigned long count = batch;
+		long ret;
+
+		if (count > nr_pages - done)
+			count = nr_pages - done;
+
+		ret = move_pages(pid, count, pages + done,
+				 nodes ? nodes + done : NULL,
+				 status + done, flags);
+		if (ret < 0)
+			return -1;
+
+		if (*(siginfo_t * volatile *)abortp)
+			break;
+	}
+	gettimeofday(&t_end, NULL);
+
+	return tv_diff_usec(&t_start, &t_end);
+}
+
+/*
+ * move_pages_batched() - move_pages_loop() from the main thread:  report
+ * errors and take an interrupt.  Returns elapsed usecs, or -1 on error.
+ */
+static long
+move_pages_batched(pid_t pid, void **pages, int *nodes, int *status,
+			unsigned long nr_pages, unsigned long batch, int flags)
+{
+	glctx_t *gcp = &glctx;
+	long     usecs;
+
+	usecs = move_pages_loop(pid, pages, nodes, status, nr_pages, batch,
+				flags, &gcp->siginfo);
+	if (usecs < 0) {
+		int err = errno;
+		fprintf(stderr, "%s:  move_pages() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return -1;
+	}
+	if (signalled(gcp))
+		reset_signal();
+	return usecs;
+}
+
+/*
+ * runs in a worker thread:  hand errno back to the main thread to report.
+ */
+static int
+move_pages_worker(worker_t *wp)
+{
+	struct mig_piece *mpp = wp->w_arg;
+
+	if (move_pages_loop(mpp->mp_pid, mpp->mp_pages, mpp->mp_nodes,
+			mpp->mp_status, mpp->mp_nr_pages, mpp->mp_batch,
+			mpp->mp_flags, mpp->mp_abort) < 0)
+		return errno;
+	return 0;
+}
+
+/*
+ * move_pages_run() - move_pages() 'nr_pages' pages of process 'pid',
+ * 'batch' pages per call.  If 'nr_threads' > 1, split the pages into that
+ * many disjoint pieces and move them concurrently from pinned worker
+ * threads.  Returns elapsed usecs or -1 on error.
+ */
+static long
+move_pages_run(pid_t pid, void **pages, int *nodes, int *status,
+		unsigned long nr_pages, unsigned long batch, int flags,
+		worker_t *workers, int nr_threads)
+{
+	glctx_t          *gcp = &glctx;
+	struct mig_piece *pieces;
+	long              usecs;
+	int               i;
+
+	if (nr_threads <= 1)
+		return move_pages_batched(pid, pages, nodes, status, nr_pages,
+						batch, flags);
+
+	pieces = calloc(nr_threads, sizeof(*pieces));
+	if (!pieces)
+		return -1;
+
+	for (i = 0; i < nr_threads; ++i) {
+		struct mig_piece *mpp = &pieces[i];
+		unsigned long first = piece_start(nr_pages, i, nr_threads);
+		unsigned long next  = piece_start(nr_pages, i+1, nr_threads);
+
+		mpp->mp_pid      = pid;
+		mpp->mp_pages    = pages + first;
+		mpp->mp_nodes    = nodes + first;
+		mpp->mp_status   = status + first;
+		mpp->mp_nr_pages = next - first;
+		mpp->mp_batch    = batch;
+		mpp->mp_flags    = flags;
+		mpp->mp_abort    = &gcp->siginfo;
+		workers[i].w_arg = mpp;
+	}
+
+	/*
+	 * workers block signals:  an interrupt lands here, in the main
+	 * thread, and they poll for it via mp_abort.
+	 */
+	usecs = workers_run(workers, nr_threads, move_pages_worker);
+	for (i = 0; usecs >= 0 && i < nr_threads; ++i) {
+		if (workers[i].w_ret) {
+			fprintf(stderr, "%s:  move_pages() failed - %s\n",
+				gcp->program_name,
+				strerror(workers[i].w_ret));
+			usecs = -1;
+		}
+	}
+	if (signalled(gcp))
+		reset_signal();
+
+	free(pieces);
+	return usecs;
+}
+
+/*
+ * restore_placement() - move pages back to the nodes recorded in 'orig'
+ * by a previous status query.  Pages that weren't present [orig < 0]
+ * are left alone.  'status' is scratch space.
+ */
+static void
+restore_placement(pid_t pid, void **pages, int *orig, int *status,
+			unsigned long nr_pages, int flags)
+{
+	void        **rpages;
+	int          *rnodes;
+	unsigned long i, nr_present = 0;
+
+	rpages = calloc(nr_pages, sizeof(*rpages));
+	rnodes = calloc(nr_pages, sizeof(*rnodes));
+	if (rpages && rnodes) {
+		for (i = 0; i < nr_pages; ++i) {
+			if (orig[i] < 0)
+				continue;
+			rpages[nr_present]   = pages[i];
+			rnodes[nr_present++] = orig[i];
+		}
+		if (nr_present)
+			(void)move_pages_batched(pid, rpages, rnodes, status,
+						nr_present, 0, flags);
+	}
+	free(rnodes);
+	free(rpages);
+}
+
+static double
+pages_per_sec(unsigned long nr_pages, long usecs)
+{
+	if (usecs <= 0)
+		usecs = 1;
+	return (double)nr_pages * 1000000.0 / (double)usecs;
+}
+
+/*
+ * move_pages_range() - move_pages() 'length' bytes at 'start' in process
+ * 'pid' [0 => memtoy] to the nodes in 'nodemask'.  Pages are distributed
+ * round-robin over the nodes in the mask, so a single node moves the whole
+ * range there and a node list specifies an interleave pattern.
+ *
+ * 'batch' = pages per move_pages() call; 0 => entire range in one call.
+ * MOVE_PAGES_SWEEP => time batch sizes 1, 2, 4, ... up to the entire range,
+ * restoring the original placement between runs, and report the best.
+ * 'nr_threads' > 1 splits the range into disjoint pieces moved concurrently.
+ * 'name' labels the reports.
+ */
+static int
+move_pages_range(pid_t pid, char *name, char *start, size_t length,
+			size_t pagesize, nodemask_t *nodemask, long batch,
+			int flags, int nr_threads)
+{
+	glctx_t       *gcp = &glctx;
+	void         **pages;
+	int           *nodes, *status, *orig = NULL;
+	int           *nodeids, nr_nodeids = 0, node;
+	worker_t      *workers = NULL;
+	unsigned long  nr_pages, i;
+	int            ret = SEG_ERR;
+
+	nodeids = calloc(gcp->numa_max_node + 1, sizeof(*nodeids));
+	nr_pages = length / pagesize;
+	pages  = calloc(nr_pages, sizeof(*pages));
+	nodes  = calloc(nr_pages, sizeof(*nodes));
+	status = calloc(nr_pages, sizeof(*status));
+	if (!nodeids || !pages || !nodes || !status) {
+		fprintf(stderr, "%s:  can't allocate move_pages() arrays for "
+			"%lu pages\n", gcp->program_name, nr_pages);
+		goto out_free;
+	}
+
+	for (node = 0; node <= gcp->numa_max_node; ++node)
+		if (nodemask_isset(nodemask, node))
+			nodeids[nr_nodeids++] = node;
+
+	for (i = 0; i < nr_pages; ++i) {
+		pages[i] = start + i * pagesize;
+		nodes[i] = nodeids[i % nr_nodeids];
+	}
+
+	if (nr_threads > nr_pages)
+		nr_threads = nr_pages;
+	if (nr_threads > 1) {
+		workers = calloc(nr_threads, sizeof(*workers));
+		if (!workers) {
+			fprintf(stderr, "%s:  can't allocate %d workers\n",
+				gcp->program_name, nr_threads);
+			goto out_free;
+		}
+	}
+
+	if (batch != MOVE_PAGES_SWEEP) {
+		unsigned long nr_failed = 0;
+		long usecs;
+
+		usecs = move_pages_run(pid, pages, nodes, status, nr_pages,
+					batch, flags, workers, nr_threads);
+		if (usecs < 0)
+			goto out_free;
+
+		for (i = 0; i < nr_pages; ++i)
+			if (status[i] != nodes[i])
+				++nr_failed;
+		result_record("move_pages", usecs, nr_pages, pagesize,
+				nr_failed);
+
+		if (!is_option(QUIET)) {
+			printf("%s:  movepages of %s [%lu pages, batch %lu] "
+				"took %6.3fsecs - %.0f pages/sec\n",
+				gcp->program_name, name, nr_pages,
+				batch ? batch : nr_pages,
+				(float)usecs/1000000.0,
+				pages_per_sec(nr_pages, usecs));
+			if (workers)
+				workers_show_times(workers, nr_threads);
+			show_move_status(status, nr_pages);
+		}
+		ret = SEG_OK;
+	} else {
+		unsigned long bsize, best_batch = 0;
+		double        best_rate = 0.0;
+
+		/*
+		 * remember where pages live now, so we can put them back
+		 * before each run.
+		 */
+		orig = calloc(nr_pages, sizeof(*orig));
+		if (!orig ||
+		    move_pages_batched(pid, pages, NULL, orig, nr_pages,
+					0, 0) < 0)
+			goto out_free;
+
+		printf("%s:  movepages batch size sweep of %s [%lu pages, "
+			"%d thread%s]\n", gcp->program_name, name,
+			nr_pages, nr_threads > 1 ? nr_threads : 1,
+			nr_threads > 1 ? "s" : "");
+		printf("    batch      pages     secs    pages/sec\n");
+
+		for (bsize = 1; ; bsize <<= 1) {
+			double rate;
+			long   usecs;
+
+			if (bsize > nr_pages)
+				bsize = nr_pages;
+
+			restore_placement(pid, pages, orig, status, nr_pages,
+						flags);
+
+			usecs = move_pages_run(pid, pages, nodes, status,
+						nr_pages, bsize, flags, workers,
+						nr_threads);
+			if (usecs < 0)
+				goto out_free;
+
+			rate = pages_per_sec(nr_pages, usecs);
+			printf("  %7lu  %9lu  %7.3f  %11.0f\n", bsize,
+				nr_pages, (float)usecs/1000000.0, rate);
+			if (rate > best_rate) {
+				best_rate  = rate;
+				best_batch = bsize;
+			}
+
+			if (bsize == nr_pages)
+				break;
+		}
+		printf("%s:  best batch size %lu - %.0f pages/sec\n",
+			gcp->program_name, best_batch, best_rate);
+		show_move_status(status, nr_pages);
+		ret = SEG_OK;
+	}
+
+out_free:
+	free(workers);
+	free(orig);
+	free(status);
+	free(nodes);
+	free(pages);
+	free(nodeids);
+	return ret;
+}
+
+/*
+ * segment_move_pages() - move_pages() the specified range of the named
+ * segment to the nodes in 'nodemask'.  See move_pages_range().
+ *
+ * NOTE:  offset is relative to start of mapping, not start of file
+ */
+static int
+move_segment_pages(char *name, range_t *range, nodemask_t *nodemask,
+			long batch, int flags, int nr_threads)
+{
+	segment_t     *segp;
+	char          *start;
+	size_t         length;
+
+	segp = get_mapped_segment(name);
+	if (segp == NULL)
+		return SEG_ERR;
+
+	if (get_segment_range(segp, range, &start, &length) == SEG_ERR)
+		return SEG_ERR;
+
+	return move_pages_range(0, segp->seg_name, start, length,
+				segp->seg_pagesize, nodemask, batch, flags,
+				nr_threads);
+}
+
+int
+segment_move_pages(char *name, range_t *range, nodemask_t *nodemask,
+			long batch, int flags, int nr_threads)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = move_segment_pages(name, range, nodemask, batch, flags, nr_threads);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_move_pages_pid() - move_pages() a segment range of another
+ * process -- e.g., a child -- described by 'extent'.  'name' labels the
+ * reports.  See move_pages_range().
+ */
+int
+segment_move_pages_pid(pid_t pid, char *name, seg_extent_t *extent,
+			nodemask_t *nodemask, long batch, int flags,
+			int nr_threads)
+{
+	return move_pages_range(pid, name, (char *)extent->se_start,
+				extent->se_length, extent->se_pagesize,
+				nodemask, batch, flags, nr_threads);
+}
+
+/*
+ * segment_extent() - return start address, length and page size of
+ * the named segment, for another process to operate on.
+ */
+static int
+get_segment_extent(char *name, seg_extent_t *extent)
+{
+	segment_t     *segp;
+
+	segp = get_mapped_segment(name);
+	if (segp == NULL)
+		return SEG_ERR;
+
+	extent->se_start    = (unsigned long)segp->seg_start;
+	extent->se_length   = segp->seg_length;
+	extent->se_pagesize = segp->seg_pagesize;
+	return SEG_OK;
+}
+
+int
+segment_extent(char *name, seg_extent_t *extent)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = get_segment_extent(name, extent);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_file() - the open file descriptor of a mapped file segment and
+ * the file offset of its start, for reading the file other than through
+ * the mapping.
+ */
+static int
+get_segment_file(char *name, int *fdp, off_t *offsetp)
+{
+	glctx_t   *gcp = &glctx;
+	segment_t *segp;
+
+	segp = get_mapped_segment(name);
+	if (segp == NULL)
+		return SEG_ERR;
+
+	if (segp->seg_type != SEGT_FILE || segp->seg_fd == SEG_FD_NONE) {
+		fprintf(stderr, "%s:  %s is not a file segment\n",
+			gcp->program_name, name);
+		return SEG_ERR;
+	}
+
+	*fdp     = segp->seg_fd;
+	*offsetp = segp->seg_offset;
+	return SEG_OK;
+}
+
+int
+segment_file(char *name, int *fdp, off_t *offsetp)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = get_segment_file(name, fdp, offsetp);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_prot() - the protection a mapped segment was given, and whether
+ * it's private anon memory of our own -- not, e.g., the heap, from maps.
+ * Commands that write its pages, or change its protection behind its
+ * back, must check both.
+ */
+static int
+get_segment_prot(char *name, int *protp, int *private_anonp)
+{
+	segment_t *segp;
+
+	segp = get_mapped_segment(name);
+	if (segp == NULL)
+		return SEG_ERR;
+
+	*protp         = segp->seg_prot;
+	*private_anonp = segp->seg_type == SEGT_ANON &&
+			 !(segp->seg_flags & (MAP_SHARED|SEGF_MAPS));
+	return SEG_OK;
+}
+
+int
+segment_prot(char *name, int *protp, int *private_anonp)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = get_segment_prot(name, protp, private_anonp);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_node_pages() - count pages of the named segment that reside on
+ * 'node'.  Also return the total # of pages and the segment page size,
+ * if requested.  Returns -1 on error.
+ */
+static long
+count_node_pages(char *name, int node, unsigned long *nr_pagesp,
+			size_t *pagesizep)
+{
+	glctx_t       *gcp = &glctx;
+	segment_t     *segp;
+	void         **pages;
+	int           *status;
+	unsigned long  nr_pages, i;
+	long           count = -1;
+
+	segp = get_mapped_segment(name);
+	if (segp == NULL)
+		return -1;
+
+	nr_pages = segp->seg_length / segp->seg_pagesize;
+	pages  = calloc(nr_pages, sizeof(*pages));
+	status = calloc(nr_pages, sizeof(*status));
+	if (!pages || !status) {
+		fprintf(stderr, "%s:  can't allocate move_pages() arrays for "
+			"%lu pages\n", gcp->program_name, nr_pages);
+		goto out_free;
+	}
+
+	for (i = 0; i < nr_pages; ++i)
+		pages[i] = segp->seg_start + i * segp->seg_pagesize;
+
+	if (move_pages_batched(0, pages, NULL, status, nr_pages, 0, 0) < 0)
+		goto out_free;
+
+	for (count = 0, i = 0; i < nr_pages; ++i)
+		if (status[i] == node)
+			++count;
+
+	if (nr_pagesp)
+		*nr_pagesp = nr_pages;
+	if (pagesizep)
+		*pagesizep = segp->seg_pagesize;
+
+out_free:
+	free(status);
+	free(pages);
+	return count;
+}
+
+long
+segment_node_pages(char *name, int node, unsigned long *nr_pagesp,
+			size_t *pagesizep)
+{
+	long ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = count_node_pages(name, node, nr_pagesp, pagesizep);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_location() - report node location of specified range of segment
+ *
+ * NOTE:  offset is relative to start of mapping, not start of file
+ */
+#define PG_PER_LINE 8
+#define PPL_MASK (PG_PER_LINE - 1)
+static int
+show_segment_location(char *name, range_t *range)
+{
+	glctx_t       *gcp = &glctx;
+	segment_t     *segp;
+	char          *apage, *end;
+	off_t          offset;
+	size_t         length, maxlength;
+	int            pgid, i;
+	bool           need_nl;
+
+	segp = segment_get(name);
+	if (segp == NULL) {
+		fprintf(stderr, "%s:  no such segment:  %s\n",
+			gcp->program_name, name);
+		return SEG_ERR;
+	}
+
+	if (segp->seg_start == MAP_FAILED) {
+		fprintf(stderr, "%s:  segment %s not mapped\n",
+			gcp->program_name, name);
+		return SEG_ERR;
+	}
+
+	offset    = round_down_to_segment_pagesize(range->offset, segp);
+	if (offset >= segp->seg_length) {
+		fprintf(stderr, "%s:  offset %ld is past end of segment %s\n",
+			gcp->program_name, offset, name);
 		return SEG_ERR;
 	}
 
@@ -1084,16 +2279,39 @@ segment_location(char *name, range_t *range)
 	return SEG_OK;
 }
 
+int
+segment_location(char *name, range_t *range)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&segtable_lock);
+	ret = show_segment_location(name, range);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * mlock2() may be missing from older C libraries
+ */
+static int
+sys_mlock2(const void *start, size_t length, int flags)
+{
+#ifdef __NR_mlock2
+	return syscall(__NR_mlock2, start, length, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 /*
  * segment_lock_unlock() -- mlock/munlock() a previously mapped segment
  *
-TODO:  tracking of # locked pages difficult.  munlock() succeeds on 
-       unlocked pages.  Would need to track locked address ranges and
-       check intersection of munlock ranges with locked ranges...
-       For now, just note rlimit when mlock() fails w/ ENOMEM
+ * 'lock' is one of SEG_UNLOCK, SEG_LOCK or SEG_LOCK_ONFAULT [mlock2()].
+ * Locked ranges are tracked per segment, for 'show'.
  */
-int
-segment_lock_unlock(char *name, range_t *range, int lock, int shm)
+static int
+lock_unlock_segment(char *name, range_t *range, int lock, int shm)
 {
 	glctx_t       *gcp = &glctx;
 	segment_t     *segp;
@@ -1163,7 +2381,12 @@ segment_lock_unlock(char *name, range_t *range, int lock, int shm)
 	if(length == 0 || length > maxlength)
 		length = maxlength;
 
-	if (lock) {
+	if (lock == SEG_LOCK_ONFAULT) {
+		operation = "mlock_onfault";
+		gettimeofday(&t_start, NULL);
+		ret = sys_mlock2(start, length, MLOCK_ONFAULT);
+		gettimeofday(&t_end, NULL);
+	} else if (lock) {
 		operation = "mlock";
 		gettimeofday(&t_start, NULL);
 		ret = mlock(start, length);
@@ -1180,22 +2403,283 @@ segment_lock_unlock(char *name, range_t *range, int lock, int shm)
 		int err = errno;
 		fprintf(stderr, "%s:  %s() of segment %s failed - %s\n",
 			gcp->program_name, operation, name, strerror(err));
+		if (err == ENOMEM)
+			fprintf(stderr,
+				"\tNote:  lock memory rlimit = %lu bytes; "
+				"%lu locked\n",
+				gcp->locked_limit, locked_total(NULL));
+		return SEG_ERR;
+	}
+
+	if (!locked_update(segp, offset, offset + length, lock != SEG_UNLOCK,
+				lock == SEG_LOCK_ONFAULT))
+		return SEG_ERR;
+	(void)locked_total(NULL);
+
+	if (lock) {
+		result_record(operation, tv_diff_usec(&t_start, &t_end),
+				length/segp->seg_pagesize, segp->seg_pagesize, 0);
+		if (!is_option(QUIET))
+			printf("%s:  %s of %s [%d pages] took %6.3fsecs.\n",
+				gcp->program_name, operation, segp->seg_name,
+				(length/gcp->pagesize),
+				(float)(tv_diff_usec(&t_start, &t_end))/1000000.0);
+		
+	}
+
+	return SEG_OK;
+}
+
+int
+segment_lock_unlock(char *name, range_t *range, int lock, int shm)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = lock_unlock_segment(name, range, lock, shm);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_lockall() -- mlockall() with MCL_* 'flags', and note which
+ * segments are now locked.  MCL_FUTURE segments are noted as they're
+ * mapped.
+ */
+static int
+lockall_segments(int flags)
+{
+	glctx_t       *gcp = &glctx;
+	segment_t     *segp, **segpp;
+	struct timeval t_start, t_end;
+	unsigned long  nr_pages = 0;
+
+	gettimeofday(&t_start, NULL);
+	if (mlockall(flags) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s:  mlockall() failed - %s\n",
+			gcp->program_name, strerror(err));
 		if (err == ENOMEM)
 			fprintf(stderr,
 				"\tNote:  lock memory rlimit = %lu bytes\n",
 				gcp->locked_limit);
 		return SEG_ERR;
-	} else  if (lock) {
+	}
+	gettimeofday(&t_end, NULL);
+
+	/*
+	 * each mlockall() replaces the MCL_FUTURE behavior
+	 */
+	lockall_flags = (flags & MCL_FUTURE) ? flags : 0;
+
+	if (flags & MCL_CURRENT) {
+		for (segpp = gcp->seglist; segp = *segpp; ++segpp) {
+			if (segp->seg_type == SEGT_NONE ||
+			    segp->seg_start == MAP_FAILED)
+				continue;
+			if (!locked_update(segp, 0, segp->seg_length, true,
+					!!(flags & MCL_ONFAULT)))
+				return SEG_ERR;
+			nr_pages += segp->seg_length / gcp->pagesize;
+		}
+	}
+	(void)locked_total(NULL);
+
+	result_record("mlockall", tv_diff_usec(&t_start, &t_end), nr_pages,
+			gcp->pagesize, 0);
+	if (!is_option(QUIET))
+		printf("%s:  mlockall took %6.3fsecs.\n", gcp->program_name,
+			(float)(tv_diff_usec(&t_start, &t_end))/1000000.0);
+
+	return SEG_OK;
+}
+
+int
+segment_lockall(int flags)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = lockall_segments(flags);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * forget_locks() -- forget all locked ranges, and MCL_FUTURE
+ */
+static void
+forget_locks(void)
+{
+	glctx_t   *gcp = &glctx;
+	segment_t *segp, **segpp;
+
+	for (segpp = gcp->seglist; segpp && (segp = *segpp); ++segpp)
+		locked_clear(segp);
+	lockall_flags = 0;
+	gcp->locked_mem = 0;
+}
+
+/*
+ * segment_unlockall() -- munlockall(); forget all locked ranges
+ */
+static int
+unlockall_segments(void)
+{
+	glctx_t *gcp = &glctx;
+
+	if (munlockall() == -1) {
+		int err = errno;
+		fprintf(stderr, "%s:  munlockall() failed - %s\n",
+			gcp->program_name, strerror(err));
+		return SEG_ERR;
+	}
+	forget_locks();
+	return SEG_OK;
+}
+
+int
+segment_unlockall(void)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = unlockall_segments();
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_merge() - madvise() a range of a private anon segment
+ * [UN]MERGEABLE for KSM.  MADV_UNMERGEABLE unmerges -- breaks COW of --
+ * the range's KSM pages before it returns, so time it.
+ */
+static int
+merge_segment(char *name, range_t *range, int merge)
+{
+	glctx_t       *gcp = &glctx;
+	segment_t     *segp;
+	char          *start, *operation;
+	off_t          offset;
+	size_t         length, maxlength;
+	struct timeval t_start, t_end;
+	long           merged;
+
+	segp = segment_get(name);
+	if (segp == NULL) {
+		fprintf(stderr, "%s:  no such segment:  %s\n",
+			gcp->program_name, name);
+		return SEG_ERR;
+	}
+
+	if (segp->seg_start == MAP_FAILED) {
+		fprintf(stderr, "%s:  segment %s not mapped\n",
+			gcp->program_name, name);
+		return SEG_ERR;
+	}
+
+	if (segp->seg_type != SEGT_ANON || segp->seg_flags & MAP_SHARED ||
+	    segp->seg_pagesize != gcp->pagesize) {
+		fprintf(stderr, "%s:  KSM merges only private anon segments "
+			"of base pages\n", gcp->program_name);
+		return SEG_ERR;
+	}
+
+	offset = round_down_to_segment_pagesize(range->offset, segp);
+	if (offset >= segp->seg_length) {
+		fprintf(stderr,
+			"%s:  offset %ld is past end of segment %s\n",
+			gcp->program_name, offset, name);
+		return SEG_ERR;
+	}
+
+	start     = segp->seg_start + offset;
+	maxlength = segp->seg_length - offset;
+
+	length = range->length;
+	if (length)
+		length = round_up_to_segment_pagesize(length, segp);
+	if(length == 0 || length > maxlength)
+		length = maxlength;
+
+	operation = merge ? "MADV_MERGEABLE" : "MADV_UNMERGEABLE";
+	vprint("%s:  madvise(%s) memory range 0x%lx-0x%lx\n",
+		gcp->program_name, operation, start, start+length-1);
+
+	merged = merge ? -1 : ksm_pages(start, length/segp->seg_pagesize,
+						segp->seg_pagesize);
+	gettimeofday(&t_start, NULL);
+	if (madvise(start, length,
+			merge ? MADV_MERGEABLE : MADV_UNMERGEABLE) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s:  madvise(%s) of segment %s failed - %s\n",
+			gcp->program_name, operation, name, strerror(err));
+		if (err == EINVAL)
+			fprintf(stderr, "\tNote:  kernel built without "
+				"CONFIG_KSM?\n");
+		return SEG_ERR;
+	}
+	gettimeofday(&t_end, NULL);
+	if (merged > 0) {
+		long left = ksm_pages(start, length/segp->seg_pagesize,
+					segp->seg_pagesize);
+
+		if (left < 0) {
+			int err = errno;
+			fprintf(stderr, "%s:  can't count KSM pages left "
+				"after %s - %s\n", gcp->program_name,
+				operation, strerror(err));
+			merged = -1;
+		} else
+			merged -= left;
+	}
+
+	if (merge) {
+		segp->seg_mergeable = true;
+		return SEG_OK;
+	}
+	if (offset == 0 && length == segp->seg_length)
+		segp->seg_mergeable = false;
+
+	result_record("ksm_unmerge", tv_diff_usec(&t_start, &t_end),
+			length/segp->seg_pagesize, segp->seg_pagesize, 0);
+	if (!is_option(QUIET)) {
 		printf("%s:  %s of %s [%d pages] took %6.3fsecs.\n",
 			gcp->program_name, operation, segp->seg_name,
-			(length/gcp->pagesize),
+			length/segp->seg_pagesize,
 			(float)(tv_diff_usec(&t_start, &t_end))/1000000.0);
-		
+		if (merged > 0)
+			printf("    %ld KSM pages unmerged, %.2f usecs each\n",
+				merged, (double)tv_diff_usec(&t_start, &t_end) /
+				merged);
 	}
-
 	return SEG_OK;
 }
 
+int
+segment_merge(char *name, range_t *range, int merge)
+{
+	int ret;
+
+	pthread_rwlock_wrlock(&segtable_lock);
+	ret = merge_segment(name, range, merge);
+	pthread_rwlock_unlock(&segtable_lock);
+	return ret;
+}
+
+/*
+ * segment_locks_forget() -- in a fork()ed child, which doesn't inherit
+ * memory locks:  forget all locked ranges, and MCL_FUTURE.  The child
+ * doesn't inherit our other threads either, so reset segtable_lock,
+ * which one of them may have held.
+ */
+void
+segment_locks_forget(void)
+{
+	pthread_rwlock_init(&segtable_lock, NULL);
+	forget_locks();
+}
+
 
 /*
  * =========================================================================
@@ -1372,12 +2856,15 @@ range_t* segment_range(char *segname, range_t *ret)
 {
 	segment_t *seg;
 	
+	pthread_rwlock_rdlock(&segtable_lock);
 	seg = segment_get(segname);
 	if (seg == NULL)
-		return NULL;
-
-	ret->offset = seg->seg_offset;
-	ret->length = seg->seg_length;
+		ret = NULL;
+	else {
+		ret->offset = seg->seg_offset;
+		ret->length = seg->seg_length;
+	}
+	pthread_rwlock_unlock(&segtable_lock);
 	return ret;
 }
 
@@ -1386,15 +2873,14 @@ int segment_mprotect(char *segname, int prot)
 	segment_t *seg;
 	int err;
 
+	pthread_rwlock_wrlock(&segtable_lock);
 	seg = segment_get(segname);
 	if (seg == NULL)
-		return SEG_ERR;
-
-	err = mprotect(seg->seg_start, seg->seg_length, prot);
-	if (err) {
+		err = -1;
+	else if ((err = mprotect(seg->seg_start, seg->seg_length, prot)))
 		perror("segment_mprotect ");
-		return SEG_ERR;
-	}
-	seg->seg_prot = prot;
-	return SEG_OK;
+	else
+		seg->seg_prot = prot;
+	pthread_rwlock_unlock(&segtable_lock);
+	return err ? SEG_ERR : SEG_OK;
 }
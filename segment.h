@@ -21,8 +21,19 @@
 
 #ifndef _MEMTOY_SEGMENT_H_
 #define _MEMTOY_SEGMENT_H_
+#include <sys/mman.h>
 #include <sys/shm.h>		/* need SHM_HUGETLB */
 
+/*
+ * mlock2()/mlockall() on-fault flags, for older headers
+ */
+#ifndef MLOCK_ONFAULT
+#define MLOCK_ONFAULT 0x01
+#endif
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
 /*
  * a "memory segment" known to memtoy
  */
@@ -52,6 +63,25 @@ typedef struct range {
 
 #define DEFAULT_LENGTH (size_t)(-1)
 
+/*
+ * segment_lock_unlock() 'lock' argument
+ */
+#define SEG_UNLOCK       0
+#define SEG_LOCK         1
+#define SEG_LOCK_ONFAULT 2	/* mlock2(MLOCK_ONFAULT) */
+
+#define MOVE_PAGES_SWEEP (-1L)	/* movepages batch size sweep */
+
+/*
+ * extent:  where a segment range lives, as reported to another process
+ * -- e.g., a child telling its parent -- for move_pages(2)
+ */
+typedef struct seg_extent {
+	unsigned long se_start;
+	size_t        se_length;
+	size_t        se_pagesize;
+} seg_extent_t;
+
 struct global_context;
 
 extern void segment_init(struct global_context *);
@@ -62,10 +92,22 @@ extern int segment_show(char*);
 extern int segment_remove(char*);
 extern int segment_map(char*, range_t*, int);
 extern int segment_unmap(char*);
-extern int segment_touch(char*, range_t*, int);
-extern int segment_mbind(char*, range_t*, int, nodemask_t*, int);
+extern int segment_touch(char*, range_t*, int, unsigned int);
+extern int segment_mbind(char*, range_t*, int, nodemask_t*, int, int);
+extern int segment_move_pages(char*, range_t*, nodemask_t*, long, int, int);
+extern int segment_move_pages_pid(pid_t, char*, seg_extent_t*, nodemask_t*,
+					long, int, int);
+extern int segment_extent(char*, seg_extent_t*);
+extern int segment_file(char*, int*, off_t*);
+extern int segment_prot(char*, int*, int*);
+extern int segment_extent_range(seg_extent_t*, range_t*, char*);
 extern int segment_location(char*, range_t*);
+extern long segment_node_pages(char*, int, unsigned long*, size_t*);
 extern int segment_lock_unlock(char*, range_t*, int, int);
+extern int segment_lockall(int);
+extern int segment_unlockall(void);
+extern void segment_locks_forget(void);
+extern int segment_merge(char*, range_t*, int);
 extern range_t* segment_range(char *segname, range_t *ret);
 extern int segment_mprotect(char *segname, int prot);
 
@@ -0,0 +1,425 @@
+/*
+ * memtoy:  server.c - Unix domain socket control server
+ *
+ * 'memtoy -S <socket>' listens on a Unix domain stream socket and runs
+ * commands, one per line, from any number of local clients -- e.g., a
+ * test harness that keeps populated segments in a long-lived memtoy
+ * between experiments.  Each command gets one framed response:
+ *
+ *	{OK|ERR} <length> [<key>=<value> ...]\n
+ *	<length> bytes of the command's output
+ *
+ * where the keys are the command's result record:  cmd, usecs, cpu,
+ * pages, faults, majflt and, if the command timed an operation, op,
+ * op_usecs, op_pages, op_pagesize and op_failed.  A synchronous
+ * '/<child> ...' command reports the child's result.  Commands with no
+ * result record -- unrecognized commands, 'quit', and '&' or broadcast
+ * child commands -- get no result keys.  The output is what
+ * the command wrote to stdout and stderr, including the output of
+ * children running synchronous '/<child> ...' commands.
+ *
+ * Commands run one at a time, in arrival order.  'quit' or 'exit'
+ * closes the client's connection; SIGINT stops the server.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memtoy.h"
+
+#define SERVER_BACKLOG  16
+#define SERVER_LINESZ  256	/* as for commands read from stdin */
+#define SERVER_HDRSZ   512
+
+struct server_client {
+	struct list_head scl_link;
+	int    scl_fd;
+	int    scl_id;
+	size_t scl_len;			/* bytes in scl_buf */
+	bool   scl_skip;		/* discarding an overlong line */
+	char   scl_buf[SERVER_LINESZ];
+};
+
+static LIST_HEAD(server_clients);
+static char *server_path;		/* NULL => not serving */
+static int   server_fd = -1;
+static int   server_epfd = -1;
+static int   server_capfd = -1;		/* command output capture */
+static int   server_stdout = -1, server_stderr = -1;
+
+/*
+ * server_send() - write all of 'buf' to a client.  Returns 0 on success,
+ * -1 if the client went away.
+ */
+static int
+server_send(struct server_client *sclp, char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = send(sclp->scl_fd, buf, len, MSG_NOSIGNAL);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * server_capture() - start, or with 'on' false, stop sending our stdout
+ * and stderr to the capture file.
+ */
+static void
+server_capture(bool on)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	if (on) {
+		(void)ftruncate(server_capfd, 0);
+		(void)lseek(server_capfd, 0, SEEK_SET);
+		dup2(server_capfd, STDOUT_FILENO);
+		dup2(server_capfd, STDERR_FILENO);
+	} else {
+		dup2(server_stdout, STDOUT_FILENO);
+		dup2(server_stderr, STDERR_FILENO);
+	}
+}
+
+/*
+ * server_respond() - frame and send a command's result and output
+ */
+static int
+server_respond(struct server_client *sclp, int ret, child_result_t *rp)
+{
+	glctx_t *gcp = &glctx;
+	op_result_t *orp = &gcp->result;
+	char   hdr[SERVER_HDRSZ], *output = NULL;
+	struct stat st;
+	size_t len = 0;
+	int    n;
+
+	if (!fstat(server_capfd, &st) && st.st_size > 0) {
+		output = malloc(st.st_size);
+		if (output)
+			len = pread(server_capfd, output, st.st_size, 0);
+		if ((ssize_t)len < 0)
+			len = 0;
+	}
+
+	n = snprintf(hdr, sizeof(hdr), "%s %lu", ret ? "ERR" : "OK",
+			(unsigned long)len);
+	if (*rp->cr_cmd)	/* else no result */
+		n += snprintf(hdr + n, sizeof(hdr) - n,
+			" cmd=%s usecs=%lu cpu=%lu pages=%lu faults=%lu"
+			" majflt=%lu", rp->cr_cmd, rp->cr_usecs,
+			rp->cr_cpu_usecs, rp->cr_pages, rp->cr_faults,
+			rp->cr_majflt);
+	if (orp->r_op)
+		n += snprintf(hdr + n, sizeof(hdr) - n,
+			" op=%s op_usecs=%lu op_pages=%lu op_pagesize=%lu"
+			" op_failed=%lu", orp->r_op, orp->r_usecs,
+			orp->r_pages, (unsigned long)orp->r_pagesize,
+			orp->r_failed);
+	n += snprintf(hdr + n, sizeof(hdr) - n, "\n");
+
+	if (server_send(sclp, hdr, n) < 0 ||
+	    (len && server_send(sclp, output, len) < 0)) {
+		free(output);
+		return -1;
+	}
+	free(output);
+	return 0;
+}
+
+/*
+ * server_run() - run one command line from a client.  Returns -1 if the
+ * client should be disconnected.
+ */
+static int
+server_run(struct server_client *sclp, char *cmdline)
+{
+	glctx_t *gcp = &glctx;
+	child_result_t result;
+	size_t len;
+	int    ret;
+
+	cmdline += strspn(cmdline, whitespace);
+	len = strlen(cmdline);
+	while (len && strchr(whitespace, cmdline[len-1]))
+		cmdline[--len] = '\0';
+	if (!len || *cmdline == '#')
+		return 0;	/* blank lines and comments:  no response */
+
+	vprint("%s:  client %d:  %s\n", gcp->program_name, sclp->scl_id,
+		cmdline);
+
+	memset(&result, 0, sizeof(result));
+	len = strcspn(cmdline, whitespace);
+	if ((len == 4 && !strncmp(cmdline, "quit", len)) ||
+	    (len == 4 && !strncmp(cmdline, "exit", len))) {
+		gcp->result.r_op = NULL;
+		server_capture(true);
+		server_capture(false);
+		(void)server_respond(sclp, CMD_SUCCESS, &result);
+		return -1;
+	}
+
+	server_capture(true);
+	ret = command_run(cmdline, &result);
+	server_capture(false);
+
+	return server_respond(sclp, ret, &result);
+}
+
+static void
+server_disconnect(struct server_client *sclp)
+{
+	glctx_t *gcp = &glctx;
+
+	vprint("%s:  client %d disconnected\n", gcp->program_name,
+		sclp->scl_id);
+	epoll_ctl(server_epfd, EPOLL_CTL_DEL, sclp->scl_fd, NULL);
+	list_del(&sclp->scl_link);
+	close(sclp->scl_fd);
+	free(sclp);
+}
+
+/*
+ * server_input() - read what a client sent and run each complete line.
+ * Returns -1 if the client is gone.
+ */
+static int
+server_input(struct server_client *sclp)
+{
+	glctx_t *gcp = &glctx;
+	char   *nl;
+	ssize_t ret;
+
+	ret = read(sclp->scl_fd, sclp->scl_buf + sclp->scl_len,
+			sizeof(sclp->scl_buf) - sclp->scl_len - 1);
+	if (ret < 0 && errno == EINTR)
+		return 0;
+	if (ret <= 0)
+		return -1;
+	sclp->scl_len += ret;
+	sclp->scl_buf[sclp->scl_len] = '\0';
+
+	while ((nl = strchr(sclp->scl_buf, '\n'))) {
+		char   *next = nl + 1;
+		bool    skip = sclp->scl_skip;
+
+		*nl = '\0';
+		sclp->scl_skip = false;
+		if (!skip && server_run(sclp, sclp->scl_buf) < 0)
+			return -1;
+		sclp->scl_len -= next - sclp->scl_buf;
+		memmove(sclp->scl_buf, next, sclp->scl_len + 1);
+	}
+
+	if (sclp->scl_len == sizeof(sclp->scl_buf) - 1) {
+		child_result_t result;
+
+		/*
+		 * no newline in a full buffer:  reject the line and
+		 * discard the rest of it.
+		 */
+		memset(&result, 0, sizeof(result));
+		server_capture(true);
+		fprintf(stderr, "%s:  command line too long\n",
+			gcp->program_name);
+		server_capture(false);
+		sclp->scl_len  = 0;
+		sclp->scl_skip = true;
+		if (server_respond(sclp, CMD_ERROR, &result) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+server_accept(void)
+{
+	glctx_t *gcp = &glctx;
+	static int next_id;
+	struct server_client *sclp;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	sclp = calloc(1, sizeof(*sclp));
+	if (!sclp) {
+		fprintf(stderr, "%s:  can't allocate client\n",
+			gcp->program_name);
+		close(fd);
+		return;
+	}
+	sclp->scl_fd = fd;
+	sclp->scl_id = ++next_id;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = sclp;
+	if (epoll_ctl(server_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(sclp);
+		return;
+	}
+	list_add_tail(&sclp->scl_link, &server_clients);
+	vprint("%s:  client %d connected\n", gcp->program_name, sclp->scl_id);
+}
+
+/*
+ * server_init() - create and listen on the socket, and set up output
+ * capture.  Returns 0 on success, -1 on error.
+ */
+static int
+server_init(char *path)
+{
+	glctx_t *gcp = &glctx;
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s:  socket path too long:  %s\n",
+			gcp->program_name, path);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server_fd < 0)
+		goto err;
+	if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto err;
+	server_path = path;	/* ours to unlink */
+	if (listen(server_fd, SERVER_BACKLOG) < 0)
+		goto err;
+
+	server_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_epfd < 0)
+		goto err;
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;		/* => listening socket */
+	if (epoll_ctl(server_epfd, EPOLL_CTL_ADD, server_fd, &ev) < 0)
+		goto err;
+
+	server_capfd  = memfd_create("memtoy-output", MFD_CLOEXEC);
+	server_stdout = dup(STDOUT_FILENO);
+	server_stderr = dup(STDERR_FILENO);
+	if (server_capfd < 0 || server_stdout < 0 || server_stderr < 0)
+		goto err;
+
+	return 0;
+
+err:
+	fprintf(stderr, "%s:  can't serve on %s - %s\n",
+		gcp->program_name, path, strerror(errno));
+	return -1;
+}
+
+/*
+ * serve_commands() - 'memtoy -S <socket>' main loop.  Doesn't return.
+ */
+void
+serve_commands(char *path)
+{
+	glctx_t *gcp = &glctx;
+
+	clear_option(INTERACTIVE);
+	if (server_init(path) < 0)
+		exit(4);
+	printf("%s:  serving commands on %s\n", gcp->program_name, path);
+
+	for (;;) {
+		struct epoll_event ev;
+		int nr;
+
+		nr = epoll_wait(server_epfd, &ev, 1, -1);
+		if (signalled(gcp)) {
+			int sig = gcp->siginfo->si_signo;
+
+			reset_signal();
+			if (sig == SIGINT || sig == SIGQUIT)
+				exit(0);	/* cleanup removes socket */
+		}
+		if (nr <= 0)
+			continue;
+
+		if (!ev.data.ptr)
+			server_accept();
+		else if (server_input(ev.data.ptr) < 0)
+			server_disconnect(ev.data.ptr);
+	}
+}
+
+/*
+ * server_fini() - in a new child:  the socket and the client connections
+ * belong to the parent.  The child keeps writing to the capture file, so
+ * that the output of a '/<child> ...' command is returned to the client
+ * that sent it.
+ */
+void
+server_fini(void)
+{
+	struct list_head *lp, *next;
+
+	list_for_each_safe(lp, next, &server_clients) {
+		struct server_client *sclp;
+
+		sclp = list_entry(lp, struct server_client, scl_link);
+		list_del(&sclp->scl_link);
+		close(sclp->scl_fd);
+		free(sclp);
+	}
+
+	server_path = NULL;
+	if (server_fd >= 0)
+		close(server_fd);
+	if (server_epfd >= 0)
+		close(server_epfd);
+	server_fd = server_epfd = -1;
+}
+
+/*
+ * server_cleanup() - at exit:  remove our socket
+ */
+void
+server_cleanup(void)
+{
+	if (server_path)
+		unlink(server_path);
+	server_path = NULL;
+}
@@ -0,0 +1,598 @@
+/*
+ * memtoy:  stats.c - kernel statistics snapshots around commands
+ *
+ * snapshot /proc/vmstat -- and a watched cgroup's memory.current,
+ * memory.events, memory.stat and memory.pressure -- before and after
+ * a command and report the counters that changed.  Likewise, memory
+ * pressure stall totals.  A PSI trigger monitor logs stall events as
+ * they happen.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memtoy.h"
+
+#define VMSTAT_PATH "/proc/vmstat"
+#define PSI_PATH    "/proc/pressure/memory"
+#define VMSTAT_NAMELEN 64
+
+struct vmstat_item {
+	char          vi_name[VMSTAT_NAMELEN];
+	unsigned long vi_value;
+};
+
+struct vmstat {
+	struct vmstat_item *vs_items;
+	int                 vs_nr_items;
+	int                 vs_max_items;
+};
+
+static __thread struct vmstat vmstat_before, vmstat_after;
+static __thread struct vmstat cgstat_before, cgstat_after;
+static __thread struct vmstat psi_before, psi_after;
+static __thread struct vmstat psicg_before, psicg_after;
+static __thread struct timeval psi_t_start;
+
+/*
+ * PSI trigger:  the kernel wakes a poll()er with POLLPRI when stall
+ * time in a window exceeds a threshold.  A monitor thread logs each
+ * event with its time and the command that was running.
+ */
+struct psi_trigger {
+	int            pt_fd;
+	int            pt_stop[2];	/* pipe:  wake monitor to exit */
+	pthread_t      pt_thread;
+	char           pt_path[PATH_MAX];
+	char           pt_spec[64];	/* "some|full <stall> <window>" */
+	char          *pt_program_name;
+	struct timeval pt_armed;
+	unsigned long  pt_events;
+};
+
+static struct psi_trigger *psi_trigger;
+static char * volatile     psi_cmd_name;	/* command running, if any */
+
+/*
+ * vmstat_add() - append an item to snapshot 'vsp', growing the item
+ * array as needed.  Returns 0 on success, -1 on error.
+ */
+static int
+vmstat_add(struct vmstat *vsp, char *prefix, char *name,
+		unsigned long value)
+{
+	glctx_t *gcp = &glctx;
+	struct vmstat_item *vip;
+
+	if (vsp->vs_nr_items == vsp->vs_max_items) {
+		int max_items = vsp->vs_max_items ?
+				2 * vsp->vs_max_items : 128;
+
+		vip = realloc(vsp->vs_items, max_items * sizeof(*vip));
+		if (!vip) {
+			fprintf(stderr, "%s:  can't allocate vmstat "
+				"snapshot\n", gcp->program_name);
+			return -1;
+		}
+		vsp->vs_items = vip;
+		vsp->vs_max_items = max_items;
+	}
+
+	vip = &vsp->vs_items[vsp->vs_nr_items++];
+	snprintf(vip->vi_name, sizeof(vip->vi_name), "%s%s%s",
+		prefix ? prefix : "", prefix && *name ? "." : "", name);
+	vip->vi_value = value;
+	return 0;
+}
+
+/*
+ * stat_file_read() - append the items of a statistics file to 'vsp',
+ * named "<prefix>.<name>".  Handles "<name> <value>" lines -- as in
+ * /proc/vmstat and memory.{events,stat} -- pressure stall lines:
+ * "some|full avg10=... total=<usecs>" -- and a lone value, as in
+ * memory.current, which is named just "<prefix>".
+ * Returns 0 on success, -1 on error.
+ */
+static int
+stat_file_read(struct vmstat *vsp, char *path, char *prefix)
+{
+	glctx_t *gcp = &glctx;
+	FILE    *vf;
+	char     line[256], name[VMSTAT_NAMELEN], *total;
+	unsigned long value;
+	int      ret = 0;
+
+	vf = fopen(path, "r");
+	if (!vf) {
+		int err = errno;
+		fprintf(stderr, "%s:  can't open %s - %s\n",
+			gcp->program_name, path, strerror(err));
+		return -1;
+	}
+
+	while (!ret && fgets(line, sizeof(line), vf)) {
+		if ((total = strstr(line, "total=")) &&
+		    sscanf(line, "%63s", name) == 1)
+			ret = vmstat_add(vsp, prefix, name,
+					strtoul(total + 6, NULL, 10));
+		else if (sscanf(line, "%63s %lu", name, &value) == 2)
+			ret = vmstat_add(vsp, prefix, name, value);
+		else if (sscanf(line, "%lu", &value) == 1)
+			ret = vmstat_add(vsp, prefix, "", value);
+	}
+
+	fclose(vf);
+	return ret;
+}
+
+/*
+ * stats_read_values() - look up the NULL terminated list of 'names' in
+ * statistics file 'path' -- "<name>[:] <value>" lines, as in /proc/vmstat
+ * or /proc/meminfo -- into 'values'; those not found are left alone.
+ * Returns the number found, or -1 if the file can't be read.
+ */
+int
+stats_read_values(char *path, char **names, unsigned long *values)
+{
+	FILE    *vf;
+	char     line[256], name[VMSTAT_NAMELEN];
+	unsigned long value;
+	int      i, nr_found = 0;
+
+	vf = fopen(path, "r");
+	if (!vf)
+		return -1;
+
+	while (fgets(line, sizeof(line), vf)) {
+		if (sscanf(line, "%63s %lu", name, &value) != 2)
+			continue;
+		name[strcspn(name, ":")] = '\0';
+		for (i = 0; names[i]; ++i)
+			if (!strcmp(name, names[i])) {
+				values[i] = value;
+				++nr_found;
+				break;
+			}
+	}
+
+	fclose(vf);
+	return nr_found;
+}
+
+/*
+ * vmstat_read() - snapshot /proc/vmstat into 'vsp'
+ */
+static int
+vmstat_read(struct vmstat *vsp)
+{
+	vsp->vs_nr_items = 0;
+	return stat_file_read(vsp, VMSTAT_PATH, NULL);
+}
+
+/*
+ * cgstat_read() - snapshot the watched cgroup's memory statistics
+ */
+static int
+cgstat_read(struct vmstat *vsp, char *dir)
+{
+	static char *files[] = {
+		"memory.current", "memory.events", "memory.stat",
+		"memory.pressure", NULL
+	};
+	char  path[PATH_MAX];
+	char **filep;
+
+	vsp->vs_nr_items = 0;
+	for (filep = files; *filep; ++filep) {
+		snprintf(path, sizeof(path), "%s/%s", dir, *filep);
+		if (stat_file_read(vsp, path, *filep + strlen("memory.")) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * psi_read() - snapshot "some" and "full" stall totals from a pressure
+ * file, or from the memory.pressure of cgroup directory 'path'
+ */
+static int
+psi_read(struct vmstat *vsp, char *path)
+{
+	char file[PATH_MAX];
+
+	if (strcmp(path, PSI_PATH)) {
+		snprintf(file, sizeof(file), "%s/memory.pressure", path);
+		path = file;
+	}
+	vsp->vs_nr_items = 0;
+	return stat_file_read(vsp, path, NULL);
+}
+
+/*
+ * vmstat_find() - look up 'name' in snapshot 'vsp', trying index 'hint'
+ * first:  the order of /proc/vmstat doesn't change from one read to
+ * the next.
+ */
+static struct vmstat_item *
+vmstat_find(struct vmstat *vsp, char *name, int hint)
+{
+	int i;
+
+	if (hint < vsp->vs_nr_items &&
+	    !strcmp(vsp->vs_items[hint].vi_name, name))
+		return &vsp->vs_items[hint];
+
+	for (i = 0; i < vsp->vs_nr_items; ++i)
+		if (!strcmp(vsp->vs_items[i].vi_name, name))
+			return &vsp->vs_items[i];
+	return NULL;
+}
+
+/*
+ * vmstat_show_delta() - display counters that changed between snapshots.
+ * The /proc/vmstat "nr_*" items are gauges [free pages, dirty pages, ...]
+ * that drift with unrelated system activity; show those only in verbose
+ * mode.  A cgroup's gauges -- memory.current, memory.stat sizes -- are
+ * its own, so show them.
+ */
+static void
+vmstat_show_delta(struct vmstat *before, struct vmstat *after, char *what)
+{
+	glctx_t *gcp = &glctx;
+	bool     header = false;
+	int      i;
+
+	for (i = 0; i < after->vs_nr_items; ++i) {
+		struct vmstat_item *ap = &after->vs_items[i], *bp;
+		long delta;
+
+		if (!is_option(VERBOSE) && !strncmp(ap->vi_name, "nr_", 3) &&
+		    after == &vmstat_after)
+			continue;
+
+		bp = vmstat_find(before, ap->vi_name, i);
+		if (!bp)
+			continue;	/* new counter?  ignore */
+
+		delta = (long)(ap->vi_value - bp->vi_value);
+		if (!delta)
+			continue;
+
+		if (!header) {
+			printf("%s:  %s deltas:\n", gcp->program_name, what);
+			header = true;
+		}
+		printf("    %-32s %+12ld\n", ap->vi_name, delta);
+	}
+}
+
+static unsigned long
+psi_delta(struct vmstat *before, struct vmstat *after, char *name)
+{
+	struct vmstat_item *bp, *ap;
+
+	bp = vmstat_find(before, name, 0);
+	ap = vmstat_find(after, name, 0);
+	if (!bp || !ap)
+		return 0;
+	return ap->vi_value - bp->vi_value;
+}
+
+/*
+ * psi_show_delta() - display stall time during a command of 'usecs',
+ * and as a percentage of it
+ */
+static void
+psi_show_delta(struct vmstat *before, struct vmstat *after, char *what,
+		long usecs)
+{
+	glctx_t *gcp = &glctx;
+	unsigned long some = psi_delta(before, after, "some");
+	unsigned long full = psi_delta(before, after, "full");
+
+	if (usecs <= 0)
+		usecs = 1;
+	printf("%s:  %s pressure:  some %lu full %lu usecs "
+		"[%.1f%% %.1f%% of %.3f secs]\n", gcp->program_name, what,
+		some, full, 100.0 * some / usecs, 100.0 * full / usecs,
+		(double)usecs / 1000000.0);
+}
+
+/*
+ * stats_begin() - take "before" snapshots of enabled statistics
+ */
+void
+stats_begin(void)
+{
+	glctx_t *gcp = &glctx;
+	char    *dir;
+
+	if (is_option(VMSTAT) && vmstat_read(&vmstat_before) < 0)
+		vmstat_before.vs_nr_items = 0;
+	if (!gcp->cmd_thread && (dir = cgroup_watched(NULL)) &&
+	    cgstat_read(&cgstat_before, dir) < 0)
+		cgstat_before.vs_nr_items = 0;
+
+	if (is_option(PSI)) {
+		if (psi_read(&psi_before, PSI_PATH) < 0)
+			psi_before.vs_nr_items = 0;
+		if (!gcp->cmd_thread && (dir = cgroup_current(NULL)) &&
+		    psi_read(&psicg_before, dir) < 0)
+			psicg_before.vs_nr_items = 0;
+		gettimeofday(&psi_t_start, NULL);
+	}
+	psi_cmd_name = gcp->cmd_name;
+}
+
+/*
+ * stats_end() - take "after" snapshots of enabled statistics and
+ * report what changed since stats_begin().
+ */
+void
+stats_end(void)
+{
+	glctx_t *gcp = &glctx;
+	char    *dir, *name;
+	char     what[128];
+	struct timeval t_end;
+
+	if (is_option(VMSTAT) && vmstat_before.vs_nr_items &&
+	    vmstat_read(&vmstat_after) == 0)
+		vmstat_show_delta(&vmstat_before, &vmstat_after, "vmstat");
+	vmstat_before.vs_nr_items = 0;	/* consumed */
+
+	if (!gcp->cmd_thread && (dir = cgroup_watched(&name)) &&
+	    cgstat_before.vs_nr_items &&
+	    cgstat_read(&cgstat_after, dir) == 0) {
+		snprintf(what, sizeof(what), "cgroup %s", name);
+		vmstat_show_delta(&cgstat_before, &cgstat_after, what);
+	}
+	cgstat_before.vs_nr_items = 0;
+
+	psi_cmd_name = NULL;
+	if (is_option(PSI)) {
+		gettimeofday(&t_end, NULL);
+		if (psi_before.vs_nr_items &&
+		    psi_read(&psi_after, PSI_PATH) == 0)
+			psi_show_delta(&psi_before, &psi_after, "memory",
+				tv_diff_usec(&psi_t_start, &t_end));
+		if (!gcp->cmd_thread && (dir = cgroup_current(&name)) &&
+		    psicg_before.vs_nr_items &&
+		    psi_read(&psicg_after, dir) == 0) {
+			snprintf(what, sizeof(what), "cgroup %s", name);
+			psi_show_delta(&psicg_before, &psicg_after, what,
+				tv_diff_usec(&psi_t_start, &t_end));
+		}
+	}
+	psi_before.vs_nr_items = psicg_before.vs_nr_items = 0;
+}
+
+/*
+ * stats_psi_check() - is pressure stall information available?
+ */
+int
+stats_psi_check(void)
+{
+	glctx_t *gcp = &glctx;
+
+	if (access(PSI_PATH, R_OK) == 0)
+		return 0;
+	fprintf(stderr, "%s:  no %s -- needs a kernel with CONFIG_PSI "
+		"[and not booted with psi=0]\n", gcp->program_name, PSI_PATH);
+	return -1;
+}
+
+/*
+ * psi_monitor() - PSI trigger monitor thread
+ */
+static void *
+psi_monitor(void *arg)
+{
+	struct psi_trigger *ptp = arg;
+	struct pollfd       fds[2];
+
+	fds[0].fd     = ptp->pt_fd;
+	fds[0].events = POLLPRI;
+	fds[1].fd     = ptp->pt_stop[0];
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		struct timeval now;
+		struct tm      tm;
+		char          *cmd_name;
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;		/* stop */
+		if (fds[0].revents & POLLERR) {
+			printf("%s:  psi trigger %s gone\n",
+				ptp->pt_program_name, ptp->pt_path);
+			fflush(stdout);
+			break;
+		}
+		if (!(fds[0].revents & POLLPRI))
+			continue;
+
+		gettimeofday(&now, NULL);
+		localtime_r(&now.tv_sec, &tm);
+		cmd_name = psi_cmd_name;
+		++ptp->pt_events;
+		printf("%s:  psi stall event %lu [%s] at "
+			"%02d:%02d:%02d.%06ld, +%.3f secs%s%s\n",
+			ptp->pt_program_name, ptp->pt_events, ptp->pt_spec,
+			tm.tm_hour, tm.tm_min, tm.tm_sec, (long)now.tv_usec,
+			(double)tv_diff_usec(&ptp->pt_armed, &now) / 1000000.0,
+			cmd_name ? " during " : "", cmd_name ? cmd_name : "");
+		fflush(stdout);
+	}
+	return NULL;
+}
+
+/*
+ * stats_psi_trigger() - arm a PSI trigger on pressure file 'path':
+ * log an event when 'kind' ["some" or "full"] stall time exceeds
+ * 'stall_usecs' in any 'window_usecs'.  Replaces any armed trigger.
+ * Returns 0 on success, -1 on error.
+ */
+int
+stats_psi_trigger(char *path, char *kind, unsigned long stall_usecs,
+		unsigned long window_usecs)
+{
+	glctx_t *gcp = &glctx;
+	struct psi_trigger *ptp;
+	sigset_t block, saved;
+	int      err;
+
+	stats_psi_trigger_off();
+	if (!path)
+		path = PSI_PATH;
+
+	ptp = calloc(1, sizeof(*ptp));
+	if (!ptp) {
+		fprintf(stderr, "%s:  can't allocate psi trigger\n",
+			gcp->program_name);
+		return -1;
+	}
+	ptp->pt_stop[0] = ptp->pt_stop[1] = -1;
+	snprintf(ptp->pt_path, sizeof(ptp->pt_path), "%s", path);
+	snprintf(ptp->pt_spec, sizeof(ptp->pt_spec), "%s %lu %lu", kind,
+		stall_usecs, window_usecs);
+	ptp->pt_program_name = gcp->program_name;
+
+	ptp->pt_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (ptp->pt_fd < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  can't open %s - %s\n",
+			gcp->program_name, path, strerror(err));
+		goto fail;
+	}
+	if (write(ptp->pt_fd, ptp->pt_spec, strlen(ptp->pt_spec) + 1) < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  can't arm psi trigger '%s' on %s - %s\n",
+			gcp->program_name, ptp->pt_spec, path, strerror(err));
+		if (err == EINVAL)
+			fprintf(stderr, "\tNote:  window must be 500ms to 10s"
+				" -- a multiple of 2s for non-root -- and\n"
+				"\tstall no longer than window\n");
+		goto fail;
+	}
+	if (pipe2(ptp->pt_stop, O_CLOEXEC) < 0) {
+		err = errno;
+		fprintf(stderr, "%s:  can't create psi monitor pipe - %s\n",
+			gcp->program_name, strerror(err));
+		goto fail;
+	}
+
+	/*
+	 * signals are for the main thread
+	 */
+	gettimeofday(&ptp->pt_armed, NULL);
+	sigfillset(&block);
+	pthread_sigmask(SIG_BLOCK, &block, &saved);
+	err = pthread_create(&ptp->pt_thread, NULL, psi_monitor, ptp);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (err) {
+		fprintf(stderr, "%s:  can't create psi monitor thread - %s\n",
+			gcp->program_name, strerror(err));
+		goto fail;
+	}
+
+	psi_trigger = ptp;
+	vprint("%s:  armed psi trigger '%s' on %s\n", gcp->program_name,
+		ptp->pt_spec, path);
+	return 0;
+
+fail:
+	if (ptp->pt_fd >= 0)
+		close(ptp->pt_fd);
+	if (ptp->pt_stop[0] >= 0) {
+		close(ptp->pt_stop[0]);
+		close(ptp->pt_stop[1]);
+	}
+	free(ptp);
+	return -1;
+}
+
+/*
+ * stats_psi_trigger_off() - stop the monitor and disarm the trigger
+ */
+void
+stats_psi_trigger_off(void)
+{
+	struct psi_trigger *ptp = psi_trigger;
+
+	if (!ptp)
+		return;
+	psi_trigger = NULL;
+
+	(void)write(ptp->pt_stop[1], "", 1);
+	pthread_join(ptp->pt_thread, NULL);
+	close(ptp->pt_stop[0]);
+	close(ptp->pt_stop[1]);
+	close(ptp->pt_fd);		/* disarms */
+	free(ptp);
+}
+
+/*
+ * stats_psi_show() - show psi settings and trigger
+ */
+void
+stats_psi_show(void)
+{
+	glctx_t *gcp = &glctx;
+	struct psi_trigger *ptp = psi_trigger;
+
+	printf("%s:  psi deltas %s\n", gcp->program_name,
+		show_option(PSI, off, on));
+	if (ptp)
+		printf("%s:  psi trigger '%s' on %s:  %lu events\n",
+			gcp->program_name, ptp->pt_spec, ptp->pt_path,
+			ptp->pt_events);
+}
+
+/*
+ * stats_fini() - in a fork()ed child:  the monitor thread isn't ours
+ */
+void
+stats_fini(void)
+{
+	struct psi_trigger *ptp = psi_trigger;
+
+	if (!ptp)
+		return;
+	psi_trigger = NULL;
+	close(ptp->pt_stop[0]);
+	close(ptp->pt_stop[1]);
+	close(ptp->pt_fd);
+	free(ptp);
+}
@@ -23,4 +23,4 @@
  * N.B. - version string may contain only [0-9.a-z+-]
  * else 'make tarball' will produce unintended tarball names.
  */
-#define MEMTOY_VERSION "0.16"
+#define MEMTOY_VERSION "0.41"
@@ -0,0 +1,207 @@
+/*
+ * memtoy:  workers.c - pinned worker threads
+ *
+ * run a function concurrently in a set of threads, each pinned to one
+ * of memtoy's allowed cpus, released together when all have started.
+ */
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memtoy.h"
+
+struct workers_run {
+	glctx_t         *wr_gcp;	/* creator's context */
+	worker_t        *wr_workers;
+	worker_func_t    wr_func;
+	pthread_mutex_t  wr_lock;
+	pthread_cond_t   wr_cond;
+	int              wr_go;		/* >0 => run; <0 => abort */
+};
+
+/*
+ * worker_cpus() - fill 'cpus' with the first 'nr_workers' cpus in our
+ * affinity mask, wrapping around when there are more workers than cpus.
+ */
+static void
+worker_cpus(int *cpus, int nr_workers)
+{
+	cpu_set_t allowed;
+	int       cpu, i = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 ||
+	    CPU_COUNT(&allowed) == 0) {
+		for (; i < nr_workers; ++i)
+			cpus[i] = -1;	/* don't pin */
+		return;
+	}
+
+	while (i < nr_workers) {
+		for (cpu = 0; cpu < CPU_SETSIZE && i < nr_workers; ++cpu)
+			if (CPU_ISSET(cpu, &allowed))
+				cpus[i++] = cpu;
+	}
+}
+
+static void *
+worker_thread(void *arg)
+{
+	worker_t           *wp = arg;
+	struct workers_run *wrp = wp->w_run;
+	struct timeval      t_start, t_end;
+
+	glctx = *wrp->wr_gcp;	/* creator waits for us to finish */
+
+	if (wp->w_cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(wp->w_cpu, &cpuset);
+		(void)sched_setaffinity(0, sizeof(cpuset), &cpuset);
+	}
+
+	pthread_mutex_lock(&wrp->wr_lock);
+	while (!wrp->wr_go)
+		pthread_cond_wait(&wrp->wr_cond, &wrp->wr_lock);
+	pthread_mutex_unlock(&wrp->wr_lock);
+	if (wrp->wr_go < 0)
+		return NULL;	/* aborted */
+
+	gettimeofday(&t_start, NULL);
+	wp->w_ret = wrp->wr_func(wp);
+	gettimeofday(&t_end, NULL);
+
+	wp->w_usecs = tv_diff_usec(&t_start, &t_end);
+	return NULL;
+}
+
+/*
+ * workers_run() - run 'func' in 'nr_workers' pinned threads, one per
+ * element of 'workers'.  Caller fills in w_arg for each worker.
+ * Threads are released together; returns elapsed usecs from release
+ * until the last worker finishes, or -1 if threads couldn't be created.
+ * Each worker's own elapsed time and return value are left in its
+ * worker_t.
+ */
+long
+workers_run(worker_t *workers, int nr_workers, worker_func_t func)
+{
+	glctx_t            *gcp = &glctx;
+	struct workers_run  wr;
+	struct timeval      t_start, t_end;
+	sigset_t            block, saved;
+	int                *cpus;
+	int                 i, nr_started, err = 0;
+
+	cpus = calloc(nr_workers, sizeof(*cpus));
+	if (!cpus) {
+		fprintf(stderr, "%s:  can't allocate %d workers\n",
+			gcp->program_name, nr_workers);
+		return -1;
+	}
+	worker_cpus(cpus, nr_workers);
+
+	wr.wr_gcp     = gcp;
+	wr.wr_workers = workers;
+	wr.wr_func    = func;
+	wr.wr_go      = 0;
+	pthread_mutex_init(&wr.wr_lock, NULL);
+	pthread_cond_init(&wr.wr_cond, NULL);
+
+	/*
+	 * workers inherit a signal mask that leaves signal handling,
+	 * other than faults, to the main thread.
+	 */
+	sigfillset(&block);
+	sigdelset(&block, SIGSEGV);
+	sigdelset(&block, SIGBUS);
+	pthread_sigmask(SIG_BLOCK, &block, &saved);
+
+	for (nr_started = 0; nr_started < nr_workers; ++nr_started) {
+		worker_t *wp = &workers[nr_started];
+
+		wp->w_id    = nr_started;
+		wp->w_cpu   = cpus[nr_started];
+		wp->w_run   = &wr;
+		wp->w_usecs = 0;
+		wp->w_ret   = 0;
+		err = pthread_create(&wp->w_thread, NULL, worker_thread, wp);
+		if (err)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (err)
+		fprintf(stderr, "%s:  failed to create worker thread - %s\n",
+			gcp->program_name, strerror(err));
+
+	/*
+	 * release the workers -- or send them home, if we couldn't
+	 * start all of them.
+	 */
+	pthread_mutex_lock(&wr.wr_lock);
+	wr.wr_go = err ? -1 : 1;
+	pthread_cond_broadcast(&wr.wr_cond);
+	pthread_mutex_unlock(&wr.wr_lock);
+	gettimeofday(&t_start, NULL);
+
+	for (i = 0; i < nr_started; ++i)
+		pthread_join(workers[i].w_thread, NULL);
+	gettimeofday(&t_end, NULL);
+
+	pthread_cond_destroy(&wr.wr_cond);
+	pthread_mutex_destroy(&wr.wr_lock);
+	free(cpus);
+
+	if (err)
+		return -1;
+	return tv_diff_usec(&t_start, &t_end);
+}
+
+/*
+ * workers_show_times() - summarize per worker elapsed times
+ */
+void
+workers_show_times(worker_t *workers, int nr_workers)
+{
+	long min_usecs = -1, max_usecs = 0, sum_usecs = 0;
+	int  i;
+
+	for (i = 0; i < nr_workers; ++i) {
+		long usecs = workers[i].w_usecs;
+
+		if (min_usecs < 0 || usecs < min_usecs)
+			min_usecs = usecs;
+		if (usecs > max_usecs)
+			max_usecs = usecs;
+		sum_usecs += usecs;
+	}
+
+	printf("    %d threads:  min %6.3f  avg %6.3f  max %6.3f secs\n",
+		nr_workers, (float)min_usecs/1000000.0,
+		(float)sum_usecs/nr_workers/1000000.0,
+		(float)max_usecs/1000000.0);
+}